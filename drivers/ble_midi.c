@@ -5,13 +5,46 @@
  * Exposes functions for sending MIDI notes and checking connection status.
  * Handles internal ATT read callbacks and BTstack event routing.
  *
+ * Outgoing channel messages are queued with the 13-bit millisecond timestamp
+ * of their scheduled time and sent when BTstack reports it can send: each
+ * notification packs as many queued messages as fit the negotiated MTU, so
+ * a busy connection event delays messages instead of losing them, and the
+ * receiver can restore their original spacing from the timestamps. The
+ * packet encoding itself is in ble_midi_packet.c.
+ *
+ * Incoming packets are parsed the same way in reverse: clock, transport and
+ * controller messages go to the handlers USB MIDI input uses, stamped with
+ * the sender's timestamp mapped onto the local clock rather than with their
+ * arrival time, which absorbs the connection-interval jitter of the link.
  *
  * Copyright 2025, Hiroyuki OYAMA
  *
  * SPDX-License-Identifier: BSD-3-Clause
  */
 #include "btstack.h"
+#include "drivers/async_timer.h"
+#include "drivers/ble_midi.h"
+#include "drivers/ble_midi_packet.h"
+#include "hot_path.h"
+#include "input_log.h"
+#include "latency.h"
+#include "looper.h"
+#include "midi_control.h"
 #include "midi_service.h"
+#include "midi_thru.h"
+#include "pattern_bank.h"
+#include "sysex.h"
+#include "trace.h"
+
+#define BLE_MIDI_TX_QUEUE_SIZE 64  // power of two
+#define BLE_MIDI_MAX_PAYLOAD 244   // largest notification we build (MTU 247)
+#define RX_OFFSET_CREEP 64         // received messages per 1 ms clock-offset relaxation
+
+// Requested link parameters: 7.5-15 ms connection interval, no peripheral latency.
+#define BLE_MIDI_CONN_INTERVAL_MIN 6      // x 1.25 ms
+#define BLE_MIDI_CONN_INTERVAL_MAX 12     // x 1.25 ms
+#define BLE_MIDI_CONN_LATENCY 0           // connection events
+#define BLE_MIDI_SUPERVISION_TIMEOUT 200  // x 10 ms
 
 // clang-format off
 static const uint8_t ble_advertising_data[] = {
@@ -29,6 +62,17 @@ typedef enum {
 
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 static hci_con_handle_t con_handle = HCI_CON_HANDLE_INVALID;
+static bool rx_in_sysex = false;
+static uint16_t rx_offset_ms = 0;  // sender clock -> local clock, 13-bit ms
+static bool rx_offset_valid = false;
+static uint16_t rx_offset_creep = 0;
+
+static ble_midi_message_t tx_queue[BLE_MIDI_TX_QUEUE_SIZE];
+static volatile uint16_t tx_head = 0;
+static volatile uint16_t tx_tail = 0;
+static bool tx_can_send_requested = false;
+static ble_midi_stats_t stats;
+static ble_midi_link_t link;
 
 static void start_advertising(void) {
     uint16_t adv_int_min = 800;
@@ -40,6 +84,77 @@ static void start_advertising(void) {
     gap_advertisements_enable(1);
 }
 
+static void ble_midi_request_send(void) {
+    if (!tx_can_send_requested && tx_head != tx_tail && con_handle != HCI_CON_HANDLE_INVALID) {
+        tx_can_send_requested = true;
+        att_server_request_can_send_now_event(con_handle);
+    }
+}
+
+// Sends one aggregated notification; runs on ATT_EVENT_CAN_SEND_NOW.
+static void ble_midi_drain_queue(void) {
+    tx_can_send_requested = false;
+    if (tx_head == tx_tail || con_handle == HCI_CON_HANDLE_INVALID)
+        return;
+
+    ble_midi_message_t batch[BLE_MIDI_MAX_PAYLOAD / 3];  // running status: 3 bytes a message
+    size_t count = 0;
+    for (uint16_t i = tx_tail; i != tx_head && count < sizeof(batch) / sizeof(batch[0]);
+         i = (i + 1) & (BLE_MIDI_TX_QUEUE_SIZE - 1))
+        batch[count++] = tx_queue[i];
+
+    uint16_t payload_max = att_server_get_mtu(con_handle) - 3;
+    if (payload_max > BLE_MIDI_MAX_PAYLOAD)
+        payload_max = BLE_MIDI_MAX_PAYLOAD;
+    uint8_t packet[BLE_MIDI_MAX_PAYLOAD];
+    size_t used;
+    uint16_t size = ble_midi_packet_encode(batch, count, payload_max, packet, &used);
+
+    if (att_server_notify(con_handle, MIDI_NOTE_HANDLE, packet, size) == ERROR_CODE_SUCCESS) {
+        tx_tail = (tx_tail + used) & (BLE_MIDI_TX_QUEUE_SIZE - 1);
+        stats.packets++;
+        stats.messages += used;
+        TRACE_INSTANT(TRACE_BLE_NOTIFY, used);
+    }
+    ble_midi_request_send();
+}
+
+static void ble_midi_enqueue(uint64_t time_us, const uint8_t *data, uint8_t length) {
+    uint16_t next = (tx_head + 1) & (BLE_MIDI_TX_QUEUE_SIZE - 1);
+    if (next == tx_tail) {
+        stats.dropped++;
+        return;
+    }
+    ble_midi_message_t *m = &tx_queue[tx_head];
+    m->timestamp_ms = ble_midi_timestamp(time_us);
+    m->length = length;
+    memcpy(m->data, data, length);
+    tx_head = next;
+}
+
+// GATT client events; only the result of our MTU exchange is of interest.
+static void gatt_client_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet,
+                                      uint16_t size) {
+    (void)packet_type;
+    (void)channel;
+    (void)packet;
+    (void)size;
+}
+
+/*
+ * Asks the central for a short connection interval and a large ATT MTU.
+ * Data length extension is negotiated by the controller itself, since
+ * ENABLE_LE_DATA_LENGTH_EXTENSION makes BTstack suggest the maximum length.
+ * Centrals are free to refuse; the granted values are reported via
+ * ble_midi_link().
+ */
+static void ble_midi_negotiate_link(void) {
+    gap_request_connection_parameter_update(con_handle, BLE_MIDI_CONN_INTERVAL_MIN,
+                                            BLE_MIDI_CONN_INTERVAL_MAX, BLE_MIDI_CONN_LATENCY,
+                                            BLE_MIDI_SUPERVISION_TIMEOUT);
+    gatt_client_send_mtu_negotiation(gatt_client_event_handler, con_handle);
+}
+
 // BTstack event handler that routes incoming events and manages connection state.
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
     (void)channel;
@@ -58,10 +173,38 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
             uint8_t subevent = hci_event_le_meta_get_subevent_code(packet);
             if (subevent == HCI_SUBEVENT_LE_CONNECTION_COMPLETE) {
                 con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+                link = (ble_midi_link_t){
+                    .interval = hci_subevent_le_connection_complete_get_conn_interval(packet),
+                    .latency = hci_subevent_le_connection_complete_get_conn_latency(packet),
+                    .supervision_timeout =
+                        hci_subevent_le_connection_complete_get_supervision_timeout(packet),
+                    .max_tx_octets = 27,
+                    .max_rx_octets = 27,
+                };
+                ble_midi_negotiate_link();
+            } else if (subevent == HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE) {
+                link.interval =
+                    hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+                link.latency =
+                    hci_subevent_le_connection_update_complete_get_conn_latency(packet);
+                link.supervision_timeout =
+                    hci_subevent_le_connection_update_complete_get_supervision_timeout(packet);
+                link.updates++;
+            } else if (subevent == HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE) {
+                link.max_tx_octets = hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+                link.max_rx_octets = hci_subevent_le_data_length_change_get_max_rx_octets(packet);
             }
             break;
         case HCI_EVENT_DISCONNECTION_COMPLETE:
             con_handle = HCI_CON_HANDLE_INVALID;
+            link = (ble_midi_link_t){0};
+            rx_in_sysex = false;
+            rx_offset_valid = false;  // the next central has its own clock
+            tx_tail = tx_head;
+            tx_can_send_requested = false;
+            break;
+        case ATT_EVENT_CAN_SEND_NOW:
+            ble_midi_drain_queue();
             break;
         default:
             break;
@@ -84,11 +227,154 @@ static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t a
     return 0;
 }
 
+/*
+ * Maps a sender timestamp to local time. The sender's 13-bit millisecond
+ * clock is related to ours by an unknown offset; the smallest observed
+ * (arrival - timestamp) is the sample with the least radio delay, so a
+ * running minimum of it recovers the offset and places every message at
+ * its send time plus a constant, instead of at its jittery arrival time.
+ * The offset creeps up by 1 ms every RX_OFFSET_CREEP messages so that a
+ * sender clock running slower than ours is followed.
+ */
+static uint64_t ble_midi_rx_time(uint64_t arrival_us, uint16_t timestamp_ms) {
+    uint16_t arrival_ms = ble_midi_timestamp(arrival_us);
+    uint16_t sample = (arrival_ms - timestamp_ms) & 0x1FFF;
+    int16_t lag = (int16_t)(((sample - rx_offset_ms) & 0x1FFF) << 3) >> 3;  // sign-extend 13 bits
+
+    if (!rx_offset_valid || lag < 0) {
+        rx_offset_ms = sample;
+        rx_offset_valid = true;
+        rx_offset_creep = 0;
+    } else if (++rx_offset_creep >= RX_OFFSET_CREEP) {
+        rx_offset_ms = (rx_offset_ms + 1) & 0x1FFF;
+        rx_offset_creep = 0;
+    }
+
+    uint16_t age_ms = (arrival_ms - ((timestamp_ms + rx_offset_ms) & 0x1FFF)) & 0x1FFF;
+    if (age_ms > 0x1000)  // estimate lies in the future: never report later than arrival
+        age_ms = 0;
+    return (arrival_us / 1000 - age_ms) * 1000;
+}
+
+static uint8_t ble_midi_data_length(uint8_t status) {
+    switch (status & 0xF0) {
+        case 0xC0:
+        case 0xD0:
+            return 1;
+        case 0xF0:
+            return (status == 0xF1 || status == 0xF3) ? 1 : (status == 0xF2) ? 2 : 0;
+        default:
+            return 2;
+    }
+}
+
+// Routes one complete message to the same handlers as USB MIDI input.
+static void ble_midi_dispatch(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2) {
+    stats.received++;
+    if (status < 0xF0 || status == 0xF8 || status == 0xFA)
+        input_log_midi(time_us, status, data1, data2);
+    if (status == 0xF8)
+        looper_handle_midi_tick(time_us);
+    else if (status == 0xFA)
+        looper_handle_midi_start();
+    else if ((status & 0xF0) == 0xB0 && midi_control_handle_cc(status & 0x0F, data1, data2))
+        return;
+    else if ((status & 0xF0) == 0xC0 && pattern_bank_handle_program_change(status & 0x0F, data1))
+        return;
+    else if (status < 0xF0 &&
+             !latency_calibration_receive(LATENCY_OUTPUT_BLE, status, data1, data2)) {
+        if ((status & 0xF0) == 0x90 && data2 > 0)
+            looper_record_note(time_us, data1, data2);
+        midi_thru_receive(status, data1, data2);
+    }
+}
+
+/*
+ * Parses one BLE-MIDI packet: a header byte carrying timestamp bits 12-7,
+ * then messages each preceded by a timestamp byte (bits 6-0). A status byte
+ * always follows a timestamp, so any other byte with bit 7 set is a
+ * timestamp; data bytes without a status reuse the running status. System
+ * real-time bytes may appear anywhere, even inside a SysEx, and SysEx
+ * continuation packets carry raw data right after the header.
+ */
+static void ble_midi_parse_packet(const uint8_t *packet, uint16_t size) {
+    if (size < 2 || !(packet[0] & 0x80))
+        return;
+
+    uint64_t arrival_us = time_us_64();
+    uint16_t timestamp_high = (packet[0] & 0x3F) << 7;
+    uint8_t timestamp_low = 0;
+    uint64_t time_us = arrival_us;
+    bool after_timestamp = false;
+    uint8_t status = 0;  // running status does not carry over between packets
+    uint8_t data[2] = {0, 0};
+    uint8_t count = 0;
+
+    for (uint16_t i = 1; i < size; i++) {
+        uint8_t b = packet[i];
+        if (b & 0x80 && !after_timestamp) {
+            if ((b & 0x7F) < timestamp_low)  // low 7 bits wrapped within this packet
+                timestamp_high = (timestamp_high + 0x80) & 0x1F80;
+            timestamp_low = b & 0x7F;
+            time_us = ble_midi_rx_time(arrival_us, timestamp_high | timestamp_low);
+            after_timestamp = true;
+            continue;
+        }
+        after_timestamp = false;
+
+        if (b >= 0xF8) {  // real-time: leaves running status and SysEx intact
+            ble_midi_dispatch(time_us, b, 0, 0);
+            continue;
+        }
+        if (rx_in_sysex) {
+            if (!(b & 0x80) || b == 0xF7) {
+                sysex_receive(SYSEX_PORT_BLE, &b, 1);
+                rx_in_sysex = (b != 0xF7);
+                continue;
+            }
+            rx_in_sysex = false;  // any other status aborts the SysEx
+        }
+        if (b == 0xF0) {
+            sysex_receive(SYSEX_PORT_BLE, &b, 1);
+            rx_in_sysex = true;
+            status = 0;
+            continue;
+        }
+
+        if (b & 0x80) {
+            status = b;
+            count = 0;
+        } else if (status != 0) {
+            data[count++] = b;
+        } else {
+            continue;  // data without a status
+        }
+        if (count < ble_midi_data_length(status))
+            continue;
+        ble_midi_dispatch(time_us, status, data[0], data[1]);
+        count = 0;
+        if (status >= 0xF0)  // system common messages cancel running status
+            status = 0;
+    }
+}
+
+// Handles ATT writes to the BLE-MIDI characteristic.
+static int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_handle,
+                              uint16_t transaction_mode, uint16_t offset, uint8_t *buffer,
+                              uint16_t buffer_size) {
+    (void)connection_handle;
+    (void)offset;
+    if (att_handle == MIDI_NOTE_HANDLE && transaction_mode == ATT_TRANSACTION_MODE_NONE)
+        ble_midi_parse_packet(buffer, buffer_size);
+    return 0;
+}
+
 // Initialise BTstack for BLE-MIDI and start advertising.
 void ble_midi_init() {
     l2cap_init();
     sm_init();
-    att_server_init(profile_data, att_read_callback, NULL);
+    gatt_client_init();
+    att_server_init(profile_data, att_read_callback, att_write_callback);
     hci_event_callback_registration.callback = &packet_handler;
     hci_add_event_handler(&hci_event_callback_registration);
     att_server_register_packet_handler(packet_handler);
@@ -96,16 +382,73 @@ void ble_midi_init() {
     hci_power_control(HCI_POWER_ON);
 }
 
-// Sends a Note-On followed immediately by a Note-Off (percussion “hit”).
-void ble_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity) {
+// Queues a Note-On followed immediately by a Note-Off (percussion “hit”) at `time_us`.
+void HOT_PATH_FUNC(ble_midi_send_note)(uint64_t time_us, uint8_t channel, uint8_t note,
+                                       uint8_t velocity) {
     if (con_handle == HCI_CON_HANDLE_INVALID)
         return;
 
-    uint8_t packet[] = {0x80,     0x80, (uint8_t)(0x90 | (channel & 0x0F)), note,
-                        velocity, 0x80, (uint8_t)(0x80 | (channel & 0x0F)), note,
-                        0x00};
-    att_server_notify(con_handle, MIDI_NOTE_HANDLE, packet, sizeof(packet));
+    uint8_t note_on[] = {(uint8_t)(0x90 | (channel & 0x0F)), note, velocity};
+    uint8_t note_off[] = {(uint8_t)(0x80 | (channel & 0x0F)), note, 0x00};
+    async_context_t *ctx = async_timer_async_context();
+    async_context_acquire_lock_blocking(ctx);
+    ble_midi_enqueue(time_us, note_on, sizeof(note_on));
+    ble_midi_enqueue(time_us, note_off, sizeof(note_off));
+    ble_midi_request_send();
+    async_context_release_lock(ctx);
+}
+
+// Queues a single channel message (2 or 3 bytes) stamped with `time_us`.
+void ble_midi_send_message(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2) {
+    if (con_handle == HCI_CON_HANDLE_INVALID)
+        return;
+
+    uint8_t message[] = {status, data1, data2};
+    uint8_t type = status & 0xF0;
+    uint8_t length = (type == 0xC0 || type == 0xD0) ? 2 : 3;
+    async_context_t *ctx = async_timer_async_context();
+    async_context_acquire_lock_blocking(ctx);
+    ble_midi_enqueue(time_us, message, length);
+    ble_midi_request_send();
+    async_context_release_lock(ctx);
+}
+
+/*
+ * Sends a complete SysEx message, split over as many notifications as the
+ * current MTU requires. Returns false while channel messages are still queued
+ * or if the link dropped a packet; the caller retries the whole message.
+ */
+bool ble_midi_send_sysex(const uint8_t *data, size_t len) {
+    if (con_handle == HCI_CON_HANDLE_INVALID || tx_head != tx_tail)
+        return false;
+
+    uint16_t payload_max = att_server_get_mtu(con_handle) - 3;
+    uint8_t packet[64];
+    if (payload_max > sizeof(packet))
+        payload_max = sizeof(packet);
+
+    uint16_t timestamp_ms = ble_midi_timestamp(time_us_64());
+    size_t sent = 0;
+    while (sent < len) {
+        uint16_t n =
+            ble_midi_packet_encode_sysex(data, len, &sent, timestamp_ms, payload_max, packet);
+        async_context_t *ctx = async_timer_async_context();
+        async_context_acquire_lock_blocking(ctx);
+        bool ok = att_server_notify(con_handle, MIDI_NOTE_HANDLE, packet, n) == ERROR_CODE_SUCCESS;
+        async_context_release_lock(ctx);
+        if (!ok)
+            return false;
+    }
+    return true;
 }
 
 // Returns true if a BLE MIDI connection is currently active.
-bool ble_midi_is_connected(void) { return con_handle != HCI_CON_HANDLE_INVALID; }
+bool HOT_PATH_FUNC(ble_midi_is_connected)(void) { return con_handle != HCI_CON_HANDLE_INVALID; }
+
+const ble_midi_stats_t *ble_midi_stats(void) { return &stats; }
+
+// Returns the parameters the central granted for the current connection.
+const ble_midi_link_t *ble_midi_link(void) {
+    link.mtu = (con_handle != HCI_CON_HANDLE_INVALID) ? att_server_get_mtu(con_handle) : 0;
+    return &link;
+}
@@ -5,12 +5,37 @@
  */
 #include "pico/async_context.h"
 
+#include "drivers/ble_midi.h"
+#include "hot_path.h"
+
+static ble_midi_stats_t stats;
+static ble_midi_link_t link;
+
 void ble_midi_init() { }
 
-void ble_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity) {
+void HOT_PATH_FUNC(ble_midi_send_note)(uint64_t time_us, uint8_t channel, uint8_t note,
+                                       uint8_t velocity) {
+    (void)time_us;
     (void)channel;
     (void)note;
     (void)velocity;
 }
 
-bool ble_midi_is_connected(void) { return false; }
+void ble_midi_send_message(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2) {
+    (void)time_us;
+    (void)status;
+    (void)data1;
+    (void)data2;
+}
+
+bool ble_midi_send_sysex(const uint8_t *data, size_t len) {
+    (void)data;
+    (void)len;
+    return false;
+}
+
+bool HOT_PATH_FUNC(ble_midi_is_connected)(void) { return false; }
+
+const ble_midi_stats_t *ble_midi_stats(void) { return &stats; }
+
+const ble_midi_link_t *ble_midi_link(void) { return &link; }
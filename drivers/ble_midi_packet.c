@@ -0,0 +1,74 @@
+/*
+ * ble_midi_packet.c
+ *
+ * BLE-MIDI packet encoding, kept apart from the BTstack driver so it builds
+ * and is tested on the host. A packet starts with a header byte carrying
+ * timestamp bits 12-7, and every message in it follows a timestamp byte
+ * carrying bits 6-0. A channel message with the status of the one before
+ * it in the same packet leaves the status out (running status).
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "drivers/ble_midi_packet.h"
+
+/*
+ * Encodes queued messages from `messages[0..count)` into one BLE-MIDI packet
+ * of at most `payload_max` bytes. Messages are only combined while their
+ * timestamps stay monotonic and within one low-byte rollover. Returns the
+ * packet length and stores the number of messages used.
+ */
+uint16_t ble_midi_packet_encode(const ble_midi_message_t *messages, size_t count,
+                                uint16_t payload_max, uint8_t *packet, size_t *used) {
+    uint16_t n = 0;
+    size_t i = 0;
+    uint16_t first = messages[0].timestamp_ms;
+    uint16_t previous = first;
+    uint8_t running_status = 0;
+
+    packet[n++] = 0x80 | ((first >> 7) & 0x3F);
+    for (; i < count; i++) {
+        const ble_midi_message_t *m = &messages[i];
+        uint16_t since_first = (m->timestamp_ms - first) & 0x1FFF;
+        uint16_t since_previous = (m->timestamp_ms - previous) & 0x1FFF;
+        if (i > 0 && (since_first >= 0x80 || since_previous > since_first))
+            break;
+        uint8_t skip = (m->data[0] == running_status) ? 1 : 0;
+        if (n + 1 + m->length - skip > payload_max)
+            break;
+        packet[n++] = 0x80 | (m->timestamp_ms & 0x7F);
+        for (uint8_t j = skip; j < m->length; j++) packet[n++] = m->data[j];
+        running_status = (m->data[0] < 0xF0) ? m->data[0] : 0;  // system messages cancel it
+        previous = m->timestamp_ms;
+    }
+    *used = i;
+    return n;
+}
+
+/*
+ * Encodes the next packet of the SysEx message `data[0..len)`, from byte
+ * `*sent` on, and advances `*sent` past what it took. The first packet puts
+ * a timestamp before F0; the ones after it carry raw data right after the
+ * header, and F7 gets a timestamp of its own. `payload_max` must leave room
+ * for the header, a timestamp and one byte. Returns the packet length.
+ */
+uint16_t ble_midi_packet_encode_sysex(const uint8_t *data, size_t len, size_t *sent,
+                                      uint16_t timestamp_ms, uint16_t payload_max,
+                                      uint8_t *packet) {
+    uint16_t n = 0;
+    uint8_t timestamp_low = 0x80 | (timestamp_ms & 0x7F);
+
+    packet[n++] = 0x80 | ((timestamp_ms >> 7) & 0x3F);
+    if (*sent == 0)
+        packet[n++] = timestamp_low;
+    while (*sent < len && n < payload_max) {
+        if (data[*sent] == 0xF7) {
+            if (n + 2 > payload_max)
+                break;
+            packet[n++] = timestamp_low;
+        }
+        packet[n++] = data[(*sent)++];
+    }
+    return n;
+}
@@ -4,6 +4,11 @@
  * Handles physical button state (BOOTSEL on Pico) and generates logical button events.
  * Internally uses a state machine to detect short press, long press, and release.
  *
+ * The button is sampled from a 1 ms async_context timer rather than from the
+ * main loop, so interrupts are only masked for one short BOOTSEL read per
+ * millisecond. Each event carries the time of the raw edge that started it,
+ * captured before debouncing, so the debounce delay does not shift recorded
+ * notes; the main loop only drains the resulting event queue.
  *
  * Copyright 2025, Hiroyuki OYAMA
  *
@@ -14,8 +19,12 @@
 #include "hardware/sync.h"
 #include "pico/stdlib.h"
 
+#include "drivers/async_timer.h"
 #include "drivers/button.h"
+#include "trace.h"
 
+#define BUTTON_SAMPLE_INTERVAL_MS 1
+#define BUTTON_EVENT_QUEUE_SIZE 8                  // power of two
 #define BUTTON_DEBOUNCE_COUNT 5                    // consecutive reads needed for stable state
 #define PRESS_DURATION_US (500 * 1000)             // 500 ms
 #define LONG_PRESS_DURATION_US (2000 * 1000)       // 2 s
@@ -34,6 +43,16 @@ typedef struct {
     uint64_t press_start_us;
 } button_fsm_t;
 
+typedef struct {
+    button_event_t event;
+    uint64_t time_us;
+} button_queued_event_t;
+
+static async_at_time_worker_t sample_worker;
+static button_queued_event_t event_queue[BUTTON_EVENT_QUEUE_SIZE];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+
 static bool __no_inline_not_in_flash_func(bootsel_button_raw)(void) {
     const uint CS_PIN_INDEX = 1;
 
@@ -58,11 +77,21 @@ static bool __no_inline_not_in_flash_func(bootsel_button_raw)(void) {
     return button_state;
 }
 
-static bool bootsel_button_debounce(void) {
+/*
+ * Integrates raw samples into a stable state. `edge_us` receives the time of
+ * the first raw sample of the transition that led to the current state, i.e.
+ * when the contact actually closed or opened.
+ */
+static bool bootsel_button_debounce(uint64_t now_us, uint64_t *edge_us) {
     static uint8_t counter = 0;
     static bool stable_state = false;
+    static uint64_t first_edge_us = 0;
 
-    if (bootsel_button_raw()) {
+    bool raw = bootsel_button_raw();
+    if (raw != stable_state && counter == (stable_state ? BUTTON_DEBOUNCE_COUNT : 0))
+        first_edge_us = now_us;  // leaving the stable rail: candidate edge
+
+    if (raw) {
         if (counter < BUTTON_DEBOUNCE_COUNT)
             counter++;
     } else {
@@ -73,31 +102,35 @@ static bool bootsel_button_debounce(void) {
     stable_state = (counter == BUTTON_DEBOUNCE_COUNT) ? true
                    : (counter == 0)                   ? false
                                                       : stable_state;
+    *edge_us = first_edge_us;
     return stable_state;
 }
 
 /*
- * Reads BOOTSEL button state and returns a button_event_t (see button.h).
+ * Advances the press FSM by one debounced sample and returns a
+ * button_event_t (see button.h) with its timestamp in `time_us`.
  * Maintains internal FSM to distinguish short press, long press, and release.
  */
-button_event_t button_poll_event(void) {
+static button_event_t button_fsm_update(bool current_down, uint64_t now_us, uint64_t edge_us,
+                                        uint64_t *time_us) {
     static button_fsm_t fsm = {0};
     button_event_t ev = BUTTON_EVENT_NONE;
-    bool current_down = bootsel_button_debounce();
-    uint64_t now_us = time_us_64();
+    *time_us = now_us;
 
     switch (fsm.state) {
         case BUTTON_STATE_IDLE:
             if (current_down) {
-                fsm.press_start_us = now_us;
+                fsm.press_start_us = edge_us;
                 fsm.state = BUTTON_STATE_PRESS_DOWN;
                 ev = BUTTON_EVENT_DOWN;
+                *time_us = edge_us;
             }
             break;
         case BUTTON_STATE_PRESS_DOWN:
             if (!current_down) {
                 fsm.state = BUTTON_STATE_IDLE;
                 ev = BUTTON_EVENT_CLICK_RELEASE;
+                *time_us = edge_us;
             } else if (now_us - fsm.press_start_us > PRESS_DURATION_US) {
                 fsm.state = BUTTON_STATE_HOLD_ACTIVE;
                 ev = BUTTON_EVENT_HOLD_BEGIN;
@@ -107,6 +140,7 @@ button_event_t button_poll_event(void) {
             if (!current_down) {
                 fsm.state = BUTTON_STATE_IDLE;
                 ev = BUTTON_EVENT_HOLD_RELEASE;
+                *time_us = edge_us;
             } else if (now_us - fsm.press_start_us > LONG_PRESS_DURATION_US) {
                 fsm.state = BUTTON_STATE_LONG_HOLD_ACTIVE;
                 ev = BUTTON_EVENT_LONG_HOLD_BEGIN;
@@ -116,6 +150,7 @@ button_event_t button_poll_event(void) {
             if (!current_down) {
                 fsm.state = BUTTON_STATE_IDLE;
                 ev = BUTTON_EVENT_LONG_HOLD_RELEASE;
+                *time_us = edge_us;
             } else if (now_us - fsm.press_start_us > VERY_LONG_PRESS_DURATION_US) {
                 fsm.state = BUTTON_STATE_VERY_LONG_HOLD_ACTIVE;
                 ev = BUTTON_EVENT_VERY_LONG_HOLD_BEGIN;
@@ -125,8 +160,50 @@ button_event_t button_poll_event(void) {
             if (!current_down) {
                 fsm.state = BUTTON_STATE_IDLE;
                 ev = BUTTON_EVENT_VERY_LONG_HOLD_RELEASE;
+                *time_us = edge_us;
             }
             break;
     }
     return ev;
 }
+
+// Timer worker: sample the button once and queue any resulting event.
+static void button_sample(async_context_t *ctx, async_at_time_worker_t *worker) {
+    uint64_t now_us = time_us_64();
+    uint64_t edge_us;
+    uint64_t time_us;
+    bool down = bootsel_button_debounce(now_us, &edge_us);
+    button_event_t ev = button_fsm_update(down, now_us, edge_us, &time_us);
+
+    if (ev != BUTTON_EVENT_NONE) {
+        uint8_t next = (event_head + 1) & (BUTTON_EVENT_QUEUE_SIZE - 1);
+        if (next != event_tail) {  // main loop stalled: drop rather than overwrite
+            event_queue[event_head] = (button_queued_event_t){ev, time_us};
+            event_head = next;
+            TRACE_INSTANT_AT(time_us, TRACE_BUTTON, ev);
+        }
+    }
+    async_context_add_at_time_worker_in_ms(ctx, worker, BUTTON_SAMPLE_INTERVAL_MS);
+}
+
+// Start periodic sampling on the shared async_context.
+void button_init(void) {
+    sample_worker.do_work = button_sample;
+    async_context_add_at_time_worker_in_ms(async_timer_async_context(), &sample_worker,
+                                           BUTTON_SAMPLE_INTERVAL_MS);
+}
+
+/*
+ * Returns the next queued button event, or BUTTON_EVENT_NONE. When `time_us`
+ * is not NULL it receives the event time: the raw contact edge for presses
+ * and releases, the detection time for hold thresholds.
+ */
+button_event_t button_poll_event(uint64_t *time_us) {
+    if (event_tail == event_head)
+        return BUTTON_EVENT_NONE;
+    button_queued_event_t e = event_queue[event_tail];
+    event_tail = (event_tail + 1) & (BUTTON_EVENT_QUEUE_SIZE - 1);
+    if (time_us != NULL)
+        *time_us = e.time_us;
+    return e.event;
+}
@@ -12,8 +12,13 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "drivers/ble_midi.h"
 #include "ghost_note.h"
+#include "latency.h"
 #include "looper.h"
+#include "midi_thru.h"
+#include "pattern_bank.h"
+#include "tap_tempo.h"
 
 #define ANSI_BLACK "\x1b[30m"
 #define ANSI_BRIGHT_BLACK "\x1b[90m"
@@ -36,19 +41,17 @@
 #define ANSI_DISABLE_ALTSCREEN "\x1b[?1049l"
 
 // Prints a single track row with step highlighting and note indicators.
-static void print_track(const track_t *track, uint8_t track_number, bool is_selected) {
+static void print_track(const track_t *track, const looper_pattern_t *pattern,
+                        uint8_t track_number, bool is_selected) {
     if (is_selected)
-        printf("#track %u > %-11s ", track_number + 1, track->name);
+        printf("#track %2u > %-11s ", track_number + 1, track->name);
     else
-        printf("#track %u _ %-11s ", track_number + 1, track->name);
+        printf("#track %2u _ %-11s ", track_number + 1, track->name);
 
-    ghost_parameters_t *params = ghost_note_parameters();
     for (int i = 0; i < LOOPER_TOTAL_STEPS; ++i) {
-        bool note_on = track->pattern[i];
-        bool ghost_on =
-            ((float)track->ghost_notes[i].probability / 100.0f) * params->ghost_intensity >
-            (float)track->ghost_notes[i].rand_sample / 100.0f;
-        bool fill_on = track->fill_pattern[i];
+        bool note_on = looper_pattern_hit(pattern, track_number, i);
+        bool ghost_on = ghost_note_is_active(&pattern->ghost_notes[i][track_number]);
+        bool fill_on = looper_pattern_fill(pattern, track_number, i);
         if (note_on)
             printf("*");
         else if (fill_on)
@@ -62,7 +65,7 @@ static void print_track(const track_t *track, uint8_t track_number, bool is_sele
 }
 
 static void print_step(uint8_t current_step) {
-    printf("#step                  ");
+    printf("#step                   ");
     for (int i = 0; i < LOOPER_TOTAL_STEPS; ++i) {
         if (i == current_step)
             printf("^");
@@ -74,7 +77,7 @@ static void print_step(uint8_t current_step) {
 
 // Displays the looper's playback state, connection status, and track patterns.
 void display_update_looper_status(bool output_connected, const looper_status_t *looper,
-                                  const track_t *tracks, size_t num_tracks) {
+                                  const track_t *tracks, const looper_pattern_t *pattern) {
     const char *state_label = "WAITING";
     if (output_connected) {
         switch (looper->state) {
@@ -98,13 +101,52 @@ void display_update_looper_status(bool output_connected, const looper_status_t *
     }
     printf("#state %s\n", state_label);
 
-    printf("#bpm %3lu\n", looper->bpm);
+    printf("#bpm %3lu.%02lu\n", (unsigned long)(looper->bpm_x100 / 100),
+           (unsigned long)(looper->bpm_x100 % 100));
+    if (looper->state == LOOPER_STATE_TAP_TEMPO && taptempo_active())
+        printf("#tap confidence=%u%%\n", taptempo_get_confidence());
 
-    printf("#grid                  1   2   3   4   5   6   7   8\n");
+    if (ble_midi_is_connected()) {
+        const ble_midi_stats_t *ble = ble_midi_stats();
+        const ble_midi_link_t *link = ble_midi_link();
+        // A notification waits at most one connection event (plus any peripheral latency).
+        uint32_t worst_us = link->interval * 1250u * (1u + link->latency);
+        printf("#ble interval=%u.%02ums latency=%u timeout=%ums mtu=%u dle=%u/%u "
+               "worst=%lu.%02lums\n",
+               link->interval * 125 / 100, link->interval * 125 % 100, link->latency,
+               link->supervision_timeout * 10, link->mtu, link->max_tx_octets,
+               link->max_rx_octets, (unsigned long)(worst_us / 1000),
+               (unsigned long)((worst_us % 1000) / 10));
+        printf("#ble packets=%lu messages=%lu drop=%lu rx=%lu\n", (unsigned long)ble->packets,
+               (unsigned long)ble->messages, (unsigned long)ble->dropped,
+               (unsigned long)ble->received);
+    }
+
+    printf("#bank %u", pattern_bank_current() + 1);
+    if (pattern_bank_pending() >= 0)
+        printf(" next=%d", pattern_bank_pending() + 1);
+    if (pattern_bank_song_playing() && pattern_bank_song_position() < PATTERN_BANK_SONG_LENGTH)
+        printf(" song=%u", pattern_bank_song_position() + 1);
+    printf("\n");
+
+    const latency_offsets_t *latency = latency_offsets();
+    printf("#latency input=%ldus usb=%ldus ble=%ldus%s\n", (long)latency->input_us,
+           (long)latency->output_us[LATENCY_OUTPUT_USB],
+           (long)latency->output_us[LATENCY_OUTPUT_BLE],
+           latency_calibration_mode() != LATENCY_CALIBRATION_IDLE ? " calibrating" : "");
+
+    if (midi_thru_is_enabled()) {
+        const midi_thru_stats_t *thru = midi_thru_stats();
+        printf("#thru fwd=%lu drop=%lu max_latency=%luus max_write=%luus\n",
+               (unsigned long)thru->forwarded, (unsigned long)thru->dropped,
+               (unsigned long)thru->max_latency_us, (unsigned long)thru->max_write_us);
+    }
+
+    printf("#grid                   1   2   3   4   5   6   7   8\n");
 
     // Display tracks in order from cymbals to basses, like a typical drum machine.
-    for (int8_t i = num_tracks - 1; i >= 0; i--)
-        print_track(&tracks[i], i, i == looper->current_track);
+    for (int8_t i = looper->num_tracks - 1; i >= 0; i--)
+        print_track(&tracks[i], pattern, i, i == looper->current_track);
     print_step(looper->current_step);
     fflush(stdout);
 }
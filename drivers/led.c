@@ -3,18 +3,22 @@
  *
  * LED driver module: Controls the built-in LED on Raspberry Pi Pico and Pico W.
  * Provides initialization, state setting, and update functions for the status LED.
+ * The LED is written only when its level changes: on Pico W every write is
+ * an SPI transaction to the wireless chip, which shares the bus with BLE.
  *
  * Copyright 2025, Hiroyuki OYAMA
  *
  * SPDX-License-Identifier: BSD-3-Clause
  */
+#include "hot_path.h"
 #include "pico/stdlib.h"
 
 #ifdef CYW43_WL_GPIO_LED_PIN
 #include "pico/cyw43_arch.h"
 #endif
 
-static bool status_led_on = false;
+static volatile bool status_led_on = false;
+static bool status_led_written = false;  // Level the LED shows
 
 /**
  * Initialize the status LED hardware.
@@ -27,24 +31,30 @@ void led_init(void) {
 #if defined(PICO_DEFAULT_LED_PIN)
     gpio_init(PICO_DEFAULT_LED_PIN);
     gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
+    gpio_put(PICO_DEFAULT_LED_PIN, false);
 #elif defined(CYW43_WL_GPIO_LED_PIN)
     cyw43_arch_init();
+    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
 #endif
 }
 
 /*
- * Controls the built-in LED on the Pico.
- * Used for indicating the active track or recording.
+ * Controls the built-in LED on the Pico. Set by the LED pattern engine
+ * (src/led_pattern.c) and shown by the next led_update().
  */
-void led_set(bool on) { status_led_on = on; }
+void HOT_PATH_FUNC(led_set)(bool on) { status_led_on = on; }
 
 /*
- * Manages LED blinking
+ * Called from the main loop: writes the LED if its level changed.
  */
 void led_update(void) {
+    bool on = status_led_on;
+    if (on == status_led_written)
+        return;
+    status_led_written = on;
 #if defined(PICO_DEFAULT_LED_PIN)
-    gpio_put(PICO_DEFAULT_LED_PIN, status_led_on);
+    gpio_put(PICO_DEFAULT_LED_PIN, on);
 #elif defined(CYW43_WL_GPIO_LED_PIN)
-    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, status_led_on);
+    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, on);
 #endif
 }
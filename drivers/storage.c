@@ -5,21 +5,44 @@
  */
 #include <string.h>
 
+#include "drivers/async_timer.h"
 #include "hardware/flash.h"
+#include "hot_path.h"
+#include "latency.h"
 #include "looper.h"
+#include "pattern_bank.h"
 #include "pico/flash.h"
 
 #ifndef GHOST_FLASH_BANK_STORAGE_OFFSET
 #define GHOST_FLASH_BANK_STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE * 4)
 #endif
 
-#define MAGIC_HEADER "GHST"
-#define NUM_TRACKS 4
+#ifndef GHOST_FLASH_LATENCY_STORAGE_OFFSET
+#define GHOST_FLASH_LATENCY_STORAGE_OFFSET (GHOST_FLASH_BANK_STORAGE_OFFSET + FLASH_SECTOR_SIZE)
+#endif
+
+#define MAGIC_HEADER "GHSM"
+#define LEGACY_MAGIC_HEADER "GHST"  // single pattern set, before pattern banks
+#define LEGACY_NUM_TRACKS 4
+#define LATENCY_MAGIC_HEADER "GHLT"
+
+typedef struct {
+    uint32_t magic;
+    bool pattern[LEGACY_NUM_TRACKS][LOOPER_TOTAL_STEPS];
+} storage_legacy_pattern_t;
 
+// Spans more than one flash page; written a page at a time.
 typedef struct {
     uint32_t magic;
-    bool pattern[NUM_TRACKS][LOOPER_TOTAL_STEPS];
+    pattern_bank_set_t banks;
 } storage_pattern_t;
+_Static_assert(sizeof(storage_pattern_t) <= FLASH_SECTOR_SIZE,
+               "the banks must fit the one sector erased before each save");
+
+typedef struct {
+    uint32_t magic;
+    latency_offsets_t offsets;
+} storage_latency_t;
 
 typedef struct {
     bool op_is_erase;
@@ -27,6 +50,8 @@ typedef struct {
     uintptr_t p1;
 } mutation_operation_t;
 
+static volatile bool store_pending = false;
+
 static void flash_bank_perform_operation(void *param) {
     const mutation_operation_t *mop = (const mutation_operation_t *)param;
     if (mop->op_is_erase) {
@@ -36,41 +61,112 @@ static void flash_bank_perform_operation(void *param) {
     }
 }
 
+// Patterns saved before banks existed become bank 1.
+static bool storage_load_legacy_tracks(pattern_bank_set_t *banks) {
+    const storage_legacy_pattern_t *data =
+        (const storage_legacy_pattern_t *)(XIP_BASE + GHOST_FLASH_BANK_STORAGE_OFFSET);
+    if (memcmp(&data->magic, LEGACY_MAGIC_HEADER, sizeof(data->magic)) != 0)
+        return false;
+
+    memset(banks->hits, 0, sizeof(banks->hits));
+    for (size_t t = 0; t < LEGACY_NUM_TRACKS && t < LOOPER_MAX_TRACKS; t++) {
+        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+            if (data->pattern[t][i])
+                banks->hits[0][i] |= TRACK_BIT(t);
+        }
+    }
+    banks->num_tracks = LEGACY_NUM_TRACKS;
+    return true;
+}
+
 bool storage_load_tracks(void) {
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
+    pattern_bank_set_t *banks = pattern_bank_set();
 
     const storage_pattern_t *data =
         (const storage_pattern_t *)(XIP_BASE + GHOST_FLASH_BANK_STORAGE_OFFSET);
-    if (memcmp(&data->magic, MAGIC_HEADER, sizeof(data->magic)) != 0)
-        return false;
-
-    for (size_t t = 0; t < num_tracks; t++) {
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
-            tracks[t].pattern[i] = data->pattern[t][i];
+    if (memcmp(&data->magic, MAGIC_HEADER, sizeof(data->magic)) == 0 &&
+        data->banks.current < PATTERN_BANK_COUNT) {
+        *banks = data->banks;
+        for (size_t i = 0; i < PATTERN_BANK_SONG_LENGTH; i++) {
+            if (banks->song[i].bank >= PATTERN_BANK_COUNT)  // table ends at the first bad entry
+                memset(&banks->song[i], 0, sizeof(banks->song[0]) * (PATTERN_BANK_SONG_LENGTH - i));
         }
+    } else if (!storage_load_legacy_tracks(banks)) {
+        return false;
     }
+
+    looper_set_num_tracks(banks->num_tracks);
+    pattern_bank_unpack(banks->current, looper_pattern_get());
     return true;
 }
 
-bool storage_erase_tracks(void) {
+/*
+ * Erases the banks' sector and writes every bank, after folding the live
+ * pattern back into the playing one. The image is taken under the async
+ * context lock, so the step timer never leaves it half updated; the flash is
+ * written outside it. Only storage_task() calls this.
+ */
+static bool storage_store_tracks(void) {
+    static storage_pattern_t image;
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    pattern_bank_set_t *banks = pattern_bank_set();
+    banks->num_tracks = looper_status_get()->num_tracks;
+    pattern_bank_pack(banks->current, looper_pattern_get());
+    memcpy(&image.magic, MAGIC_HEADER, sizeof(image.magic));
+    image.banks = *banks;
+    async_context_release_lock(async_timer_async_context());
+
     mutation_operation_t erase = {.op_is_erase = true, .p0 = GHOST_FLASH_BANK_STORAGE_OFFSET};
     flash_safe_execute(flash_bank_perform_operation, &erase, UINT32_MAX);
+    for (size_t offset = 0; offset < sizeof(image); offset += FLASH_PAGE_SIZE) {
+        uint8_t storage[FLASH_PAGE_SIZE];
+        memset(storage, 0xFF, sizeof(storage));
+        size_t length = sizeof(image) - offset;
+        memcpy(storage, (const uint8_t *)&image + offset,
+               length < FLASH_PAGE_SIZE ? length : FLASH_PAGE_SIZE);
+        mutation_operation_t program = {.op_is_erase = false,
+                                        .p0 = GHOST_FLASH_BANK_STORAGE_OFFSET + offset,
+                                        .p1 = (uintptr_t)storage};
+        flash_safe_execute(flash_bank_perform_operation, &program, UINT32_MAX);
+    }
+
     return true;
 }
 
-bool storage_store_tracks(void) {
-    uint8_t storage[FLASH_PAGE_SIZE];
-    storage_pattern_t *data = (storage_pattern_t *)&storage;
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
+// Asks the main loop to save the banks; the step timer calls this instead of writing flash.
+void HOT_PATH_FUNC(storage_request_store_tracks)(void) { store_pending = true; }
 
-    memcpy(&data->magic, MAGIC_HEADER, sizeof(data->magic));
-    for (size_t t = 0; t < NUM_TRACKS; t++) {
-        memcpy(data->pattern[t], tracks[t].pattern, sizeof(tracks[t].pattern));
-    }
-    mutation_operation_t program = {
-        .op_is_erase = false, .p0 = GHOST_FLASH_BANK_STORAGE_OFFSET, .p1 = (uintptr_t)storage};
+// Called from the main loop: saves the banks when a save was asked for.
+void storage_task(void) {
+    if (!store_pending)
+        return;
+    store_pending = false;
+    storage_store_tracks();
+}
+
+bool storage_load_latency(latency_offsets_t *offsets) {
+    const storage_latency_t *data =
+        (const storage_latency_t *)(XIP_BASE + GHOST_FLASH_LATENCY_STORAGE_OFFSET);
+    if (memcmp(&data->magic, LATENCY_MAGIC_HEADER, sizeof(data->magic)) != 0)
+        return false;
+
+    *offsets = data->offsets;
+    return true;
+}
+
+// Latency offsets live in their own sector, so erasing the patterns keeps them.
+bool storage_store_latency(const latency_offsets_t *offsets) {
+    uint8_t storage[FLASH_PAGE_SIZE] = {0};
+    storage_latency_t *data = (storage_latency_t *)&storage;
+
+    memcpy(&data->magic, LATENCY_MAGIC_HEADER, sizeof(data->magic));
+    data->offsets = *offsets;
+
+    mutation_operation_t erase = {.op_is_erase = true, .p0 = GHOST_FLASH_LATENCY_STORAGE_OFFSET};
+    flash_safe_execute(flash_bank_perform_operation, &erase, UINT32_MAX);
+    mutation_operation_t program = {.op_is_erase = false,
+                                    .p0 = GHOST_FLASH_LATENCY_STORAGE_OFFSET,
+                                    .p1 = (uintptr_t)storage};
     flash_safe_execute(flash_bank_perform_operation, &program, UINT32_MAX);
 
     return true;
@@ -4,9 +4,16 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 #include "bsp/board_api.h"
-#include "ghost_note.h"
+#include "hot_path.h"
+#include "input_log.h"
+#include "latency.h"
 #include "looper.h"
+#include "midi_control.h"
+#include "midi_thru.h"
+#include "pattern_bank.h"
 #include "pico/bootrom.h"
+#include "sysex.h"
+#include "trace.h"
 #include "tusb.h"
 
 #define _PID_MAP(itf, n) ((CFG_TUD_##itf) << (n))
@@ -135,12 +142,13 @@ void usb_midi_init(void) {
     }
 }
 
-bool usb_midi_is_connected(void) { return tud_mounted(); }
+bool HOT_PATH_FUNC(usb_midi_is_connected)(void) { return tud_mounted(); }
 
-void usb_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity) {
+void HOT_PATH_FUNC(usb_midi_send_note)(uint8_t channel, uint8_t note, uint8_t velocity) {
     uint8_t const cable_num = 0;
     // Send Note On for current position at full velocity (127) on channel 1.
     uint8_t note_on[] = {0x90 | channel, note, velocity};
+    TRACE_INSTANT(TRACE_USB_WRITE, note_on[0] << 8 | note);
     tud_midi_stream_write(cable_num, note_on, sizeof(note_on));
 
     // Send Note Off for previous note.
@@ -148,71 +156,41 @@ void usb_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity) {
     tud_midi_stream_write(cable_num, note_off, sizeof(note_off));
 }
 
-static inline int clamp(int x, int lo, int hi) {
-    if (x < lo)
-        return lo;
-    if (x > hi)
-        return hi;
-    return x;
+/*
+ * Sends one channel message as a single USB-MIDI packet, so it can never be
+ * split around other traffic. Returns false if the endpoint FIFO is full.
+ */
+bool usb_midi_send_message(uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t const cable_num = 0;
+    uint8_t packet[4] = {cable_num << 4 | status >> 4, status, data1, data2};
+    TRACE_INSTANT(TRACE_USB_WRITE, status << 8 | data1);
+    return tud_midi_packet_write(packet);
 }
 
-enum {
-    MIDI_CC_SOUND_CONTROLLER1 = 70,
-    MIDI_CC_SOUND_CONTROLLER2 = 71,
-    MIDI_CC_SOUND_CONTROLLER3 = 72,
-    MIDI_CC_SOUND_CONTROLLER4 = 73,
-    MIDI_CC_SOUND_CONTROLLER5 = 74,
-    MIDI_CC_SOUND_CONTROLLER6 = 75,
-    MIDI_CC_SOUND_CONTROLLER7 = 76,
-    MIDI_CC_SOUND_CONTROLLER8 = 77,
-    MIDI_CC_SOUND_CONTROLLER9 = 78,
-    MIDI_CC_SOUND_CONTROLLER10 = 79,
-    MIDI_CC_SOUND_CONTROLLER11 = 80,
-};
-
-static void update_ghost_parameters(uint8_t channel, uint8_t cc, uint8_t value) {
-    (void)channel;
-    ghost_parameters_t *params = ghost_note_parameters();
-    switch (cc) {
-        case MIDI_CC_SOUND_CONTROLLER1:
-            params->ghost_intensity = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER2:  // euclidean k_max (1-16)
-            params->euclidean.k_max = (uint8_t)clamp((int)value, 1, 16);
-            break;
-        case MIDI_CC_SOUND_CONTROLLER3:  // euclidean k_sufficient (0-k_max)
-            params->euclidean.k_sufficient =
-                (uint8_t)clamp((int)value, 0, params->euclidean.k_max);
-            break;
-        case MIDI_CC_SOUND_CONTROLLER4:  // euclidean k_intensity (0.0-1.0)
-            params->euclidean.k_intensity = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER5:  // euclidean probability (0.0-1.0)
-            params->euclidean.probability = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER6:  // boundary before_probability (0.0-1.0)
-            params->boundary.before_probability = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER7:  // boundary after_probability (0.0-1.0)
-            params->boundary.after_probability = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER8:  // fill start_mean (0.0-MAX_MEAN)
-            params->fill.start_mean = (value / 127.0f) * 32;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER9:  // fill start_sd (0.0-MAX_SD)
-            params->fill.start_sd = (value / 127.0f) * 16;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER10:  // fill probability (0.0-1.0)
-            params->fill.probability = value / 127.0f;
-            break;
-        case MIDI_CC_SOUND_CONTROLLER11:  // fill interval_bar (0, 2, 4, 8, 16)
-            params->fill.interval_bar = (value / 127.0f) * 16;
-            break;
-        default:
+/*
+ * Writes a SysEx message as USB-MIDI packets without blocking.
+ * Returns the number of bytes consumed; call again with the remainder
+ * when the endpoint FIFO was full.
+ */
+size_t usb_midi_send_sysex(const uint8_t *data, size_t len) {
+    uint8_t const cable_num = 0;
+    size_t sent = 0;
+    while (sent < len) {
+        size_t n = (len - sent < 3) ? len - sent : 3;
+        uint8_t packet[4] = {cable_num << 4 | 0x04, 0, 0, 0};
+        memcpy(&packet[1], &data[sent], n);
+        if (data[sent + n - 1] == 0xF7)
+            packet[0] = cable_num << 4 | (0x04 + n);  // CIN 5/6/7: SysEx ends with n bytes
+        if (!tud_midi_packet_write(packet))
             break;
+        sent += n;
     }
+    return sent;
 }
 
+// True when the USB stack has events queued by its interrupt, or MIDI input is waiting.
+bool usb_midi_task_ready(void) { return tud_task_event_ready() || tud_midi_available(); }
+
 void usb_midi_task(void) {
     tud_task();
 
@@ -222,11 +200,25 @@ void usb_midi_task(void) {
         uint8_t status = packet[1];
         uint8_t channel = status & 0x0F;
         uint8_t message = status & 0xF0;
+        uint8_t cin = packet[0] & 0x0F;
+        if ((cin >= 0x08 && cin <= 0x0E) ||
+            (packet[0] == 0x0F && (status == 0xF8 || status == 0xFA)))
+            input_log_midi(time_us_64(), status, packet[2], packet[3]);
         if (packet[0] == 0x0F && status == 0xF8)
-            looper_handle_midi_tick();
+            looper_handle_midi_tick(time_us_64());
         else if (packet[0] == 0x0F && status == 0xFA)
             looper_handle_midi_start();
-        else if (message == 0xB0)
-            update_ghost_parameters(channel, packet[2], packet[3]);
+        else if (message == 0xB0 && midi_control_handle_cc(channel, packet[2], packet[3]))
+            continue;
+        else if (message == 0xC0 && pattern_bank_handle_program_change(channel, packet[2]))
+            continue;
+        else if (cin >= 0x04 && cin <= 0x07)  // SysEx start/continue/end
+            sysex_receive(SYSEX_PORT_USB, &packet[1], (cin == 0x04) ? 3 : cin - 0x04);
+        else if (cin >= 0x08 && cin <= 0x0E &&  // channel voice message
+                 !latency_calibration_receive(LATENCY_OUTPUT_USB, status, packet[2], packet[3])) {
+            if (message == 0x90 && packet[3] > 0)
+                looper_record_note(time_us_64(), packet[2], packet[3]);
+            midi_thru_receive(status, packet[2], packet[3]);
+        }
     }
 }
@@ -0,0 +1,83 @@
+/*
+ * looper_bench.c
+ *
+ * Measures the host CPU time of the step path: the step timer with its
+ * state machine, ghost notes and display output, the note workers it
+ * schedules, and the main loop tasks that dispatch the notes. Every track
+ * plays on every step, the worst case for the scheduler. The virtual clock
+ * jumps from deadline to deadline, so only the work itself is timed.
+ *
+ *   looper_bench [steps] [tracks]
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/usb_midi.h"
+#include "host/hal.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "midi_thru.h"
+#include "note_scheduler.h"
+#include "pattern_bank.h"
+#include "sysex.h"
+
+#define BENCH_DEFAULT_STEPS 100000
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    long steps = (argc > 1) ? strtol(argv[1], NULL, 10) : BENCH_DEFAULT_STEPS;
+    long num_tracks = (argc > 2) ? strtol(argv[2], NULL, 10) : LOOPER_DEFAULT_TRACKS;
+    if (steps < 1 || num_tracks < 1 || num_tracks > LOOPER_MAX_TRACKS) {
+        fprintf(stderr, "usage: %s [steps] [tracks 1-%u]\n", argv[0], LOOPER_MAX_TRACKS);
+        return 1;
+    }
+    if (freopen("/dev/null", "w", stdout) == NULL)  // the step display prints every step
+        return 1;
+
+    async_timer_init();
+    looper_set_num_tracks(num_tracks);
+    looper_pattern_t *pattern = looper_pattern_get();
+    for (size_t step = 0; step < LOOPER_TOTAL_STEPS; step++)
+        pattern->hits[step] = looper_active_tracks();
+    looper_schedule_step_timer();
+    midi_control_init();
+    note_scheduler_init();
+    midi_thru_init();
+
+    uint64_t busy_ns = 0;
+    size_t notes = 0;
+    for (long performed = 0; performed < steps;) {
+        uint64_t next_us = host_async_next_time();
+        if (next_us == looper_status_get()->timing.next_step_us)
+            performed++;
+        uint64_t start_ns = bench_now_ns();
+        host_async_run_until(next_us);
+        looper_handle_input();
+        usb_midi_task();
+        sysex_task();
+        note_scheduler_dispatch_pending();
+        midi_thru_task();
+        pattern_bank_task();
+        busy_ns += bench_now_ns() - start_ns;
+
+        size_t count;
+        host_usb_midi_sent(&count);
+        notes += count / 2;
+        host_usb_midi_clear();
+    }
+
+    fprintf(stderr, "steps=%ld tracks=%ld notes=%zu ns/step=%.1f\n", steps, num_tracks, notes,
+            (double)busy_ns / steps);
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Host shim for hardware/flash.h. Flash is a RAM array that behaves like
+ * NOR flash: erase sets a sector to 0xFF, programming can only clear bits.
+ * XIP_BASE points at the array, so reads through the XIP window work.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+extern uint8_t host_flash_memory[PICO_FLASH_SIZE_BYTES];
+
+#define XIP_BASE ((uintptr_t)host_flash_memory)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
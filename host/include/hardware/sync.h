@@ -0,0 +1,42 @@
+/*
+ * Host shim for hardware/sync.h and the critical section API. The host
+ * build is single threaded, so sections only check their nesting.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    bool entered;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t *cs) { cs->entered = false; }
+
+static inline void critical_section_enter_blocking(critical_section_t *cs) {
+    assert(!cs->entered);
+    cs->entered = true;
+}
+
+static inline void critical_section_exit(critical_section_t *cs) {
+    assert(cs->entered);
+    cs->entered = false;
+}
+
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+
+// Nothing else runs on the host, so there is no event to send or wait for.
+static inline void __sev(void) {}
+
+static inline void __wfe(void) {}
+
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __no_inline_not_in_flash_func(func_name) __attribute__((noinline)) func_name
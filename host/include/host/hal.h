@@ -0,0 +1,67 @@
+/*
+ * Control side of the host HAL shim. Firmware code sees the usual Pico SDK
+ * and driver headers; a test or benchmark drives time, input and the
+ * simulated peripherals through these calls and inspects what came out.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "drivers/button.h"
+#include "pico/async_context.h"
+
+#ifndef HOST_USB_MIDI_CAPTURE_SIZE
+#define HOST_USB_MIDI_CAPTURE_SIZE 4096  // Sent messages kept for inspection
+#endif
+
+#define HOST_USB_MIDI_INPUT_SIZE 256   // Queued incoming USB-MIDI packets
+#define HOST_USB_MIDI_SYSEX_SIZE 1024  // Sent SysEx bytes kept for inspection
+#define HOST_BUTTON_QUEUE_SIZE 64      // Queued button events
+#define HOST_STDIN_SIZE 1024           // Queued console input bytes
+
+// Microseconds a worker is held up past its deadline before it runs.
+typedef uint32_t (*host_async_stall_t)(async_at_time_worker_t *worker);
+
+// One message written to the USB-MIDI endpoint, stamped with the virtual clock.
+typedef struct {
+    uint64_t time_us;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} host_midi_message_t;
+
+void host_clock_set(uint64_t time_us);
+
+void host_clock_advance(uint64_t delta_us);
+
+uint64_t host_async_next_time(void);
+
+size_t host_async_run_until(uint64_t time_us);
+
+void host_async_reset(void);
+
+void host_async_set_stall(host_async_stall_t hook);
+
+void host_flash_erase_all(void);
+
+bool host_stdin_push(const char *text);
+
+void host_usb_midi_set_connected(bool connected);
+
+bool host_usb_midi_inject(uint8_t status, uint8_t data1, uint8_t data2);
+
+const host_midi_message_t *host_usb_midi_sent(size_t *count);
+
+void host_usb_midi_clear(void);
+
+const uint8_t *host_usb_midi_sysex(size_t *length);
+
+void host_usb_midi_sysex_clear(void);
+
+bool host_button_push(button_event_t event, uint64_t time_us);
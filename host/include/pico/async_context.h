@@ -0,0 +1,38 @@
+/*
+ * Host shim for pico/async_context.h. A single simulated context runs
+ * at-time workers in deadline order as the virtual clock is advanced;
+ * workers due at the same time fire in the order they were added.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/time.h"
+
+typedef struct async_context {
+    uint32_t lock_depth;
+} async_context_t;
+
+typedef struct async_work_on_timeout {
+    struct async_work_on_timeout *next;
+    void (*do_work)(async_context_t *context, struct async_work_on_timeout *timeout);
+    absolute_time_t next_time;
+    void *user_data;
+} async_at_time_worker_t;
+
+bool async_context_add_at_time_worker_at(async_context_t *context, async_at_time_worker_t *worker,
+                                         absolute_time_t at);
+
+bool async_context_add_at_time_worker_in_ms(async_context_t *context,
+                                            async_at_time_worker_t *worker, uint32_t ms);
+
+bool async_context_remove_at_time_worker(async_context_t *context, async_at_time_worker_t *worker);
+
+void async_context_acquire_lock_blocking(async_context_t *context);
+
+void async_context_release_lock(async_context_t *context);
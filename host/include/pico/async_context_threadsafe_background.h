@@ -0,0 +1,31 @@
+/*
+ * Host shim for pico/async_context_threadsafe_background.h.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include "pico/async_context.h"
+
+typedef struct {
+    int unused;
+} async_context_threadsafe_background_config_t;
+
+typedef struct {
+    async_context_t core;
+} async_context_threadsafe_background_t;
+
+static inline async_context_threadsafe_background_config_t
+async_context_threadsafe_background_default_config(void) {
+    return (async_context_threadsafe_background_config_t){0};
+}
+
+static inline bool async_context_threadsafe_background_init(
+    async_context_threadsafe_background_t *self,
+    async_context_threadsafe_background_config_t *config) {
+    (void)config;
+    self->core.lock_depth = 0;
+    return true;
+}
@@ -0,0 +1,10 @@
+/*
+ * Host shim for pico/multicore.h (nothing the looper uses).
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include "hardware/sync.h"
@@ -0,0 +1,30 @@
+/*
+ * Host shim for pico/stdlib.h.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+typedef unsigned int uint;
+
+#define GPIO_OUT 1
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+
+static inline void gpio_init(uint gpio) { (void)gpio; }
+static inline void gpio_set_dir(uint gpio, bool out) { (void)gpio, (void)out; }
+static inline void gpio_put(uint gpio, bool value) { (void)gpio, (void)value; }
+
+static inline bool stdio_init_all(void) { return true; }
+
+int getchar_timeout_us(uint32_t timeout_us);
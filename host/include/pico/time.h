@@ -0,0 +1,27 @@
+/*
+ * Host shim for pico/time.h: a virtual monotonic clock in microseconds.
+ * Time only moves when the host advances it (see host/hal.h).
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t absolute_time_t;
+
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
@@ -0,0 +1,269 @@
+/*
+ * looper_replay.c
+ *
+ * Replays an input log recorded on the device (`record dump`, see
+ * src/input_log.c) against the looper core on the virtual clock, and
+ * writes every MIDI message sent to USB with its time:
+ *
+ *   <time_us> <status> <data1> <data2>   (hex)
+ *
+ * The firmware is started as main() starts it, with empty flash and the
+ * ghost note RNG seeded with `seed`, and its main loop is run_loop_poll()
+ * over the firmware's own task table. An input arrives through a timer at
+ * its time, as an interrupt would, so a sleeping loop wakes for it. The
+ * same log and seed always give the same output. Diff the output against
+ * a saved one to catch behaviour changes.
+ *
+ *   looper_replay [-b] [-c task_us] [-s seed] [-t tail_us] input.log [output.txt]
+ *
+ * `-b` runs the loop in busy mode, and `-c` charges every task run
+ * `task_us` of virtual time, as if it took that long on the device. The
+ * loop's passes, sleeps and note dispatch latency are printed on stderr
+ * with the host time taken, so the two modes can be compared.
+ *
+ * Lines of the log that are not inputs are skipped, so a whole console
+ * capture can be replayed. After the last input the replay runs on for
+ * `tail_us` (default two seconds).
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/ble_midi.h"
+#include "drivers/button.h"
+#include "drivers/led.h"
+#include "drivers/storage.h"
+#include "drivers/usb_midi.h"
+#include "host/hal.h"
+#include "latency.h"
+#include "led_pattern.h"
+#include "looper.h"
+#include "main_tasks.h"
+#include "midi_control.h"
+#include "midi_thru.h"
+#include "note_scheduler.h"
+#include "run_loop.h"
+
+#define REPLAY_DEFAULT_TAIL_US 2000000
+
+static FILE *output;
+static size_t output_count = 0;
+static async_at_time_worker_t input_timer;
+static bool input_due;
+
+/*
+ * The firmware's tasks, each charged `task_cost_us` of virtual time per
+ * run. Timers that fall due meanwhile fire right after it, as interrupts
+ * would have fired during it. A task is not told its index, so every slot
+ * has a function of its own.
+ */
+static const run_loop_task_t *firmware_tasks;
+static run_loop_task_t charged_tasks[RUN_LOOP_MAX_TASKS];
+static uint32_t task_cost_us = 0;
+
+static void charged_run(size_t i) {
+    firmware_tasks[i].run();
+    if (task_cost_us > 0) {
+        host_clock_advance(task_cost_us);
+        host_async_run_until(time_us_64());
+    }
+}
+
+#define CHARGED_TASK(i) \
+    static void charged_task_##i(void) { charged_run(i); }
+CHARGED_TASK(0)
+CHARGED_TASK(1)
+CHARGED_TASK(2)
+CHARGED_TASK(3)
+CHARGED_TASK(4)
+CHARGED_TASK(5)
+CHARGED_TASK(6)
+CHARGED_TASK(7)
+CHARGED_TASK(8)
+CHARGED_TASK(9)
+CHARGED_TASK(10)
+CHARGED_TASK(11)
+CHARGED_TASK(12)
+CHARGED_TASK(13)
+CHARGED_TASK(14)
+CHARGED_TASK(15)
+
+static void (*const charged_task_runs[RUN_LOOP_MAX_TASKS])(void) = {
+    charged_task_0,  charged_task_1,  charged_task_2,  charged_task_3,
+    charged_task_4,  charged_task_5,  charged_task_6,  charged_task_7,
+    charged_task_8,  charged_task_9,  charged_task_10, charged_task_11,
+    charged_task_12, charged_task_13, charged_task_14, charged_task_15,
+};
+
+// Starts the run loop on the firmware's task table.
+static void replay_loop_init(void) {
+    size_t count;
+    firmware_tasks = main_tasks_get(&count);
+    if (count > RUN_LOOP_MAX_TASKS)
+        count = RUN_LOOP_MAX_TASKS;
+    for (size_t i = 0; i < count; i++) {
+        charged_tasks[i] = firmware_tasks[i];
+        charged_tasks[i].run = charged_task_runs[i];
+    }
+    run_loop_init(charged_tasks, count);
+}
+
+// Writes out what the firmware sent to USB.
+static void replay_output(void) {
+    size_t count;
+    const host_midi_message_t *sent = host_usb_midi_sent(&count);
+    for (size_t i = 0; i < count; i++)
+        fprintf(output, "%llu %02x %02x %02x\n", (unsigned long long)sent[i].time_us,
+                sent[i].status, sent[i].data1, sent[i].data2);
+    output_count += count;
+    host_usb_midi_clear();
+}
+
+static void input_timer_fired(async_context_t *ctx, async_at_time_worker_t *worker) {
+    (void)ctx;
+    (void)worker;
+    input_due = true;
+}
+
+/*
+ * Runs the main loop up to `time_us`. A busy loop never sleeps, so the
+ * clock is moved on to the next timer after each of its passes, as its
+ * spinning would.
+ */
+static void replay_run_until(uint64_t time_us) {
+    input_due = false;
+    input_timer.do_work = input_timer_fired;
+    async_context_add_at_time_worker_at(async_timer_async_context(), &input_timer,
+                                        from_us_since_boot(time_us));
+    while (!input_due) {
+        run_loop_poll();
+        if (run_loop_busy())
+            host_async_run_until(host_async_next_time());
+        replay_output();
+    }
+}
+
+// Applies one log line; returns false if it is not an input.
+static bool replay_input(const char *line, uint64_t *time_us) {
+    const char *prefix = "[INPUT] ";
+    if (strncmp(line, prefix, strlen(prefix)) == 0)
+        line += strlen(prefix);
+
+    unsigned long long t;
+    char kind[8];
+    unsigned int a, b, c;
+    if (sscanf(line, "%llu %7s", &t, kind) != 2)
+        return false;
+    const char *args = strstr(line, kind) + strlen(kind);
+
+    if (strcmp(kind, "button") == 0 && sscanf(args, "%u", &a) == 1) {
+        replay_run_until(t);
+        host_button_push((button_event_t)a, t);
+    } else if (strcmp(kind, "midi") == 0 && sscanf(args, "%x %x %x", &a, &b, &c) == 3) {
+        replay_run_until(t);
+        host_usb_midi_inject(a, b, c);
+    } else if (strcmp(kind, "usb") == 0 && sscanf(args, "%u", &a) == 1) {
+        replay_run_until(t);
+        host_usb_midi_set_connected(a != 0);
+    } else {
+        return false;
+    }
+    *time_us = t;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    unsigned int seed = 1;
+    uint64_t tail_us = REPLAY_DEFAULT_TAIL_US;
+    bool busy = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "bc:s:t:")) != -1) {
+        if (opt == 'b')
+            busy = true;
+        else if (opt == 'c')
+            task_cost_us = strtoul(optarg, NULL, 0);
+        else if (opt == 's')
+            seed = strtoul(optarg, NULL, 0);
+        else if (opt == 't')
+            tail_us = strtoull(optarg, NULL, 0);
+        else
+            optind = argc + 1;
+    }
+    if (optind >= argc || argc - optind > 2) {
+        fprintf(stderr,
+                "usage: %s [-b] [-c task_us] [-s seed] [-t tail_us] input.log [output.txt]\n",
+                argv[0]);
+        return 2;
+    }
+    FILE *input = fopen(argv[optind], "r");
+    if (input == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    output = (argc - optind == 2) ? fopen(argv[optind + 1], "w") : fdopen(dup(1), "w");
+    if (output == NULL || freopen("/dev/null", "w", stdout) == NULL) {  // firmware console
+        perror("output");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    srand(seed);
+    host_usb_midi_set_connected(false);
+    usb_midi_init();
+    ble_midi_init();
+    stdio_init_all();
+    led_init();
+    storage_load_tracks();
+    latency_init();
+    async_timer_init();
+    button_init();
+    led_pattern_init();
+    looper_schedule_step_timer();
+    midi_control_init();
+    note_scheduler_init();
+    midi_thru_init();
+    replay_loop_init();
+    run_loop_set_busy(busy);
+
+    char line[256];
+    size_t inputs = 0;
+    uint64_t last_us = 0;
+    while (fgets(line, sizeof(line), input) != NULL) {
+        uint64_t time_us;
+        if (!replay_input(line, &time_us))
+            continue;
+        if (time_us < last_us)
+            fprintf(stderr, "input %zu at %llu us goes back in time\n", inputs + 1,
+                    (unsigned long long)time_us);
+        last_us = time_us;
+        inputs++;
+    }
+    replay_run_until(last_us + tail_us);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "inputs=%zu messages=%zu end=%llu us host=%.3f ms\n", inputs, output_count,
+            (unsigned long long)(last_us + tail_us),
+            (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    const run_loop_stats_t *stats = run_loop_stats_get();
+    const note_scheduler_latency_t *latency = note_scheduler_latency_get();
+    uint64_t span_us = time_us_64() - stats->since_us;
+    fprintf(stderr,
+            "loop mode=%s task_us=%lu passes=%lu sleeps=%lu asleep=%.1f%% "
+            "dispatch notes=%lu avg_late=%lluus max_late=%luus\n",
+            busy ? "busy" : "sleep", (unsigned long)task_cost_us, (unsigned long)stats->iterations,
+            (unsigned long)stats->sleeps, span_us ? stats->sleep_us * 100.0 / span_us : 0.0,
+            (unsigned long)latency->notes,
+            (unsigned long long)(latency->notes ? latency->total_us / latency->notes : 0),
+            (unsigned long)latency->max_us);
+    fclose(input);
+    fclose(output);
+    return 0;
+}
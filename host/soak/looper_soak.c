@@ -0,0 +1,158 @@
+/*
+ * looper_soak.c
+ *
+ * Soak test of the step clock's catch-up policies. The step timer is held
+ * up at random, for up to a few steps, as a slow handler or a long flash
+ * write would hold it up, and every policy in turn runs through the same
+ * kind of stalls. At each step the clock is checked against the grid it
+ * started on: played and skipped steps together must account for every
+ * step period that has passed, less what stretching shifted the loop by,
+ * and the step index must be where that puts it in the loop. The ghost
+ * engine's bar count must have followed every one of those steps too.
+ *
+ *   looper_soak [-s seed] [-p stall_percent] [-m max_stall_steps] [steps]
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/usb_midi.h"
+#include "ghost_note.h"
+#include "host/hal.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "note_scheduler.h"
+#include "pattern_bank.h"
+
+#define SOAK_DEFAULT_STEPS 20000
+#define SOAK_BAR_STEPS (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT)
+
+static const char *const policy_names[LOOPER_CATCH_UP_COUNT] = {"skip", "burst", "stretch"};
+
+static FILE *report;
+static unsigned int stall_percent = 5;
+static unsigned int max_stall_steps = 3;
+
+// Grid of the policy under test, and what has been seen of it.
+static uint64_t grid_start_us;
+static uint8_t grid_start_step;
+static uint8_t grid_start_bar;
+static uint32_t steps_played;
+static uint32_t grid_errors;
+static uint64_t tick_gap_min_us;
+static uint64_t last_tick_us;
+
+// Checks the step about to run against the grid, then picks its stall.
+static uint32_t soak_stall(async_at_time_worker_t *worker) {
+    looper_status_t *status = looper_status_get();
+    if (worker != &status->tick_timer)
+        return 0;
+
+    const looper_overrun_t *overrun = looper_overrun_get();
+    uint32_t elapsed = steps_played + overrun->skipped;
+    uint64_t expected_us = grid_start_us + overrun->stretched_us +
+                           (uint64_t)elapsed * status->step_period_us;
+    uint8_t expected_step = (grid_start_step + elapsed) % LOOPER_TOTAL_STEPS;
+    uint32_t bars = (grid_start_step + elapsed) / SOAK_BAR_STEPS - grid_start_step / SOAK_BAR_STEPS;
+    uint8_t expected_bar = (grid_start_bar + bars) % ghost_note_parameters()->fill.interval_bar;
+    if (worker->next_time != expected_us || status->current_step != expected_step ||
+        status->ghost_bar_counter != expected_bar) {
+        if (grid_errors++ < 5)
+            fprintf(stderr,
+                    "  off grid at step %lu: due %llu us, step %u, bar %u; "
+                    "expected %llu us, %u, %u\n",
+                    (unsigned long)elapsed, (unsigned long long)worker->next_time,
+                    status->current_step, status->ghost_bar_counter,
+                    (unsigned long long)expected_us, expected_step, expected_bar);
+    }
+    steps_played++;
+
+    uint64_t now_us = time_us_64();
+    if (steps_played > 1 && now_us - last_tick_us < tick_gap_min_us)
+        tick_gap_min_us = now_us - last_tick_us;
+    uint32_t stall_us = 0;
+    if ((unsigned int)(rand() % 100) < stall_percent)
+        stall_us = rand() % (max_stall_steps * status->step_period_us + 1);
+    last_tick_us = now_us + stall_us;
+    return stall_us;
+}
+
+static void soak_run(looper_catch_up_t policy, long steps) {
+    looper_status_t *status = looper_status_get();
+    looper_set_catch_up(policy);
+    looper_overrun_reset();
+    grid_start_us = status->timing.next_step_us;
+    grid_start_step = status->current_step;
+    grid_start_bar = status->ghost_bar_counter;
+    steps_played = 0;
+    grid_errors = 0;
+    tick_gap_min_us = UINT64_MAX;
+
+    size_t notes = 0;
+    while (steps_played < steps) {
+        host_async_run_until(host_async_next_time());
+        usb_midi_task();
+        note_scheduler_dispatch_pending();
+        pattern_bank_task();
+
+        size_t count;
+        host_usb_midi_sent(&count);
+        notes += count / 2;
+        host_usb_midi_clear();
+    }
+
+    const looper_overrun_t *overrun = looper_overrun_get();
+    fprintf(report, "%-7s steps=%lu skipped=%lu overruns=%lu max_late_us=%lu stretched_us=%llu "
+           "min_gap_us=%llu notes=%zu grid=%s\n",
+           policy_names[policy], (unsigned long)steps_played, (unsigned long)overrun->skipped,
+           (unsigned long)overrun->overruns, (unsigned long)overrun->max_late_us,
+           (unsigned long long)overrun->stretched_us, (unsigned long long)tick_gap_min_us, notes,
+           grid_errors ? "FAIL" : "ok");
+}
+
+int main(int argc, char **argv) {
+    unsigned int seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:m:")) != -1) {
+        if (opt == 's')
+            seed = strtoul(optarg, NULL, 0);
+        else if (opt == 'p')
+            stall_percent = strtoul(optarg, NULL, 0);
+        else if (opt == 'm')
+            max_stall_steps = strtoul(optarg, NULL, 0);
+        else
+            optind = argc + 1;
+    }
+    long steps = (optind < argc) ? strtol(argv[optind], NULL, 10) : SOAK_DEFAULT_STEPS;
+    if (optind + 1 < argc || steps < 1 || stall_percent > 100) {
+        fprintf(stderr, "usage: %s [-s seed] [-p stall_percent] [-m max_stall_steps] [steps]\n",
+                argv[0]);
+        return 2;
+    }
+    report = fdopen(dup(1), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL)  // the step display
+        return 1;
+
+    srand(seed);
+    async_timer_init();
+    looper_pattern_t *pattern = looper_pattern_get();
+    for (size_t step = 0; step < LOOPER_TOTAL_STEPS; step++)
+        pattern->hits[step] = looper_active_tracks();
+    looper_schedule_step_timer();
+    midi_control_init();
+    note_scheduler_init();
+    host_async_set_stall(soak_stall);
+
+    bool failed = false;
+    for (int policy = 0; policy < LOOPER_CATCH_UP_COUNT; policy++) {
+        soak_run(policy, steps);
+        failed |= grid_errors > 0;
+    }
+    fclose(report);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * async_context.c
+ *
+ * Simulated async_context. At-time workers are kept in a list sorted by
+ * deadline, with workers added for the same deadline kept in the order
+ * they were added. Nothing runs on its own: host_async_run_until() fires
+ * every worker due up to a time, with the clock set to each worker's
+ * deadline, which makes the timing of a run exact and deterministic. The
+ * host is single threaded, so the context lock only tracks nesting.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <assert.h>
+
+#include "host/hal.h"
+#include "pico/async_context.h"
+#include "pico/async_context_threadsafe_background.h"
+
+static async_at_time_worker_t *workers = NULL;
+static async_context_t *running_context = NULL;
+static host_async_stall_t stall = NULL;
+
+static void worker_unlink(async_at_time_worker_t *worker) {
+    for (async_at_time_worker_t **link = &workers; *link != NULL; link = &(*link)->next) {
+        if (*link == worker) {
+            *link = worker->next;
+            worker->next = NULL;
+            return;
+        }
+    }
+}
+
+bool async_context_add_at_time_worker_at(async_context_t *context, async_at_time_worker_t *worker,
+                                         absolute_time_t at) {
+    running_context = context;
+    worker_unlink(worker);
+    worker->next_time = at;
+
+    async_at_time_worker_t **link = &workers;
+    while (*link != NULL && (*link)->next_time <= at) link = &(*link)->next;
+    worker->next = *link;
+    *link = worker;
+    return true;
+}
+
+bool async_context_add_at_time_worker_in_ms(async_context_t *context,
+                                            async_at_time_worker_t *worker, uint32_t ms) {
+    return async_context_add_at_time_worker_at(context, worker, time_us_64() + ms * 1000ull);
+}
+
+bool async_context_remove_at_time_worker(async_context_t *context, async_at_time_worker_t *worker) {
+    (void)context;
+    for (async_at_time_worker_t *w = workers; w != NULL; w = w->next) {
+        if (w == worker) {
+            worker_unlink(worker);
+            return true;
+        }
+    }
+    return false;
+}
+
+void async_context_acquire_lock_blocking(async_context_t *context) { context->lock_depth++; }
+
+void async_context_release_lock(async_context_t *context) {
+    assert(context->lock_depth > 0);
+    context->lock_depth--;
+}
+
+// Deadline of the earliest worker, or UINT64_MAX when none is pending.
+uint64_t host_async_next_time(void) { return (workers != NULL) ? workers->next_time : UINT64_MAX; }
+
+/*
+ * Has `hook` say how long each worker is held up before it runs, as if
+ * something else had the CPU; NULL runs every worker on time.
+ */
+void host_async_set_stall(host_async_stall_t hook) { stall = hook; }
+
+/*
+ * Fires every worker due at or before `time_us`, in deadline order, and
+ * leaves the clock at `time_us`. Workers re-added by a callback run again
+ * within the same call if their new deadline is still due. Returns how
+ * many workers ran.
+ */
+size_t host_async_run_until(uint64_t time_us) {
+    size_t count = 0;
+    while (workers != NULL && workers->next_time <= time_us) {
+        async_at_time_worker_t *worker = workers;
+        worker_unlink(worker);
+        host_clock_set(worker->next_time);
+        if (stall != NULL)
+            host_clock_advance(stall(worker));
+        worker->do_work(running_context, worker);
+        count++;
+    }
+    host_clock_set(time_us);
+    return count;
+}
+
+/*
+ * The main loop's sleep: the first worker due before the timeout stands in
+ * for the interrupt that would end it early, and runs. Returns true when
+ * the timeout was reached.
+ */
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+    uint64_t timeout_us = to_us_since_boot(timeout_timestamp);
+    if (workers != NULL && workers->next_time < timeout_us) {
+        host_async_run_until(workers->next_time);
+        return false;
+    }
+    host_clock_set(timeout_us);
+    return true;
+}
+
+// Drops every pending worker.
+void host_async_reset(void) {
+    while (workers != NULL) worker_unlink(workers);
+}
@@ -0,0 +1,48 @@
+/*
+ * button.c
+ *
+ * Host stand-in for drivers/button.c. There is no BOOTSEL button to
+ * sample; the host queues already debounced events, with their edge
+ * times, and button_poll_event() hands them out once the virtual clock
+ * has reached them.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "drivers/button.h"
+
+#include "host/hal.h"
+#include "pico/time.h"
+
+typedef struct {
+    button_event_t event;
+    uint64_t time_us;
+} button_queued_event_t;
+
+static button_queued_event_t event_queue[HOST_BUTTON_QUEUE_SIZE];
+static size_t event_head = 0;
+static size_t event_tail = 0;
+
+bool bb_get_bootsel_button(void) { return false; }
+
+void button_init(void) {}
+
+button_event_t button_poll_event(uint64_t *time_us) {
+    if (event_tail == event_head || event_queue[event_tail].time_us > time_us_64())
+        return BUTTON_EVENT_NONE;
+    button_queued_event_t e = event_queue[event_tail];
+    event_tail = (event_tail + 1) % HOST_BUTTON_QUEUE_SIZE;
+    *time_us = e.time_us;
+    return e.event;
+}
+
+// Queues `event` as happening at `time_us`; events must be pushed in time order.
+bool host_button_push(button_event_t event, uint64_t time_us) {
+    size_t next = (event_head + 1) % HOST_BUTTON_QUEUE_SIZE;
+    if (next == event_tail)
+        return false;
+    event_queue[event_head] = (button_queued_event_t){event, time_us};
+    event_head = next;
+    return true;
+}
@@ -0,0 +1,25 @@
+/*
+ * clock.c
+ *
+ * Virtual monotonic clock behind time_us_64(). It starts at zero and only
+ * moves forward when the host sets or advances it, so a run is repeatable
+ * regardless of how fast the host machine is.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "host/hal.h"
+#include "pico/time.h"
+
+static uint64_t now_us = 0;
+
+uint64_t time_us_64(void) { return now_us; }
+
+// Moves the clock to `time_us`; the clock never goes backwards.
+void host_clock_set(uint64_t time_us) {
+    if (time_us > now_us)
+        now_us = time_us;
+}
+
+void host_clock_advance(uint64_t delta_us) { now_us += delta_us; }
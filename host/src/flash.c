@@ -0,0 +1,42 @@
+/*
+ * flash.c
+ *
+ * RAM-backed flash with NOR semantics: it starts erased, erasing sets a
+ * whole sector to 0xFF and programming can only clear bits, so a missing
+ * erase shows up as corrupted data just as it would on the device.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "host/hal.h"
+#include "pico/flash.h"
+
+uint8_t host_flash_memory[PICO_FLASH_SIZE_BYTES];
+
+// Erased before main(), so a first boot finds empty flash.
+__attribute__((constructor)) void host_flash_erase_all(void) {
+    memset(host_flash_memory, 0xFF, sizeof(host_flash_memory));
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    assert(flash_offs % FLASH_SECTOR_SIZE == 0 && count % FLASH_SECTOR_SIZE == 0);
+    assert(flash_offs + count <= PICO_FLASH_SIZE_BYTES);
+    memset(&host_flash_memory[flash_offs], 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    assert(flash_offs % FLASH_PAGE_SIZE == 0 && count % FLASH_PAGE_SIZE == 0);
+    assert(flash_offs + count <= PICO_FLASH_SIZE_BYTES);
+    for (size_t i = 0; i < count; i++) host_flash_memory[flash_offs + i] &= data[i];
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms) {
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * stdio.c
+ *
+ * Console input for the host build. The USB CDC console is replaced by a
+ * byte queue that the host fills; getchar_timeout_us() never waits.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <string.h>
+
+#include "host/hal.h"
+#include "pico/stdlib.h"
+
+static char input[HOST_STDIN_SIZE];
+static size_t input_head = 0;
+static size_t input_tail = 0;
+
+int getchar_timeout_us(uint32_t timeout_us) {
+    (void)timeout_us;
+    if (input_tail == input_head)
+        return PICO_ERROR_TIMEOUT;
+    char c = input[input_tail];
+    input_tail = (input_tail + 1) % HOST_STDIN_SIZE;
+    return (unsigned char)c;
+}
+
+// Queues `text` as console input; false, with nothing queued, if it does not fit.
+bool host_stdin_push(const char *text) {
+    size_t used = (input_head + HOST_STDIN_SIZE - input_tail) % HOST_STDIN_SIZE;
+    size_t length = strlen(text);
+    if (used + length >= HOST_STDIN_SIZE)
+        return false;
+    for (size_t i = 0; i < length; i++) {
+        input[input_head] = text[i];
+        input_head = (input_head + 1) % HOST_STDIN_SIZE;
+    }
+    return true;
+}
@@ -0,0 +1,119 @@
+/*
+ * usb_midi.c
+ *
+ * Host stand-in for drivers/usb_midi.c. Outgoing channel messages are
+ * captured with the virtual time they were written, and outgoing SysEx as
+ * a byte stream; incoming messages are queued by the host and routed by
+ * usb_midi_task() exactly as the device driver routes USB-MIDI packets.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "drivers/usb_midi.h"
+
+#include <string.h>
+
+#include "host/hal.h"
+#include "latency.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "midi_thru.h"
+#include "pattern_bank.h"
+#include "pico/time.h"
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} midi_input_t;
+
+static bool connected = true;
+static host_midi_message_t sent[HOST_USB_MIDI_CAPTURE_SIZE];
+static size_t sent_count = 0;
+static uint8_t sysex_sent[HOST_USB_MIDI_SYSEX_SIZE];
+static size_t sysex_sent_length = 0;
+static midi_input_t input[HOST_USB_MIDI_INPUT_SIZE];
+static size_t input_head = 0;
+static size_t input_tail = 0;
+
+void usb_midi_init(void) {}
+
+bool usb_midi_is_connected(void) { return connected; }
+
+static bool usb_midi_capture(uint8_t status, uint8_t data1, uint8_t data2) {
+    if (sent_count >= HOST_USB_MIDI_CAPTURE_SIZE)
+        return false;
+    sent[sent_count++] = (host_midi_message_t){time_us_64(), status, data1, data2};
+    return true;
+}
+
+void usb_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity) {
+    usb_midi_capture(0x90 | channel, note, velocity);
+    usb_midi_capture(0x80 | channel, note, 0);
+}
+
+bool usb_midi_send_message(uint8_t status, uint8_t data1, uint8_t data2) {
+    return usb_midi_capture(status, data1, data2);
+}
+
+// Takes as much SysEx as the capture has room for, as the device takes what fits its FIFO.
+size_t usb_midi_send_sysex(const uint8_t *data, size_t len) {
+    size_t room = HOST_USB_MIDI_SYSEX_SIZE - sysex_sent_length;
+    if (len > room)
+        len = room;
+    memcpy(&sysex_sent[sysex_sent_length], data, len);
+    sysex_sent_length += len;
+    return len;
+}
+
+bool usb_midi_task_ready(void) { return input_tail != input_head; }
+
+void usb_midi_task(void) {
+    while (input_tail != input_head) {
+        midi_input_t m = input[input_tail];
+        input_tail = (input_tail + 1) % HOST_USB_MIDI_INPUT_SIZE;
+        uint8_t channel = m.status & 0x0F;
+        uint8_t message = m.status & 0xF0;
+        if (m.status == 0xF8)
+            looper_handle_midi_tick(time_us_64());
+        else if (m.status == 0xFA)
+            looper_handle_midi_start();
+        else if (message == 0xB0 && midi_control_handle_cc(channel, m.data1, m.data2))
+            continue;
+        else if (message == 0xC0 && pattern_bank_handle_program_change(channel, m.data1))
+            continue;
+        else if (message >= 0x80 && message <= 0xE0 &&
+                 !latency_calibration_receive(LATENCY_OUTPUT_USB, m.status, m.data1, m.data2)) {
+            if (message == 0x90 && m.data2 > 0)
+                looper_record_note(time_us_64(), m.data1, m.data2);
+            midi_thru_receive(m.status, m.data1, m.data2);
+        }
+    }
+}
+
+void host_usb_midi_set_connected(bool value) { connected = value; }
+
+// Queues one incoming message for the next usb_midi_task(); false when the queue is full.
+bool host_usb_midi_inject(uint8_t status, uint8_t data1, uint8_t data2) {
+    size_t next = (input_head + 1) % HOST_USB_MIDI_INPUT_SIZE;
+    if (next == input_tail)
+        return false;
+    input[input_head] = (midi_input_t){status, data1, data2};
+    input_head = next;
+    return true;
+}
+
+const host_midi_message_t *host_usb_midi_sent(size_t *count) {
+    *count = sent_count;
+    return sent;
+}
+
+void host_usb_midi_clear(void) { sent_count = 0; }
+
+const uint8_t *host_usb_midi_sysex(size_t *length) {
+    *length = sysex_sent_length;
+    return sysex_sent;
+}
+
+void host_usb_midi_sysex_clear(void) { sysex_sent_length = 0; }
@@ -0,0 +1,47 @@
+/*
+ * Checks for the host unit tests. A failed check prints where it failed
+ * and what it saw on stderr, and the test goes on; main() returns
+ * host_test_result(), which is non-zero if any check failed.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdio.h>
+
+static int host_test_checks = 0;
+static int host_test_failures = 0;
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        host_test_checks++;                                                           \
+        if (!(cond)) {                                                                \
+            host_test_failures++;                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+        }                                                                             \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                    \
+    do {                                                                              \
+        long long actual_ = (long long)(actual);                                      \
+        long long expected_ = (long long)(expected);                                  \
+        host_test_checks++;                                                           \
+        if (actual_ != expected_) {                                                   \
+            host_test_failures++;                                                     \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, \
+                    #actual, actual_, expected_);                                     \
+        }                                                                             \
+    } while (0)
+
+// Hides the firmware console, which prints the step display on every step.
+static inline void host_test_quiet(void) {
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        perror("stdout");
+}
+
+static inline int host_test_result(const char *name) {
+    fprintf(stderr, "%s: %d checks, %d failed\n", name, host_test_checks, host_test_failures);
+    return host_test_failures ? 1 : 0;
+}
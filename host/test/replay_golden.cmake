@@ -0,0 +1,21 @@
+# Replays a recorded session and compares its MIDI output with the golden
+# file. Run by ctest as the `replay` test:
+#
+#   cmake -DREPLAY=looper_replay -DINPUT=session.log -DEXPECTED=session.txt
+#         -DOUTPUT=out.txt -P replay_golden.cmake
+#
+execute_process(
+  COMMAND ${REPLAY} -s 1 -t 6000000 ${INPUT} ${OUTPUT}
+  RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "looper_replay failed: ${result}")
+endif()
+
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${EXPECTED}
+  RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR
+    "${OUTPUT} differs from ${EXPECTED}; if the change in output is "
+    "intended, copy it over the golden file")
+endif()
@@ -0,0 +1,162 @@
+/*
+ * test_ble_midi_packet.c
+ *
+ * Unit tests of the BLE-MIDI packet encoding: timestamp header and low
+ * bytes, running status, where packets are split by the MTU and by the
+ * timestamps, and a SysEx message spread over several packets.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <string.h>
+
+#include "drivers/ble_midi_packet.h"
+#include "host_test.h"
+
+#define TEST_PAYLOAD_MAX 244
+
+static ble_midi_message_t message(uint16_t timestamp_ms, uint8_t status, uint8_t data1,
+                                  uint8_t data2) {
+    return (ble_midi_message_t){timestamp_ms, 3, {status, data1, data2}};
+}
+
+static void check_packet(const uint8_t *packet, uint16_t length, const uint8_t *expected,
+                         uint16_t expected_length) {
+    CHECK_EQ(length, expected_length);
+    CHECK(length == expected_length && memcmp(packet, expected, length) == 0);
+}
+
+static void test_timestamps(void) {
+    uint8_t packet[TEST_PAYLOAD_MAX];
+    size_t used;
+
+    CHECK_EQ(ble_midi_timestamp(8191999), 0x1FFF);
+    CHECK_EQ(ble_midi_timestamp(8192000), 0);
+
+    // Timestamp 0x0ABC: bits 12-7 in the header, bits 6-0 before the message.
+    ble_midi_message_t m = message(0x0ABC, 0x99, 36, 100);
+    uint16_t n = ble_midi_packet_encode(&m, 1, TEST_PAYLOAD_MAX, packet, &used);
+    check_packet(packet, n, (const uint8_t[]){0x95, 0xBC, 0x99, 36, 100}, 5);
+    CHECK_EQ(used, 1);
+
+    // The low byte may wrap within a packet, once; the receiver carries it into the header.
+    ble_midi_message_t wrap[] = {message(0x017F, 0x99, 36, 100), message(0x0180, 0x99, 38, 90)};
+    n = ble_midi_packet_encode(wrap, 2, TEST_PAYLOAD_MAX, packet, &used);
+    check_packet(packet, n, (const uint8_t[]){0x82, 0xFF, 0x99, 36, 100, 0x80, 38, 90}, 8);
+    CHECK_EQ(used, 2);
+
+    // A message 128 ms or more after the first, or earlier than the last, starts a new packet.
+    ble_midi_message_t late[] = {message(100, 0x99, 36, 100), message(228, 0x99, 38, 90)};
+    ble_midi_packet_encode(late, 2, TEST_PAYLOAD_MAX, packet, &used);
+    CHECK_EQ(used, 1);
+    ble_midi_message_t back[] = {message(100, 0x99, 36, 100), message(99, 0x99, 38, 90)};
+    ble_midi_packet_encode(back, 2, TEST_PAYLOAD_MAX, packet, &used);
+    CHECK_EQ(used, 1);
+}
+
+static void test_running_status(void) {
+    uint8_t packet[TEST_PAYLOAD_MAX];
+    size_t used;
+
+    // A note-on and its note-off keep their statuses; a second note-on reuses the first's.
+    ble_midi_message_t notes[] = {message(5, 0x99, 36, 100), message(5, 0x89, 36, 0),
+                                  message(6, 0x89, 38, 0), message(6, 0xF2, 1, 2),
+                                  message(7, 0xF2, 3, 4)};
+    uint16_t n = ble_midi_packet_encode(notes, 5, TEST_PAYLOAD_MAX, packet, &used);
+    check_packet(packet, n,
+                 (const uint8_t[]){0x80, 0x85, 0x99, 36, 100, 0x85, 0x89, 36, 0, 0x86, 38, 0,
+                                   0x86, 0xF2, 1, 2, 0x87, 0xF2, 3, 4},
+                 20);
+    CHECK_EQ(used, 5);
+
+    // Program changes are two bytes, one with running status.
+    ble_midi_message_t programs[] = {{5, 2, {0xC0, 3}}, {5, 2, {0xC0, 4}}};
+    n = ble_midi_packet_encode(programs, 2, TEST_PAYLOAD_MAX, packet, &used);
+    check_packet(packet, n, (const uint8_t[]){0x80, 0x85, 0xC0, 3, 0x85, 4}, 6);
+}
+
+// Messages are packed up to the payload limit and the rest left for the next packet.
+static void test_mtu_split(void) {
+    uint8_t packet[TEST_PAYLOAD_MAX];
+    ble_midi_message_t hits[40];
+    for (size_t i = 0; i < 40; i++)
+        hits[i] = message(10, (i % 2) ? 0x89 : 0x99, 36 + i / 2, (i % 2) ? 0 : 100);
+
+    // Default MTU 23: 20 bytes of payload fit the header and four whole messages.
+    size_t used;
+    uint16_t n = ble_midi_packet_encode(hits, 40, 20, packet, &used);
+    CHECK_EQ(used, 4);
+    CHECK_EQ(n, 17);
+
+    size_t total = 0, packets = 0;
+    while (total < 40) {
+        n = ble_midi_packet_encode(&hits[total], 40 - total, 20, packet, &used);
+        CHECK(n <= 20);
+        CHECK(used > 0);
+        if (used == 0)
+            break;
+        total += used;
+        packets++;
+    }
+    CHECK_EQ(total, 40);
+    CHECK_EQ(packets, 10);
+
+    // A large MTU takes them all at once.
+    ble_midi_packet_encode(hits, 40, TEST_PAYLOAD_MAX, packet, &used);
+    CHECK_EQ(used, 40);
+}
+
+static void test_sysex(void) {
+    uint8_t sysex[40];
+    sysex[0] = 0xF0;
+    for (size_t i = 1; i < sizeof(sysex) - 1; i++) sysex[i] = i;
+    sysex[sizeof(sysex) - 1] = 0xF7;
+
+    uint8_t packet[TEST_PAYLOAD_MAX];
+    uint8_t joined[sizeof(sysex)];
+    size_t joined_length = 0;
+    size_t sent = 0;
+    size_t packets = 0;
+    while (sent < sizeof(sysex) && packets < 10) {
+        size_t from = sent;
+        uint16_t n = ble_midi_packet_encode_sysex(sysex, sizeof(sysex), &sent, 0x0ABC, 20, packet);
+        CHECK(n <= 20);
+        CHECK_EQ(packet[0], 0x95);
+        // Timestamp before F0 in the first packet and before F7 in the last, raw data between.
+        size_t i = 1;
+        if (from == 0)
+            CHECK_EQ(packet[i++], 0xBC);
+        for (; i < n; i++) {
+            if (packet[i] == 0xBC) {
+                CHECK_EQ(i, n - 2u);
+                CHECK_EQ(packet[n - 1], 0xF7);
+                continue;
+            }
+            joined[joined_length++] = packet[i];
+        }
+        packets++;
+    }
+    CHECK_EQ(sent, sizeof(sysex));
+    CHECK_EQ(packets, 3);
+    CHECK_EQ(joined_length, sizeof(sysex));
+    CHECK(memcmp(joined, sysex, sizeof(sysex)) == 0);
+
+    // F7 is never separated from its timestamp: here it waits for the next packet.
+    uint8_t short_sysex[] = {0xF0, 1, 2, 3, 4, 5, 0xF7};
+    sent = 0;
+    uint16_t n = ble_midi_packet_encode_sysex(short_sysex, sizeof(short_sysex), &sent, 0, 9,
+                                              packet);
+    CHECK_EQ(n, 8);
+    CHECK_EQ(sent, 6);
+    n = ble_midi_packet_encode_sysex(short_sysex, sizeof(short_sysex), &sent, 0, 9, packet);
+    check_packet(packet, n, (const uint8_t[]){0x80, 0x80, 0xF7}, 3);
+}
+
+int main(void) {
+    test_timestamps();
+    test_running_status();
+    test_mtu_split();
+    test_sysex();
+    return host_test_result("test_ble_midi_packet");
+}
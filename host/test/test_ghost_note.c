@@ -0,0 +1,146 @@
+/*
+ * test_ghost_note.c
+ *
+ * Unit tests of the ghost engine: the threshold a ghost note's random
+ * sample is held against, and ghost note and fill generation over a few
+ * loops of a fixed pattern with a fixed seed, by a render's own engine.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "ghost_note.h"
+#include "host_test.h"
+#include "looper.h"
+
+#define TEST_SEED 7
+#define TEST_LOOPS 3
+
+static void set_intensity(float ghost_intensity, float fill_probability) {
+    ghost_parameters_t *p = ghost_note_parameters_edit();
+    p->ghost_intensity = ghost_intensity;
+    p->fill.probability = fill_probability;
+    ghost_note_parameters_commit();
+    ghost_note_parameters_sync();
+}
+
+// A ghost note plays when its sample is below its probability scaled by the intensity.
+static void test_threshold(void) {
+    set_intensity(0.5f, 0.4f);
+    CHECK(ghost_note_is_active(&(ghost_note_t){.probability = 40, .rand_sample = 19}));
+    CHECK(!ghost_note_is_active(&(ghost_note_t){.probability = 40, .rand_sample = 20}));
+    CHECK(ghost_note_is_active(&(ghost_note_t){.probability = 1, .rand_sample = 0}));
+    CHECK(!ghost_note_is_active(&(ghost_note_t){.probability = 0, .rand_sample = 0}));
+
+    set_intensity(1.0f, 0.4f);
+    CHECK(ghost_note_is_active(&(ghost_note_t){.probability = 100, .rand_sample = 99}));
+    CHECK(!ghost_note_is_active(&(ghost_note_t){.probability = 40, .rand_sample = 40}));
+
+    set_intensity(0.0f, 0.4f);
+    CHECK(!ghost_note_is_active(&(ghost_note_t){.probability = 100, .rand_sample = 0}));
+}
+
+// Kick on the beats, snare on the backbeats, nothing on the other tracks.
+static void make_pattern(looper_pattern_t *pattern) {
+    memset(pattern, 0, sizeof(*pattern));
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step += LOOPER_STEPS_PER_BEAT * 2) {
+        pattern->hits[step] |= TRACK_BIT(0);
+        pattern->hits[step + LOOPER_STEPS_PER_BEAT] |= TRACK_BIT(1);
+    }
+}
+
+/*
+ * Renders the pattern from `seed` as the exporter does, keeping a copy of
+ * it at the start of each of TEST_LOOPS loops.
+ */
+static void render(uint32_t seed, looper_pattern_t loops[TEST_LOOPS]) {
+    looper_pattern_t pattern;
+    make_pattern(&pattern);
+    ghost_render_t engine;
+    ghost_note_render_init(&engine, seed);
+    ghost_note_render_create(&engine, &pattern);
+
+    loops[0] = pattern;
+
+    uint8_t bar_counter = 0;
+    for (int step = 1; step < TEST_LOOPS * LOOPER_TOTAL_STEPS; step++) {
+        ghost_note_render_step(&engine, &pattern, step % LOOPER_TOTAL_STEPS, &bar_counter);
+        if (step % LOOPER_TOTAL_STEPS == 0)
+            loops[step / LOOPER_TOTAL_STEPS] = pattern;
+    }
+}
+
+static void test_generation(void) {
+    size_t num_tracks;
+    const track_t *tracks = looper_tracks_get(&num_tracks);
+    track_mask_t fill_tracks = 0;
+    for (size_t t = 0; t < num_tracks; t++)
+        if (tracks[t].fill)
+            fill_tracks |= TRACK_BIT(t);
+
+    set_intensity(1.0f, 1.0f);  // every fill step with a ghost chance plays
+    static looper_pattern_t loops[TEST_LOOPS], again[TEST_LOOPS];
+    srand(1);
+    int next_rand = rand();
+    srand(1);
+    render(TEST_SEED, loops);
+    CHECK_EQ(rand(), next_rand);  // the render leaves the step timer's rand() alone
+
+    // A render keeps the parameters it started from.
+    ghost_render_t engine;
+    ghost_note_render_init(&engine, TEST_SEED);
+    set_intensity(0.0f, 1.0f);
+    ghost_note_t ghost = {.probability = 40, .rand_sample = 39};
+    CHECK(ghost_note_render_is_active(&engine, &ghost));
+    set_intensity(1.0f, 1.0f);
+
+    render(TEST_SEED, again);
+    CHECK(memcmp(loops, again, sizeof(loops)) == 0);
+
+    // Ghost notes stay off the steps a track plays itself.
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++) {
+        for (size_t t = 0; t < num_tracks; t++) {
+            if (looper_pattern_hit(&loops[0], t, step))
+                CHECK_EQ(loops[0].ghost_notes[step][t].rand_sample, 0);
+        }
+    }
+    size_t ghosts = 0;
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++)
+        for (size_t t = 0; t < 2; t++) ghosts += loops[0].ghost_notes[step][t].probability > 0;
+    CHECK(ghosts > 0);
+
+    /*
+     * With fills every 4 bars, counted from the first, the second loop starts
+     * on the fill bar and the third regenerates the ghost notes.
+     */
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++) {
+        CHECK_EQ(loops[0].fills[step], 0);
+        CHECK_EQ(loops[2].fills[step], 0);
+        CHECK_EQ(loops[1].fills[step] & ~fill_tracks, 0);
+    }
+    // The fill runs from its start to the loop end on every fill track in use.
+    uint8_t start = LOOPER_TOTAL_STEPS;
+    while (start > 0 && loops[1].fills[start - 1] != 0) start--;
+    CHECK(start < LOOPER_TOTAL_STEPS);
+    for (uint8_t step = 0; step < start; step++) CHECK_EQ(loops[1].fills[step], 0);
+    for (uint8_t step = start; step < LOOPER_TOTAL_STEPS; step++)
+        CHECK_EQ(loops[1].fills[step], fill_tracks & looper_active_tracks());
+
+    CHECK(memcmp(loops[0].ghost_notes, loops[2].ghost_notes, sizeof(loops[0].ghost_notes)) != 0);
+    // Another seed places the ghost notes differently.
+    render(TEST_SEED + 1, again);
+    CHECK(memcmp(loops[0].ghost_notes, again[0].ghost_notes, sizeof(loops[0].ghost_notes)) != 0);
+}
+
+int main(void) {
+    host_test_quiet();
+    async_timer_init();
+
+    test_threshold();
+    test_generation();
+    return host_test_result("test_ghost_note");
+}
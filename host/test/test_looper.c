@@ -0,0 +1,341 @@
+/*
+ * test_looper.c
+ *
+ * Unit tests of the step sequencer: which step a button press is quantized
+ * to, how much of its microtiming is kept, that a recorded hit plays back
+ * on its step once the take is stored, that a hit and an early one on
+ * the next step both play, that steps skipped by a stall count towards
+ * the length of a take, that a bank switch takes the early downbeat hit
+ * from the incoming bank, that the note queue holds the heaviest step load,
+ * and that takes are saved from the main loop.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/storage.h"
+#include "ghost_note.h"
+#include "host/hal.h"
+#include "host_test.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "note_scheduler.h"
+#include "pattern_bank.h"
+
+#define TEST_TRACK 1  // Snare: no velocity LFO, so recorded velocities play as they are
+#define TEST_NOTE_ON 0x99
+#define TEST_NOTE 38
+#define TEST_KICK_TRACK 0  // Bass drum: follows the kick velocity LFO
+#define TEST_KICK_NOTE 36
+
+/*
+ * Runs the step timer and the note dispatch until `step` is the next step
+ * to play, playing at least one step.
+ */
+static void run_to_step(uint8_t step) {
+    looper_status_t *status = looper_status_get();
+    bool played = false;
+    while (!played || status->current_step != step) {
+        uint64_t last_us = status->timing.last_step_time_us;
+        host_async_run_until(host_async_next_time());
+        note_scheduler_dispatch_pending();
+        played |= status->timing.last_step_time_us != last_us;
+    }
+}
+
+// Runs until one more step has played.
+static void run_step(void) {
+    run_to_step((looper_status_get()->current_step + 1) % LOOPER_TOTAL_STEPS);
+}
+
+// Time of the last step played.
+static uint64_t last_step_us(void) { return looper_status_get()->timing.last_step_time_us; }
+
+// Clicks the button at `press_us` and lets the looper take the press and the release.
+static void click(uint64_t press_us) {
+    host_button_push(BUTTON_EVENT_DOWN, press_us);
+    host_button_push(BUTTON_EVENT_CLICK_RELEASE, press_us + 10000);
+    host_async_run_until(press_us + 10000);
+    looper_handle_input();
+    looper_handle_input();
+    note_scheduler_dispatch_pending();
+}
+
+static void test_quantize(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+    status->current_track = TEST_TRACK;
+    status->quantize_strength = 100;
+
+    run_to_step(5);  // step 4 has just played
+    click(last_step_us() + 10000);
+    CHECK_EQ(status->state, LOOPER_STATE_RECORDING);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 4));
+    CHECK_EQ(pattern->records[4][TEST_TRACK].offset, 0);
+    CHECK_EQ(pattern->records[4][TEST_TRACK].velocity, 0);
+
+    // Closer to the next step than to the last: the press belongs to step 5.
+    click(last_step_us() + status->step_period_us * 4 / 5);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 5));
+    CHECK_EQ(pattern->records[5][TEST_TRACK].offset, 0);
+
+    // With no quantizing the distance from the grid is kept, in 1/128 step.
+    status->quantize_strength = 0;
+    run_to_step(9);
+    click(last_step_us() + 10000);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 8));
+    CHECK_EQ(pattern->records[8][TEST_TRACK].offset,
+             10000 * LOOPER_MICROTIMING_ONE / (int32_t)status->step_period_us);
+    click(last_step_us() + status->step_period_us - 25000);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 9));
+    CHECK_EQ(pattern->records[9][TEST_TRACK].offset,
+             -25000 * LOOPER_MICROTIMING_ONE / (int32_t)status->step_period_us);
+
+    // A press on the last step's side of the loop end wraps to step 0.
+    status->quantize_strength = 100;
+    run_to_step(0);
+    click(last_step_us() + status->step_period_us - 10000);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 0));
+}
+
+static void test_record_and_play(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+
+    // The take ends after one loop and is stored; the track then plays what was recorded.
+    for (int i = 0; i < LOOPER_TOTAL_STEPS && status->state == LOOPER_STATE_RECORDING; i++)
+        run_step();
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++) {
+        bool recorded = step == 0 || step == 4 || step == 5 || step == 8 || step == 9;
+        CHECK_EQ(looper_pattern_hit(pattern, TEST_TRACK, step), recorded);
+    }
+
+    // A new take clears the track first; the click's velocity is the default.
+    run_to_step(3);
+    click(last_step_us() + 5000);
+    run_to_step(3);
+    run_to_step(3);
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+    CHECK_EQ(pattern->hits[4] & TRACK_BIT(TEST_TRACK), 0);
+
+    host_usb_midi_clear();
+    run_to_step(2);
+    uint64_t step2_us = status->timing.next_step_us;
+    run_to_step(2);
+    size_t count;
+    const host_midi_message_t *sent = host_usb_midi_sent(&count);
+    size_t played = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (sent[i].status != TEST_NOTE_ON || sent[i].data1 != TEST_NOTE)
+            continue;
+        played++;
+        CHECK_EQ(sent[i].time_us, step2_us);
+        CHECK_EQ(sent[i].data2, 0x7f);
+    }
+    CHECK_EQ(played, 1);
+}
+
+// A MIDI note-on is recorded like a click on the track that plays its note, with its velocity.
+static void test_record_note(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+    status->current_track = 0;
+
+    run_to_step(7);
+    looper_record_note(last_step_us() + 1000, TEST_NOTE, 90);
+    CHECK_EQ(status->current_track, TEST_TRACK);
+    CHECK_EQ(status->state, LOOPER_STATE_RECORDING);
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 6));
+    CHECK_EQ(pattern->records[6][TEST_TRACK].velocity, 90);
+
+    looper_record_note(last_step_us() + 1000, 0, 90);  // no track plays note 0
+    CHECK_EQ(status->current_track, TEST_TRACK);
+}
+
+/*
+ * An on-time hit and an early hit on the next step are scheduled from the
+ * same tick, and both play. Only the one recorded without velocity follows
+ * the velocity LFO.
+ */
+static void test_hit_and_early_hit(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+    for (int i = 0; i < 2 * LOOPER_TOTAL_STEPS && status->state == LOOPER_STATE_RECORDING; i++)
+        run_step();
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+
+    pattern->hits[10] |= TRACK_BIT(TEST_KICK_TRACK);
+    pattern->records[10][TEST_KICK_TRACK] = (step_record_t){.velocity = 90, .offset = 0};
+    pattern->hits[11] |= TRACK_BIT(TEST_KICK_TRACK);
+    pattern->records[11][TEST_KICK_TRACK] =
+        (step_record_t){.velocity = 0, .offset = -LOOPER_MICROTIMING_ONE / 4};
+
+    run_to_step(10);
+    host_usb_midi_clear();
+    run_to_step(12);
+    size_t count;
+    const host_midi_message_t *sent = host_usb_midi_sent(&count);
+    size_t played = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (sent[i].status != TEST_NOTE_ON || sent[i].data1 != TEST_KICK_NOTE)
+            continue;
+        if (played == 0) {
+            CHECK_EQ(sent[i].data2, 90);
+        } else {
+            CHECK(sent[i].data2 >= 75 && sent[i].data2 <= 125);
+        }
+        played++;
+    }
+    CHECK_EQ(played, 2);
+}
+
+static uint32_t stall_us;  // Held up the next step tick by this much, once
+
+static uint32_t stall_once(async_at_time_worker_t *worker) {
+    if (worker != &looper_status_get()->tick_timer)
+        return 0;
+    uint32_t us = stall_us;
+    stall_us = 0;
+    return us;
+}
+
+// A take lasts one loop of the grid, even when steps of it are skipped.
+static void test_skip_while_recording(void) {
+    looper_status_t *status = looper_status_get();
+    looper_set_catch_up(LOOPER_CATCH_UP_SKIP);
+    looper_overrun_reset();
+    host_async_set_stall(stall_once);
+
+    run_to_step(2);
+    uint64_t start_us = last_step_us();
+    click(start_us + 5000);
+    CHECK_EQ(status->state, LOOPER_STATE_RECORDING);
+
+    stall_us = 3 * status->step_period_us + 1000;  // the next tick ends past three more
+    for (int i = 0; i < 4 * LOOPER_TOTAL_STEPS && status->state == LOOPER_STATE_RECORDING; i++) {
+        host_async_run_until(host_async_next_time());
+        note_scheduler_dispatch_pending();
+    }
+    CHECK_EQ(looper_overrun_get()->skipped, 3);
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+    CHECK_EQ(last_step_us() - start_us, (LOOPER_TOTAL_STEPS + 1) * status->step_period_us);
+    host_async_set_stall(NULL);
+}
+
+/*
+ * The last step schedules the early hits of the next downbeat from the
+ * bank that plays it: switching to an empty bank, the outgoing bank's
+ * early hit on step 0 stays silent.
+ */
+static void test_early_downbeat_across_switch(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+
+    run_to_step(LOOPER_TOTAL_STEPS - 1);
+    pattern->hits[0] |= TRACK_BIT(TEST_TRACK);
+    pattern->records[0][TEST_TRACK] = (step_record_t){100, -LOOPER_MICROTIMING_ONE / 4};
+    pattern_bank_select(1);
+    pattern_bank_task();
+
+    host_usb_midi_clear();
+    run_to_step(1);
+    CHECK_EQ(pattern_bank_current(), 1);
+    size_t count;
+    const host_midi_message_t *sent = host_usb_midi_sent(&count);
+    for (size_t i = 0; i < count; i++)
+        CHECK(sent[i].status != TEST_NOTE_ON || sent[i].data2 != 100);
+}
+
+/*
+ * The heaviest load the looper puts on the note queue: every track plays a
+ * late hit and a ghost note on one step and an early hit on the next. It
+ * fits in each output's share of the queue with nothing refused or lost.
+ */
+static void test_note_queue_bound(void) {
+    looper_pattern_t *pattern = looper_pattern_get();
+    looper_set_num_tracks(LOOPER_MAX_TRACKS);
+    ghost_note_parameters_edit()->ghost_intensity = 1.0f;
+    ghost_note_parameters_commit();
+    ghost_note_parameters_sync();
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++) {
+        pattern->hits[step] = looper_active_tracks();
+        pattern->fills[step] = 0;
+        int8_t offset = (step % 2) ? -LOOPER_MICROTIMING_ONE / 2 : LOOPER_MICROTIMING_ONE / 2 - 1;
+        for (uint8_t t = 0; t < LOOPER_MAX_TRACKS; t++) {
+            pattern->records[step][t] = (step_record_t){100, offset};
+            pattern->ghost_notes[step][t] = (ghost_note_t){GHOST_NOTE_THRESHOLDS - 1, 0};
+        }
+    }
+
+    run_to_step(2);
+    note_scheduler_latency_reset();
+    run_to_step(7);
+    const note_scheduler_latency_t *latency = note_scheduler_latency_get();
+    CHECK_EQ(latency->refused, 0);
+    CHECK_EQ(latency->lost, 0);
+    CHECK(latency->peak >= LOOPER_MAX_TRACKS * 3);
+    CHECK(latency->peak <= NOTE_SCHEDULER_MAX_NOTES / LATENCY_OUTPUT_COUNT);
+
+    memset(pattern, 0, sizeof(*pattern));
+    looper_set_num_tracks(LOOPER_DEFAULT_TRACKS);
+    ghost_note_parameters_edit()->ghost_intensity = 0.0f;
+    ghost_note_parameters_commit();
+    ghost_note_parameters_sync();
+}
+
+/*
+ * A take is saved from the main loop once it has ended, over a save made
+ * while it ran. Starting the next take leaves the saved banks as they were.
+ */
+static void test_take_saved(void) {
+    looper_status_t *status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+
+    run_to_step(11);
+    looper_record_note(last_step_us() + 1000, TEST_NOTE, 100);
+    storage_request_store_tracks();  // as a console command during the take
+    storage_task();
+    run_to_step(13);
+    looper_record_note(last_step_us() + 1000, TEST_NOTE, 100);
+    for (int i = 0; i < 2 * LOOPER_TOTAL_STEPS && status->state == LOOPER_STATE_RECORDING; i++)
+        run_step();
+    CHECK_EQ(status->state, LOOPER_STATE_PLAYING);
+    storage_task();
+    track_mask_t saved[LOOPER_TOTAL_STEPS];
+    memcpy(saved, pattern->hits, sizeof(saved));
+
+    looper_record_note(last_step_us() + 1000, TEST_KICK_NOTE, 100);
+    run_step();
+    storage_task();
+    CHECK(storage_load_tracks());
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 10));
+    CHECK(looper_pattern_hit(pattern, TEST_TRACK, 12));
+    CHECK(memcmp(pattern->hits, saved, sizeof(saved)) == 0);
+}
+
+int main(void) {
+    host_test_quiet();
+    async_timer_init();
+    looper_schedule_step_timer();
+    midi_control_init();
+    note_scheduler_init();
+
+    // No ghost notes or fills, so only recorded hits play on the test track.
+    ghost_note_parameters_edit()->ghost_intensity = 0.0f;
+    ghost_note_parameters_commit();
+
+    test_quantize();
+    test_record_and_play();
+    test_record_note();
+    test_hit_and_early_hit();
+    test_skip_while_recording();
+    test_early_downbeat_across_switch();
+    test_note_queue_bound();
+    test_take_saved();
+    return host_test_result("test_looper");
+}
@@ -0,0 +1,99 @@
+/*
+ * test_note_scheduler.c
+ *
+ * Unit tests of the note scheduler: notes come out at their own time and
+ * in time order whatever order they were scheduled in, the queue holds a
+ * step on every track and turns further notes away, a dispatched note
+ * frees its slot, and notes refused or lost are counted.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "drivers/async_timer.h"
+#include "host/hal.h"
+#include "host_test.h"
+#include "note_scheduler.h"
+
+// Runs every due note worker, with a dispatch after each as the main loop would.
+static void run_all(void) {
+    while (host_async_next_time() != UINT64_MAX) {
+        host_async_run_until(host_async_next_time());
+        note_scheduler_dispatch_pending();
+    }
+}
+
+static void test_order(void) {
+    static const uint32_t delays_us[] = {3000, 1000, 2000, 1000, 500};
+    uint64_t start_us = time_us_64();
+    host_usb_midi_clear();
+    for (size_t i = 0; i < sizeof(delays_us) / sizeof(delays_us[0]); i++)
+        CHECK(note_scheduler_schedule_note(start_us + delays_us[i], 9, 36 + i, 100));
+    CHECK(!note_scheduler_pending());
+    run_all();
+
+    size_t count;
+    const host_midi_message_t *sent = host_usb_midi_sent(&count);
+    CHECK_EQ(count, 2 * sizeof(delays_us) / sizeof(delays_us[0]));  // note-on and note-off
+    static const uint8_t order[] = {40, 37, 39, 38, 36};             // by time, then as scheduled
+    for (size_t i = 0; i < count / 2 && i < sizeof(order); i++) {
+        const host_midi_message_t *on = &sent[2 * i];
+        CHECK_EQ(on->status, 0x99);
+        CHECK_EQ(on->data1, order[i]);
+        CHECK_EQ(on->time_us, start_us + delays_us[order[i] - 36]);
+    }
+    const note_scheduler_latency_t *latency = note_scheduler_latency_get();
+    CHECK_EQ(latency->max_us, 0);
+}
+
+static void test_exhaustion(void) {
+    uint64_t start_us = time_us_64();
+    host_usb_midi_clear();
+    note_scheduler_latency_reset();
+    size_t accepted = 0;
+    while (accepted < 1000 && note_scheduler_schedule_note(start_us + 1000, 0, 60, 100))
+        accepted++;
+    CHECK_EQ(accepted, NOTE_SCHEDULER_MAX_NOTES);
+    CHECK(accepted >= LOOPER_MAX_TRACKS * LATENCY_OUTPUT_COUNT);  // a step on every track
+    CHECK(!note_scheduler_schedule_note(start_us + 500, 0, 61, 100));
+    CHECK_EQ(note_scheduler_latency_get()->refused, 2);  // this one and the one ending the loop
+
+    // Every accepted note is played, and the slots are free again afterwards.
+    run_all();
+    size_t count;
+    host_usb_midi_sent(&count);
+    CHECK_EQ(count, 2 * accepted);
+    CHECK(note_scheduler_schedule_note(time_us_64() + 1000, 0, 62, 100));
+    run_all();
+    CHECK_EQ(note_scheduler_latency_get()->lost, 0);
+}
+
+// A note that fires while every pending entry still waits for the main loop is counted as lost.
+static void test_lost(void) {
+    uint64_t start_us = time_us_64();
+    host_usb_midi_clear();
+    note_scheduler_latency_reset();
+    for (size_t i = 0; i < NOTE_SCHEDULER_MAX_NOTES; i++)
+        note_scheduler_schedule_note(start_us + 1000, 0, 60, 100);
+    host_async_run_until(start_us + 1000);  // fired, not dispatched
+    CHECK(note_scheduler_schedule_note(start_us + 2000, 0, 61, 100));
+    host_async_run_until(start_us + 2000);
+    note_scheduler_dispatch_pending();
+
+    size_t count;
+    host_usb_midi_sent(&count);
+    CHECK_EQ(count, 2 * NOTE_SCHEDULER_MAX_NOTES);
+    CHECK_EQ(note_scheduler_latency_get()->lost, 1);
+    CHECK_EQ(note_scheduler_latency_get()->refused, 0);
+}
+
+int main(void) {
+    async_timer_init();
+    note_scheduler_init();
+    host_clock_set(1000000);
+
+    test_order();
+    test_exhaustion();
+    test_lost();
+    return host_test_result("test_note_scheduler");
+}
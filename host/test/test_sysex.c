@@ -0,0 +1,224 @@
+/*
+ * test_sysex.c
+ *
+ * Round trip of the SysEx bulk transfer: a session is dumped chunk by
+ * chunk, changed, and loaded back, and must play as it was from the next
+ * loop start. Also checks that images with out-of-range parameters are
+ * refused, and reports the dump throughput at one sysex_task() pass per
+ * millisecond, the main loop's period for it.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <math.h>
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/storage.h"
+#include "ghost_note.h"
+#include "host/hal.h"
+#include "host_test.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "note_scheduler.h"
+#include "pattern_bank.h"
+#include "pico/time.h"
+#include "sysex.h"
+
+#define TEST_PASS_US 1000  // Period of sysex_task() in the main loop
+#define TEST_MAX_PASSES 10
+#define TEST_CHUNKS ((sizeof(sysex_image_t) + SYSEX_CHUNK_BYTES - 1) / SYSEX_CHUNK_BYTES)
+
+// One message sent by the device.
+typedef struct {
+    sysex_command_t cmd;
+    uint16_t seq;
+    uint8_t data[SYSEX_CHUNK_BYTES + 1];
+    size_t length;
+} reply_t;
+
+static size_t reply_offset = 0;
+
+// Sends one message to the device as the host would, see the layout in sysex.h.
+static void send(sysex_command_t cmd, uint16_t seq, const uint8_t *data, size_t len) {
+    uint8_t m[SYSEX_MAX_MESSAGE_BYTES];
+    size_t n = 0;
+    m[n++] = 0xF0;
+    m[n++] = SYSEX_MANUFACTURER_ID;
+    m[n++] = SYSEX_DEVICE_ID;
+    m[n++] = cmd;
+    m[n++] = seq & 0x7F;
+    m[n++] = (seq >> 7) & 0x7F;
+    m[n++] = (uint8_t)len;
+    n += sysex_pack7(data, len, &m[n]);
+    uint8_t checksum = 0;
+    for (size_t i = 3; i < n; i++) checksum ^= m[i];
+    m[n++] = checksum & 0x7F;
+    m[n++] = 0xF7;
+    sysex_receive(SYSEX_PORT_USB, m, n);
+}
+
+// One main loop pass: the step timer and note dispatch run up to it, then sysex_task().
+static void task_pass(void) {
+    host_async_run_until(time_us_64() + TEST_PASS_US);
+    note_scheduler_dispatch_pending();
+    sysex_task();
+}
+
+// Runs passes until the device has sent a whole message; false if it sends none.
+static bool receive(reply_t *reply) {
+    for (int pass = 0; pass < TEST_MAX_PASSES; pass++) {
+        task_pass();
+        size_t length;
+        const uint8_t *sent = host_usb_midi_sysex(&length);
+        const uint8_t *end = memchr(&sent[reply_offset], 0xF7, length - reply_offset);
+        if (end == NULL)
+            continue;
+        const uint8_t *m = &sent[reply_offset];
+        size_t n = end - m + 1;
+        reply_offset += n;
+        if (n < 9 || m[0] != 0xF0)
+            return false;
+        reply->cmd = m[3];
+        reply->seq = m[4] | (m[5] << 7);
+        reply->length = sysex_unpack7(&m[7], n - 9, reply->data);
+        return reply->length == m[6];
+    }
+    return false;
+}
+
+// Loads `image` chunk by chunk; returns true if the device accepted it at END.
+static bool load(const sysex_image_t *image) {
+    const uint8_t *bytes = (const uint8_t *)image;
+    uint8_t length[2] = {sizeof(*image) & 0xFF, sizeof(*image) >> 8};
+    reply_t r;
+
+    send(SYSEX_CMD_LOAD_BEGIN, 0, length, sizeof(length));
+    if (!receive(&r) || r.cmd != SYSEX_CMD_ACK)
+        return false;
+    uint16_t seq = 0;
+    for (size_t offset = 0; offset < sizeof(*image); offset += SYSEX_CHUNK_BYTES, seq++) {
+        size_t n = sizeof(*image) - offset;
+        send(SYSEX_CMD_DATA, seq, &bytes[offset], n < SYSEX_CHUNK_BYTES ? n : SYSEX_CHUNK_BYTES);
+        CHECK(receive(&r));
+        CHECK_EQ(r.cmd, SYSEX_CMD_ACK);
+        CHECK_EQ(r.seq, seq);
+    }
+    send(SYSEX_CMD_END, seq, length, sizeof(length));
+    return receive(&r) && r.cmd == SYSEX_CMD_ACK;
+}
+
+// Runs the step timer until step 0 has been played, so a staged load is in play.
+static void run_loop_start(void) {
+    looper_status_t *status = looper_status_get();
+    while (status->current_step != 0) task_pass();
+    while (status->current_step == 0) task_pass();
+}
+
+static void set_intensity(float ghost_intensity) {
+    ghost_note_parameters_edit()->ghost_intensity = ghost_intensity;
+    ghost_note_parameters_commit();
+}
+
+static sysex_image_t image;
+static looper_pattern_t played;
+
+static void test_round_trip(void) {
+    looper_pattern_t *pattern = looper_pattern_get();
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step += LOOPER_STEPS_PER_BEAT) {
+        pattern->hits[step] |= TRACK_BIT(0);
+        pattern->hits[(step + 6) % LOOPER_TOTAL_STEPS] |= TRACK_BIT(2);
+    }
+    pattern->hits[LOOPER_STEPS_PER_BEAT] |= TRACK_BIT(1);
+    looper_update_bpm(100);
+    set_intensity(0.6f);
+    run_loop_start();
+    played = *pattern;
+
+    // Every chunk is acknowledged before the next goes out.
+    uint64_t start_us = time_us_64();
+    uint8_t *bytes = (uint8_t *)&image;
+    size_t received = 0;
+    reply_t r;
+    send(SYSEX_CMD_DUMP_REQUEST, 0, NULL, 0);
+    while (receive(&r) && r.cmd == SYSEX_CMD_DATA) {
+        CHECK_EQ(r.seq * SYSEX_CHUNK_BYTES, received);
+        if (received + r.length > sizeof(image))
+            break;
+        memcpy(&bytes[received], r.data, r.length);
+        received += r.length;
+        send(SYSEX_CMD_ACK, r.seq, NULL, 0);
+    }
+    CHECK_EQ(r.cmd, SYSEX_CMD_END);
+    CHECK_EQ(received, sizeof(image));
+    send(SYSEX_CMD_ACK, r.seq, NULL, 0);
+    uint64_t elapsed_us = time_us_64() - start_us;
+    fprintf(stderr, "test_sysex: %zu byte dump in %llu us, %.0f bytes/s\n", sizeof(image),
+            (unsigned long long)elapsed_us, sizeof(image) * 1e6 / elapsed_us);
+    CHECK(elapsed_us <= (TEST_CHUNKS + 1) * TEST_PASS_US);  // one pass per message
+
+    CHECK(memcmp(image.magic, SYSEX_IMAGE_MAGIC, sizeof(image.magic)) == 0);
+    CHECK_EQ(image.bpm, 100);
+    CHECK(image.ghost_intensity == 0.6f);
+    for (uint8_t step = 0; step < LOOPER_TOTAL_STEPS; step++) {
+        for (size_t t = 0; t < LOOPER_MAX_TRACKS; t++)
+            CHECK_EQ((image.pattern[t][step / 8] >> (step % 8)) & 0x01,
+                     looper_pattern_hit(&played, t, step));
+    }
+
+    // Changed, then loaded back: the load waits for the loop start.
+    memset(pattern->hits, 0, sizeof(pattern->hits));
+    looper_update_bpm(130);
+    set_intensity(0.2f);
+    CHECK(load(&image));
+    CHECK_EQ(pattern->hits[0], 0);
+    CHECK_EQ(looper_status_get()->bpm, 130);
+
+    run_loop_start();
+    pattern = looper_pattern_get();
+    CHECK(memcmp(pattern->hits, played.hits, sizeof(played.hits)) == 0);
+    CHECK_EQ(looper_status_get()->bpm, 100);
+    CHECK(ghost_note_parameters()->ghost_intensity == 0.6f);
+    CHECK(memcmp(pattern_bank_set()->hits[pattern_bank_current()], played.hits,
+                 sizeof(played.hits)) == 0);
+}
+
+// An image is refused at END if any parameter is outside its controller's range.
+static void test_invalid(void) {
+    const looper_pattern_t *pattern = looper_pattern_get();
+    sysex_image_t bad;
+
+    bad = image;
+    bad.ghost_intensity = NAN;
+    CHECK(!load(&bad));
+    bad = image;
+    bad.euclid_probability = 1.5f;
+    CHECK(!load(&bad));
+    bad = image;
+    bad.fill_start_sd = -1.0f;
+    CHECK(!load(&bad));
+    bad = image;
+    bad.fill_start_mean = INFINITY;
+    CHECK(!load(&bad));
+    bad = image;
+    bad.bpm = 0;
+    CHECK(!load(&bad));
+
+    run_loop_start();
+    CHECK(pattern == looper_pattern_get());  // nothing was swapped in
+    CHECK(load(&image));
+}
+
+int main(void) {
+    host_test_quiet();
+    async_timer_init();
+    looper_schedule_step_timer();
+    midi_control_init();
+    note_scheduler_init();
+    storage_load_tracks();
+
+    test_round_trip();
+    test_invalid();
+    return host_test_result("test_sysex");
+}
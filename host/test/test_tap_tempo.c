@@ -0,0 +1,167 @@
+/*
+ * test_tap_tempo.c
+ *
+ * Unit tests of the tap tempo fit: exact and fractional tempos, a tap off
+ * the beat, a skipped beat, and leaving or timing out of the mode. A
+ * convergence test plays runs of taps with Gaussian timing jitter and holds
+ * the reported confidence against the actual tempo error.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "tap_tempo.h"
+
+static uint64_t session_us = 10000000;  // each session starts well after the last one timed out
+
+// Enters tap collection; the click that starts it is not a tap.
+static void tap_begin(void) {
+    session_us += 10000000;
+    taptempo_handle_event(BUTTON_EVENT_CLICK_RELEASE, session_us);
+}
+
+static tap_result_t tap(uint64_t time_us) {
+    return taptempo_handle_event(BUTTON_EVENT_CLICK_RELEASE, session_us + time_us);
+}
+
+static void tap_end(void) {
+    CHECK_EQ(taptempo_handle_event(BUTTON_EVENT_HOLD_RELEASE, 0), TAP_EXIT);
+}
+
+static void test_exact(void) {
+    tap_begin();
+    CHECK(taptempo_active());
+    CHECK_EQ(tap(0), TAP_NONE);
+    CHECK_EQ(tap(500000), TAP_PRELIM);
+    CHECK_EQ(taptempo_get_bpm_x100(), 12000);
+    CHECK_EQ(tap(1000000), TAP_FINAL);
+    for (int i = 3; i < 8; i++) CHECK_EQ(tap(i * 500000ull), TAP_FINAL);
+    CHECK_EQ(taptempo_get_bpm_x100(), 12000);
+    CHECK_EQ(taptempo_get_bpm(), 120);
+    CHECK_EQ(taptempo_get_confidence(), 100);
+    tap_end();
+    CHECK(!taptempo_active());
+}
+
+// 123.45 BPM is kept to the hundredth, past the whole microsecond each tap is rounded to.
+static void test_fractional(void) {
+    double period_us = 60e6 / 123.45;
+    tap_begin();
+    for (int i = 0; i < 16; i++) tap((uint64_t)(i * period_us + 0.5));
+    CHECK(abs((int)taptempo_get_bpm_x100() - 12345) <= 1);
+    CHECK_EQ(taptempo_get_bpm(), 123);
+    tap_end();
+}
+
+// A sloppy tap is dropped from the fit, and a skipped beat does not halve the tempo.
+static void test_outlier_and_skip(void) {
+    tap_begin();
+    for (int i = 0; i < 10; i++) tap(i * 500000ull + (i == 5 ? 90000 : 0));
+    CHECK_EQ(taptempo_get_bpm_x100(), 12000);
+    tap_end();
+
+    tap_begin();
+    for (int i = 0; i < 10; i++)
+        if (i != 4)
+            tap(i * 500000ull);
+    CHECK_EQ(taptempo_get_bpm_x100(), 12000);
+    tap_end();
+}
+
+// Over 2 s without a tap ends the session; the next click starts a new one.
+static void test_timeout(void) {
+    tap_begin();
+    tap(0);
+    tap(600000);
+    CHECK_EQ(taptempo_get_bpm_x100(), 10000);
+    CHECK_EQ(tap(3000000), TAP_NONE);
+    CHECK(!taptempo_active());
+    CHECK_EQ(tap(3100000), TAP_NONE);
+    CHECK(taptempo_active());
+    CHECK_EQ(taptempo_get_bpm_x100(), 10000);
+    tap_end();
+}
+
+#define TEST_SEED 1
+#define TEST_SESSIONS 200
+#define TEST_FULL_ERROR 0.0025  // Error a confidence of 100 stands for, see tap_tempo.c
+
+static double gaussian(void) {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+typedef struct {
+    double mean_error;  // relative to the tempo
+    double mean_confidence;
+    int full;            // sessions at confidence 100
+    int full_in_bounds;  // ... of which within TEST_FULL_ERROR
+} convergence_t;
+
+// Plays TEST_SESSIONS runs of `taps` taps at 120 BPM, each off the beat by N(0, jitter_ms).
+static convergence_t converge(int taps, double jitter_ms) {
+    convergence_t c = {0};
+    for (int s = 0; s < TEST_SESSIONS; s++) {
+        tap_begin();
+        for (int i = 0; i < taps; i++)
+            tap((uint64_t)(100000 + i * 500000 + gaussian() * jitter_ms * 1000));
+        double error = fabs(taptempo_get_bpm_x100() / 12000.0 - 1.0);
+        uint8_t confidence = taptempo_get_confidence();
+        c.mean_error += error / TEST_SESSIONS;
+        c.mean_confidence += (double)confidence / TEST_SESSIONS;
+        if (confidence == 100) {
+            c.full++;
+            c.full_in_bounds += error <= TEST_FULL_ERROR;
+        }
+        tap_end();
+    }
+    return c;
+}
+
+/*
+ * More taps narrow the error, more jitter lowers the confidence, and a
+ * confidence of 100 means the tempo is within 0.25 % 95 % of the time.
+ */
+static void test_convergence(void) {
+    static const int taps[] = {4, 8, 16};
+    static const double jitter_ms[] = {2, 10, 40};
+    convergence_t c[3][3];
+    int full = 0, full_in_bounds = 0;
+
+    srand(TEST_SEED);
+    for (int t = 0; t < 3; t++) {
+        for (int j = 0; j < 3; j++) {
+            c[t][j] = converge(taps[t], jitter_ms[j]);
+            full += c[t][j].full;
+            full_in_bounds += c[t][j].full_in_bounds;
+            fprintf(stderr,
+                    "test_tap_tempo: taps=%2d jitter=%2.0fms error=%.3f%% confidence=%.0f\n",
+                    taps[t], jitter_ms[j], c[t][j].mean_error * 100, c[t][j].mean_confidence);
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        CHECK(c[1][j].mean_error < c[0][j].mean_error);
+        CHECK(c[2][j].mean_error < c[1][j].mean_error);
+    }
+    for (int t = 0; t < 3; t++) {
+        CHECK(c[t][1].mean_confidence <= c[t][0].mean_confidence);
+        CHECK(c[t][2].mean_confidence < c[t][1].mean_confidence);
+    }
+    CHECK(full_in_bounds >= full * 95 / 100);
+    CHECK_EQ(c[2][0].full, TEST_SESSIONS);  // a steady hand gets there in 16 taps
+    CHECK(c[0][2].mean_confidence < 10);    // four sloppy taps are not trusted
+}
+
+int main(void) {
+    test_exact();
+    test_fractional();
+    test_outlier_and_skip();
+    test_timeout();
+    test_convergence();
+    return host_test_result("test_tap_tempo");
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "looper.h"
+
+#ifndef CAPTURE_NOTES
+#define CAPTURE_NOTES 2048  // Notes kept; 4 bytes each, 64 bars at two notes a step
+#endif
+
+#define CAPTURE_POSITIONS 8192  // Loop steps told apart by capture_note_t.position
+
+#if CAPTURE_POSITIONS % LOOPER_TOTAL_STEPS != 0
+#error "LOOPER_TOTAL_STEPS must divide CAPTURE_POSITIONS"
+#endif
+
+// One note as it was played.
+typedef struct {
+    uint32_t position : 13;  // loop_count * LOOPER_TOTAL_STEPS + nearest step, wrapping
+    uint32_t track : 4;
+    uint32_t velocity : 7;
+    uint32_t offset : 8;  // int8_t distance from the step, 1/LOOPER_MICROTIMING_ONE step
+} capture_note_t;
+
+// Loop steps from position `from` to `note`, within half of CAPTURE_POSITIONS either way.
+static inline int capture_steps_from(uint32_t from, capture_note_t note) {
+    uint16_t steps = (note.position - from) & (CAPTURE_POSITIONS - 1);
+    return (steps < CAPTURE_POSITIONS / 2) ? steps : steps - CAPTURE_POSITIONS;
+}
+
+void capture_note(uint64_t time_us, uint8_t track, uint8_t velocity);
+
+void capture_hold(bool hold);
+
+uint16_t capture_count(void);
+
+capture_note_t capture_get(uint16_t index);
+
+uint32_t capture_position(void);
+
+bool capture_freeze(uint8_t bank, uint8_t loops_back);
+
+void capture_status(void);
@@ -0,0 +1,10 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#define CONSOLE_LINE_LENGTH 80  // Longest command line accepted
+
+void console_task(void);
@@ -6,10 +6,37 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+typedef struct {
+    uint32_t packets;   // Notifications sent
+    uint32_t messages;  // Channel messages carried in them
+    uint32_t dropped;   // Messages lost to a full TX queue
+    uint32_t received;  // Messages parsed from incoming packets
+} ble_midi_stats_t;
+
+// Negotiated connection parameters, in the units of the Bluetooth Core spec.
+typedef struct {
+    uint16_t interval;             // x 1.25 ms
+    uint16_t latency;              // peripheral latency, connection events
+    uint16_t supervision_timeout;  // x 10 ms
+    uint16_t mtu;                  // ATT MTU
+    uint16_t max_tx_octets;        // LL payload after data length extension
+    uint16_t max_rx_octets;
+    uint16_t updates;              // connection updates applied so far
+} ble_midi_link_t;
+
 void ble_midi_init(void);
 
 bool ble_midi_is_connected(void);
 
-void ble_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity);
+void ble_midi_send_note(uint64_t time_us, uint8_t channel, uint8_t note, uint8_t velocity);
+
+void ble_midi_send_message(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2);
+
+bool ble_midi_send_sysex(const uint8_t *data, size_t len);
+
+const ble_midi_stats_t *ble_midi_stats(void);
+
+const ble_midi_link_t *ble_midi_link(void);
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One queued channel message and its 13-bit millisecond timestamp.
+typedef struct {
+    uint16_t timestamp_ms;
+    uint8_t length;
+    uint8_t data[3];
+} ble_midi_message_t;
+
+// The 13-bit millisecond timestamp BLE-MIDI carries for `time_us`.
+static inline uint16_t ble_midi_timestamp(uint64_t time_us) {
+    return (uint16_t)((time_us / 1000) & 0x1FFF);
+}
+
+uint16_t ble_midi_packet_encode(const ble_midi_message_t *messages, size_t count,
+                                uint16_t payload_max, uint8_t *packet, size_t *used);
+
+uint16_t ble_midi_packet_encode_sysex(const uint8_t *data, size_t len, size_t *sent,
+                                      uint16_t timestamp_ms, uint16_t payload_max,
+                                      uint8_t *packet);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <hardware/sync.h>
+#include <stdint.h>
 
 typedef enum {
     BUTTON_EVENT_NONE,
@@ -21,4 +22,6 @@ typedef enum {
 
 bool __no_inline_not_in_flash_func(bb_get_bootsel_button)();
 
-button_event_t button_poll_event(void);
+void button_init(void);
+
+button_event_t button_poll_event(uint64_t *time_us);
@@ -8,4 +8,4 @@
 #include "looper.h"
 
 void display_update_looper_status(bool ble_connected, const looper_status_t *looper,
-                                  const track_t *tracks, size_t num_tracks);
+                                  const track_t *tracks, const looper_pattern_t *pattern);
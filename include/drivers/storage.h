@@ -5,8 +5,11 @@
  */
 #pragma once
 
+#include "latency.h"
 #include "looper.h"
 
 bool storage_load_tracks(void);
-bool storage_erase_tracks(void);
-bool storage_store_tracks(void);
+void storage_request_store_tracks(void);
+void storage_task(void);
+bool storage_load_latency(latency_offsets_t *offsets);
+bool storage_store_latency(const latency_offsets_t *offsets);
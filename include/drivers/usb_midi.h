@@ -6,6 +6,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 void usb_midi_init(void);
@@ -14,4 +15,10 @@ bool usb_midi_is_connected(void);
 
 void usb_midi_send_note(uint8_t channel, uint8_t note, uint8_t velocity);
 
+bool usb_midi_send_message(uint8_t status, uint8_t data1, uint8_t data2);
+
+size_t usb_midi_send_sysex(const uint8_t *data, size_t len);
+
+bool usb_midi_task_ready(void);
+
 void usb_midi_task(void);
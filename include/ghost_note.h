@@ -35,16 +35,57 @@ typedef struct {
     fill_parameters_t fill;
 } ghost_parameters_t;
 
-uint8_t *ghost_note_velocity_table(void);
+#define GHOST_NOTE_THRESHOLDS 101        // One per ghost note probability, 0-100 %
+#define GHOST_NOTE_SWING_CURVE_SIZE 64  // Swing ratios over one LFO period
 
-uint8_t ghost_note_modulate_base_velocity(uint8_t track_num, uint8_t default_velocity, float lfo);
+/*
+ * A ghost engine of its own, for rendering a pattern that is not playing:
+ * a snapshot of the parameters and of the tracks in play, the tables
+ * derived from them and a random state. Nothing in it is shared with
+ * playback, so a render runs without the async context lock.
+ */
+typedef struct {
+    ghost_parameters_t params;
+    uint8_t threshold[GHOST_NOTE_THRESHOLDS];
+    float swing_curve[GHOST_NOTE_SWING_CURVE_SIZE];
+    float fill_start_sigma;
+    const track_t *tracks;  // The looper's track table
+    size_t num_tracks;
+    track_mask_t active;
+    uint32_t seed;  // xorshift32 state
+} ghost_render_t;
+
+uint8_t ghost_note_modulate_base_velocity(const track_t *track, uint8_t default_velocity,
+                                          float lfo);
 
 float ghost_note_modulate_swing_ratio(float lfo);
 
-void ghost_note_create(track_t *track);
+void ghost_note_create(looper_pattern_t *pattern, uint8_t track);
+
+void ghost_note_create_with(looper_pattern_t *pattern, uint8_t track,
+                            const ghost_parameters_t *params);
 
 void ghost_note_maintenance_step(void);
 
-ghost_parameters_t *ghost_note_parameters(void);
+void ghost_note_render_init(ghost_render_t *render, uint32_t seed);
+
+void ghost_note_render_create(ghost_render_t *render, looper_pattern_t *pattern);
+
+void ghost_note_render_step(ghost_render_t *render, looper_pattern_t *pattern, uint8_t step,
+                            uint8_t *bar_counter);
+
+bool ghost_note_render_is_active(const ghost_render_t *render, const ghost_note_t *ghost);
+
+float ghost_note_render_swing_ratio(const ghost_render_t *render, float lfo);
+
+const ghost_parameters_t *ghost_note_parameters(void);
+
+ghost_parameters_t *ghost_note_parameters_edit(void);
+
+void ghost_note_parameters_commit(void);
+
+void ghost_note_parameters_sync(void);
+
+bool ghost_note_is_active(const ghost_note_t *ghost);
 
 void ghost_note_set_pending_fill_request(void);
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    GROOVE_SWING_16TH = 0,  // MPC-style: the swing ratio delays every odd 16th
+    GROOVE_SWING_8TH,       // the swing ratio delays the off-beat 8th
+    GROOVE_SHUFFLE,         // triplet 16ths, independent of the swing ratio
+    GROOVE_RECORDED,        // microtiming learned from the last recording
+    GROOVE_COUNT,
+} groove_template_t;
+
+void groove_select(groove_template_t groove);
+
+groove_template_t groove_selected(void);
+
+void groove_update(uint32_t step_period_us, float swing_ratio_base, float swing_ratio);
+
+uint32_t groove_offset_us(uint8_t step);
+
+int32_t groove_step_q15(uint8_t step, float swing_ratio);
+
+void groove_learn_reset(void);
+
+void groove_learn(uint8_t step, int32_t offset_us, uint32_t step_period_us);
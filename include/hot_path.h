@@ -0,0 +1,26 @@
+/*
+ * Placement of the step tick path: the step timer, the ghost engine and
+ * the note scheduler. Built with -DHOT_PATH_IN_RAM=1, the functions marked
+ * HOT_PATH_FUNC and the constant tables marked HOT_PATH_DATA are copied to
+ * SRAM at boot, so a tick never waits on an XIP cache miss. Variables are
+ * in SRAM either way. Otherwise both macros leave the code in flash.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include "hardware/sync.h"
+
+#ifndef HOT_PATH_IN_RAM
+#define HOT_PATH_IN_RAM 0  // Build with -DHOT_PATH_IN_RAM=1 to run the tick path from SRAM
+#endif
+
+#if HOT_PATH_IN_RAM
+#define HOT_PATH_FUNC(func_name) __not_in_flash_func(func_name)
+#define HOT_PATH_DATA __not_in_flash("hot_path_data")
+#else
+#define HOT_PATH_FUNC(func_name) func_name
+#define HOT_PATH_DATA
+#endif
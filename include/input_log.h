@@ -0,0 +1,41 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "drivers/button.h"
+
+#ifndef INPUT_LOG_EVENTS
+#define INPUT_LOG_EVENTS 1024  // Inputs kept per recording; 8 bytes each
+#endif
+
+typedef enum {
+    INPUT_LOG_BUTTON = 0,  // data[0] = button_event_t
+    INPUT_LOG_MIDI,        // data = status, data1, data2
+    INPUT_LOG_USB,         // data[0] = 1 when mounted
+} input_log_kind_t;
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t kind;
+    uint8_t data[3];
+} input_log_event_t;
+
+void input_log_button(button_event_t event, uint64_t time_us);
+
+void input_log_midi(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2);
+
+void input_log_start(void);
+
+void input_log_stop(void);
+
+void input_log_dump(void);
+
+bool input_log_dumping(void);
+
+void input_log_task(void);
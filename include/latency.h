@@ -0,0 +1,50 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "drivers/button.h"
+
+#define LATENCY_MAX_US 200000  // Offsets are clamped to this range
+
+typedef enum {
+    LATENCY_OUTPUT_USB = 0,
+    LATENCY_OUTPUT_BLE,
+    LATENCY_OUTPUT_COUNT,
+} latency_output_t;
+
+#define LATENCY_OUTPUT_BIT(output) (1u << (output))
+#define LATENCY_OUTPUT_ALL ((1u << LATENCY_OUTPUT_COUNT) - 1)
+
+typedef struct {
+    int32_t input_us;                         // Subtracted from button times before quantizing
+    int32_t output_us[LATENCY_OUTPUT_COUNT];  // One-way latency of each destination
+} latency_offsets_t;
+
+typedef enum {
+    LATENCY_CALIBRATION_IDLE = 0,
+    LATENCY_CALIBRATION_LOOPBACK,  // Probe notes returned through MIDI IN
+    LATENCY_CALIBRATION_TAP,       // Button taps along with a click
+} latency_calibration_t;
+
+void latency_init(void);
+
+const latency_offsets_t *latency_offsets(void);
+
+uint32_t latency_output_delay_us(latency_output_t output);
+
+void latency_calibration_start(latency_calibration_t mode);
+
+latency_calibration_t latency_calibration_mode(void);
+
+bool latency_calibration_handle_button(button_event_t event, uint64_t time_us);
+
+bool latency_calibration_receive(latency_output_t port, uint8_t status, uint8_t data1,
+                                 uint8_t data2);
+
+void latency_task(void);
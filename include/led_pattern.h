@@ -0,0 +1,24 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdint.h>
+
+// What the status LED shows; each looper state selects one.
+typedef enum {
+    LED_PATTERN_OFF = 0,  // sync mute
+    LED_PATTERN_ON,       // recording, sync playing
+    LED_PATTERN_BAR,      // lit on the first step of every bar: waiting for a connection
+    LED_PATTERN_BEAT,     // lit on the first step of every beat: tap tempo
+    LED_PATTERN_TRACK,    // lit on the current track's hits: playing
+    LED_PATTERN_COUNT,
+} led_pattern_t;
+
+void led_pattern_init(void);
+
+void led_pattern_set(led_pattern_t pattern);
+
+led_pattern_t led_pattern_get(void);
@@ -13,6 +13,18 @@
 #define LOOPER_BARS 2            // Loop length in bars
 #define LOOPER_BEATS_PER_BAR 4   // Time signature numerator (e.g., 4/4)
 #define LOOPER_STEPS_PER_BEAT 4  // Resolution (4 = 16th notes)
+#define LOOPER_DEFAULT_TRACKS 4  // Tracks active until another count is set
+
+#ifndef LOOPER_CATCH_UP_BURST_STEPS
+#define LOOPER_CATCH_UP_BURST_STEPS 4  // Late steps played back to back; any more are skipped
+#endif
+
+#ifndef LOOPER_MAX_TRACKS
+#define LOOPER_MAX_TRACKS 16  // Build-time limit on the track count
+#endif
+#if LOOPER_MAX_TRACKS > 16
+#error "LOOPER_MAX_TRACKS must fit in track_mask_t"
+#endif
 
 #define LOOPER_TOTAL_STEPS (LOOPER_STEPS_PER_BEAT * LOOPER_BEATS_PER_BAR * LOOPER_BARS)
 #define LOOPER_CLICK_DIV (LOOPER_TOTAL_STEPS / LOOPER_BARS / LOOPER_BEATS_PER_BAR)
@@ -33,7 +45,8 @@ typedef enum {
 
 typedef struct {
     uint64_t last_step_time_us;      // Time of last step transition
-    uint64_t button_press_start_us;  // Timestamp when button was pressed
+    uint64_t button_press_start_us;  // Raw edge time of the last button press
+    uint64_t next_step_us;           // Deadline of the next internal-clock step
 } looper_timing_t;
 
 typedef enum {
@@ -41,17 +54,37 @@ typedef enum {
     LOOPER_CLOCK_EXTERNAL,      // MIDI clock
 } looper_clock_source_t;
 
+// What the internal step clock does when a step finishes past the next one's deadline.
+typedef enum {
+    LOOPER_CATCH_UP_SKIP = 0,  // Drop the missed steps and go on at the right place in the bar
+    LOOPER_CATCH_UP_BURST,     // Play the missed steps at once, then go on on the grid
+    LOOPER_CATCH_UP_STRETCH,   // Go on from now, shifting the loop later by the overrun
+    LOOPER_CATCH_UP_COUNT,
+} looper_catch_up_t;
+
+// Step clock overruns since boot or the last reset.
+typedef struct {
+    uint32_t overruns;      // Steps that finished past the next step's deadline
+    uint32_t skipped;       // Steps dropped without being played
+    uint32_t max_late_us;   // Latest start of a step after its deadline
+    uint64_t stretched_us;  // Total shift of the loop by stretching
+} looper_overrun_t;
+
 /*
  * Runtime playback state, managed globally.
  * Holds track index, current step, recording progress, and last tick time.
  */
 typedef struct {
     uint32_t bpm;
-    uint32_t step_period_ms;
+    uint32_t bpm_x100;  // Fractional tempo in hundredths of a BPM
+    uint32_t step_period_us;
     looper_state_t state;          // Current looper mode (e.g. PLAYING, RECORDING).
+    uint8_t num_tracks;            // Tracks in use, 1 to LOOPER_MAX_TRACKS.
     uint8_t current_track;         // Index of the active track (for recording or preview).
     uint8_t current_step;          // Index of the current step in the sequence loop.
+    uint16_t loop_count;           // Loops started since boot, wrapping.
     uint8_t recording_step_count;  // Step count for ongoing recording session (resets on new record).
+    uint8_t quantize_strength;     // 0-100 %: share of the microtiming removed when recording
     looper_timing_t timing;
     uint8_t ghost_bar_counter;
     uint16_t lfo_phase;
@@ -65,17 +98,55 @@ typedef struct {
     uint8_t rand_sample;
 } ghost_note_t;
 
-// Represents each MIDI track with note and sequence pattern.
+#define LOOPER_MICROTIMING_ONE 128  // step_record_t.offset units per step
+
+// Performance detail captured with a recorded hit.
 typedef struct {
-    const char *name;                       // Human-readable name of the track.
-    uint8_t note;                           // MIDI note to trigger.
-    uint8_t channel;                        // MIDI channel.
-    bool pattern[LOOPER_TOTAL_STEPS];       // Current active pattern
-    bool hold_pattern[LOOPER_TOTAL_STEPS];  // Temporary copy saved on button down.
-    ghost_note_t ghost_notes[LOOPER_TOTAL_STEPS];
-    bool fill_pattern[LOOPER_TOTAL_STEPS];
+    uint8_t velocity;  // 0 = default (0x7f, LFO-modulated)
+    int8_t offset;     // microtiming from the grid, 1/128 step, within half a step
+} step_record_t;
+
+typedef uint16_t track_mask_t;  // One bit per track
+
+#define TRACK_BIT(track) ((track_mask_t)(1u << (track)))
+
+// How a track's velocity follows the LFO.
+typedef enum {
+    TRACK_LFO_NONE = 0,
+    TRACK_LFO_KICK,   // slow swell
+    TRACK_LFO_HIHAT,  // twice the LFO rate
+} track_lfo_t;
+
+// Represents each MIDI track: the note it plays and its role in generated notes.
+typedef struct {
+    const char *name;          // Human-readable name of the track.
+    uint8_t note;              // MIDI note to trigger.
+    uint8_t channel;           // MIDI channel.
+    uint8_t ghost_velocity;    // Velocity of ghost notes.
+    bool fill;                 // Takes part in generated fill-ins.
+    track_lfo_t velocity_lfo;  // Velocity modulation of recorded hits.
 } track_t;
 
+/*
+ * Per-step data of every track, laid out by step: the tracks sounding on a
+ * step are a single mask, so a step is evaluated with bit operations.
+ */
+typedef struct {
+    track_mask_t hits[LOOPER_TOTAL_STEPS];   // Recorded pattern
+    track_mask_t fills[LOOPER_TOTAL_STEPS];  // Generated fill-in notes
+    step_record_t records[LOOPER_TOTAL_STEPS][LOOPER_MAX_TRACKS];  // Velocity and microtiming
+    ghost_note_t ghost_notes[LOOPER_TOTAL_STEPS][LOOPER_MAX_TRACKS];
+} looper_pattern_t;
+
+static inline bool looper_pattern_hit(const looper_pattern_t *pattern, uint8_t track,
+                                      uint8_t step) {
+    return pattern->hits[step] & TRACK_BIT(track);
+}
+
+static inline bool looper_pattern_fill(const looper_pattern_t *pattern, uint8_t track,
+                                       uint8_t step) {
+    return pattern->fills[step] & TRACK_BIT(track);
+}
 
 void looper_status_led_init(void);
 
@@ -83,19 +154,42 @@ looper_status_t *looper_status_get(void);
 
 track_t *looper_tracks_get(size_t *num_tracks);
 
+track_mask_t looper_active_tracks(void);
+
+void looper_set_num_tracks(uint8_t num_tracks);
+
+looper_pattern_t *looper_pattern_get(void);
+
+looper_pattern_t *looper_pattern_standby(void);
+
+void looper_pattern_swap(void);
+
 void looper_update_bpm(uint32_t bpm);
 
+void looper_update_bpm_x100(uint32_t bpm_x100);
+
+void looper_set_catch_up(looper_catch_up_t catch_up);
+
+looper_catch_up_t looper_catch_up_get(void);
+
+const looper_overrun_t *looper_overrun_get(void);
+
+void looper_overrun_reset(void);
+
+void looper_record_note(uint64_t time_us, uint8_t note, uint8_t velocity);
+
 void looper_process_state(uint64_t start_us);
 
-void looper_handle_button_event(button_event_t event);
+void looper_handle_button_event(button_event_t event, uint64_t time_us);
 
 void looper_handle_tick(async_context_t *ctx, async_at_time_worker_t *worker);
 
-void looper_handle_midi_tick(void);
+void looper_handle_midi_tick(uint64_t time_us);
 void looper_handle_midi_start(void);
 
 void looper_handle_input(void);
 
 void looper_schedule_step_timer(void);
 
-void looper_perform_note(uint8_t channel, uint8_t note, uint8_t velocity);
+void looper_perform_note(uint8_t outputs, uint64_t time_us, uint8_t channel, uint8_t note,
+                         uint8_t velocity);
@@ -0,0 +1,12 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include "run_loop.h"
+
+const run_loop_task_t *main_tasks_get(size_t *count);
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Controllable parameters. Each one is reachable as
+ *  - NRPN MSB 0 / LSB <index> with 14-bit data entry (CC6 + CC38),
+ *  - a 14-bit CC pair: MSB on CC(14 + index), LSB on CC(46 + index),
+ *  - and, for the original set, a 7-bit CC on CC70-80.
+ */
+typedef enum {
+    MIDI_CONTROL_GHOST_INTENSITY = 0,
+    MIDI_CONTROL_EUCLID_K_MAX,
+    MIDI_CONTROL_EUCLID_K_SUFFICIENT,
+    MIDI_CONTROL_EUCLID_K_INTENSITY,
+    MIDI_CONTROL_EUCLID_PROBABILITY,
+    MIDI_CONTROL_BOUNDARY_BEFORE,
+    MIDI_CONTROL_BOUNDARY_AFTER,
+    MIDI_CONTROL_FILL_START_MEAN,
+    MIDI_CONTROL_FILL_START_SD,
+    MIDI_CONTROL_FILL_PROBABILITY,
+    MIDI_CONTROL_FILL_INTERVAL_BAR,
+    MIDI_CONTROL_BPM,
+    MIDI_CONTROL_SWING,
+    MIDI_CONTROL_TEMPO_APPLY,        // 0 immediate, 1 next beat, 2 next bar
+    MIDI_CONTROL_TEMPO_CURVE,        // 0 linear, 1 exponential
+    MIDI_CONTROL_TEMPO_RAMP_BARS,    // 0 jumps to the new BPM
+    MIDI_CONTROL_GROOVE,             // groove_template_t
+    MIDI_CONTROL_QUANTIZE_STRENGTH,  // 0-100 % of the recorded microtiming removed
+    MIDI_CONTROL_COUNT,
+} midi_control_t;
+
+void midi_control_init(void);
+
+bool midi_control_handle_cc(uint8_t channel, uint8_t cc, uint8_t value);
+
+void midi_control_step(void);
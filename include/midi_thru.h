@@ -0,0 +1,36 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef MIDI_THRU_DEFAULT_ENABLED
+#define MIDI_THRU_DEFAULT_ENABLED 0
+#endif
+
+#define MIDI_THRU_MAX_LATENCY_US 5000  // Note-on and controller data older than this is dropped
+
+typedef struct {
+    uint32_t forwarded;
+    uint32_t dropped;
+    uint32_t max_latency_us;  // Worst receive-to-write delay
+    uint32_t max_write_us;    // Worst time spent writing one message
+} midi_thru_stats_t;
+
+void midi_thru_init(void);
+
+void midi_thru_set_enabled(bool enabled);
+
+bool midi_thru_is_enabled(void);
+
+void midi_thru_receive(uint8_t status, uint8_t data1, uint8_t data2);
+
+bool midi_thru_pending(void);
+
+void midi_thru_task(void);
+
+const midi_thru_stats_t *midi_thru_stats(void);
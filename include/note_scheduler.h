@@ -8,6 +8,45 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "latency.h"
+#include "looper.h"
+
+#define NOTE_SCHEDULER_NO_TRACK 0xFF  // Track of notes outside the pattern, e.g. clicks
+
+/*
+ * Scheduled note slots, for the most notes the looper can have waiting at
+ * once. A note fires within two step periods of the tick that scheduled
+ * it: the groove delays a step by less than one period, a late hit by
+ * less than half of one more, and an early hit is scheduled a tick ahead
+ * by less than half a period. So the notes of two ticks wait together. On
+ * a track that is the hits of three steps (each step's hit is scheduled
+ * once, on time or early) and two ghost notes or fills; outside the pattern
+ * it is two clicks and a button cue. Every note takes one slot per output
+ * when USB and BLE are compensated differently. Compensation that holds a
+ * note past the second tick can still run out of slots, which is counted
+ * as refused.
+ */
+#define NOTE_SCHEDULER_TRACK_NOTES 5  // Notes of one track waiting at once
+#define NOTE_SCHEDULER_OTHER_NOTES 3  // Clicks and button cues waiting at once
+#define NOTE_SCHEDULER_MAX_NOTES                                                    \
+    ((LOOPER_MAX_TRACKS * NOTE_SCHEDULER_TRACK_NOTES + NOTE_SCHEDULER_OTHER_NOTES) * \
+     LATENCY_OUTPUT_COUNT)
+
+// Lateness of dispatched notes against their scheduled time, and notes lost on the way.
+typedef struct {
+    uint32_t notes;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t refused;  // Not scheduled: every slot was taken
+    uint32_t lost;     // Fired while the pending list was full
+    uint32_t peak;     // Most slots taken at once
+} note_scheduler_latency_t;
+
 void note_scheduler_init(void);
 bool note_scheduler_schedule_note(uint64_t time_us, uint8_t channel, uint8_t note, uint8_t velocity);
+bool note_scheduler_schedule_track_note(uint64_t time_us, uint8_t track, uint8_t channel,
+                                        uint8_t note, uint8_t velocity);
 void note_scheduler_dispatch_pending(void);
+bool note_scheduler_pending(void);
+const note_scheduler_latency_t *note_scheduler_latency_get(void);
+void note_scheduler_latency_reset(void);
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "looper.h"
+
+#ifndef PATTERN_BANK_COUNT
+#define PATTERN_BANK_COUNT 16
+#endif
+
+#define PATTERN_BANK_SONG_LENGTH 16  // Entries in the song-mode sequence table
+
+// One song-mode entry: play `bank` for `loops` passes of the loop.
+typedef struct {
+    uint8_t bank;
+    uint8_t loops;  // 0 terminates the table
+} pattern_bank_song_entry_t;
+
+/*
+ * Every bank's patterns as per-step track masks, plus the song table.
+ * This is also the flash image, so it is kept small.
+ */
+typedef struct {
+    uint8_t current;     // Bank playing in the live pattern
+    uint8_t num_tracks;  // Tracks in use
+    uint8_t reserved[2];
+    track_mask_t hits[PATTERN_BANK_COUNT][LOOPER_TOTAL_STEPS];
+    pattern_bank_song_entry_t song[PATTERN_BANK_SONG_LENGTH];
+} pattern_bank_set_t;
+
+pattern_bank_set_t *pattern_bank_set(void);
+
+void pattern_bank_pack(uint8_t bank, const looper_pattern_t *pattern);
+
+void pattern_bank_unpack(uint8_t bank, looper_pattern_t *pattern);
+
+uint8_t pattern_bank_current(void);
+
+void pattern_bank_replace(uint8_t bank, const track_mask_t *hits);
+
+int pattern_bank_pending(void);
+
+void pattern_bank_select(uint8_t bank);
+
+bool pattern_bank_handle_program_change(uint8_t channel, uint8_t program);
+
+void pattern_bank_song_set(const pattern_bank_song_entry_t *entries, uint8_t count);
+
+void pattern_bank_song_start(void);
+
+void pattern_bank_song_stop(void);
+
+bool pattern_bank_song_playing(void);
+
+uint8_t pattern_bank_song_position(void);
+
+void pattern_bank_task(void);
+
+bool pattern_bank_swap_due(void);
+
+void pattern_bank_apply_pending(void);
+
+looper_pattern_t *pattern_bank_claim_standby(void);
+
+void pattern_bank_swap_claimed(void);
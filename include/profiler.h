@@ -0,0 +1,79 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "pico/time.h"
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0  // Build with -DPROFILER_ENABLED=1 to time the step path
+#endif
+
+#ifndef PROFILER_WORST_COUNT
+#define PROFILER_WORST_COUNT 8  // Worst ticks kept with their phase breakdown
+#endif
+
+// Parts of the step tick, in the order they run.
+typedef enum {
+    PROFILER_PHASE_PENDING = 0,  // Bank switch and SysEx load at the loop start
+    PROFILER_PHASE_DISPLAY,      // Status lines on the console
+    PROFILER_PHASE_PERFORM,      // State machine and note scheduling
+    PROFILER_PHASE_GHOST,        // Controller, ghost note and groove maintenance
+    PROFILER_PHASE_TIMER,        // Rearming the step timer
+    PROFILER_PHASE_COUNT,
+} profiler_phase_t;
+
+// Main loop tasks timed as a whole.
+typedef enum {
+    PROFILER_SECTION_DISPATCH = 0,  // note_scheduler_dispatch_pending()
+    PROFILER_SECTION_USB_MIDI,      // usb_midi_task()
+    PROFILER_SECTION_COUNT,
+} profiler_section_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+} profiler_stats_t;
+
+// One tick: when it ran, how late it started, and where its time went.
+typedef struct {
+    uint32_t start_us;
+    uint32_t late_us;  // Start past the step deadline
+    uint32_t total_us;
+    uint8_t step;
+    uint16_t phase_us[PROFILER_PHASE_COUNT];
+} profiler_tick_t;
+
+void profiler_tick_begin(uint64_t deadline_us);
+
+void profiler_tick_phase(profiler_phase_t phase);
+
+void profiler_tick_end(uint8_t step);
+
+void profiler_section_record(profiler_section_t section, uint32_t elapsed_us);
+
+void profiler_reset(void);
+
+void profiler_dump(void);
+
+#if PROFILER_ENABLED
+#define PROFILER_TICK_BEGIN(deadline_us) profiler_tick_begin(deadline_us)
+#define PROFILER_TICK_PHASE(phase) profiler_tick_phase(phase)
+#define PROFILER_TICK_END(step) profiler_tick_end(step)
+#define PROFILER_MEASURE(section, call)                                     \
+    do {                                                                    \
+        uint32_t profiler_start_us = time_us_32();                          \
+        call;                                                               \
+        profiler_section_record(section, time_us_32() - profiler_start_us); \
+    } while (0)
+#else
+#define PROFILER_TICK_BEGIN(deadline_us) ((void)(deadline_us))
+#define PROFILER_TICK_PHASE(phase) ((void)0)
+#define PROFILER_TICK_END(step) ((void)(step))
+#define PROFILER_MEASURE(section, call) call
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef RUN_LOOP_MAX_TASKS
+#define RUN_LOOP_MAX_TASKS 16
+#endif
+
+/*
+ * One main loop task. It runs at least every `interval_us`, and earlier
+ * when `ready` reports work waiting, but never twice within
+ * `min_interval_us`.
+ */
+typedef struct {
+    const char *name;
+    void (*run)(void);
+    bool (*ready)(void);       // Work waiting that should not wait for the interval; may be NULL
+    uint32_t min_interval_us;  // Rate bound
+    uint32_t interval_us;      // Longest time between two runs
+} run_loop_task_t;
+
+typedef struct {
+    uint64_t since_us;  // Start of the statistics
+    uint32_t iterations;
+    uint32_t sleeps;
+    uint64_t sleep_us;
+    uint32_t runs[RUN_LOOP_MAX_TASKS];
+} run_loop_stats_t;
+
+void run_loop_init(const run_loop_task_t *tasks, size_t count);
+
+void run_loop_poll(void);
+
+void run_loop_run(void);
+
+void run_loop_set_busy(bool busy);
+
+bool run_loop_busy(void);
+
+const run_loop_stats_t *run_loop_stats_get(void);
+
+void run_loop_stats_reset(void);
+
+void run_loop_dump(void);
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SMF_EXPORT_MAX_BARS
+#define SMF_EXPORT_MAX_BARS 32  // Longest export; costs 4 bytes of RAM per step
+#endif
+
+#define SMF_EXPORT_PPQN 96  // Ticks per quarter note in the exported file
+
+bool smf_export_start(uint8_t bars);
+
+bool smf_export_start_capture(uint8_t bars);
+
+bool smf_export_busy(void);
+
+void smf_export_task(void);
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "looper.h"
+
+#define SYSEX_MANUFACTURER_ID 0x7D  // Non-commercial / educational use
+#define SYSEX_DEVICE_ID 0x47        // 'G'
+#define SYSEX_CHUNK_BYTES 21        // Raw bytes per DATA chunk (3 groups of 7)
+#define SYSEX_CHUNK_ENCODED_BYTES (SYSEX_CHUNK_BYTES / 7 * 8)
+#define SYSEX_MAX_MESSAGE_BYTES (9 + SYSEX_CHUNK_ENCODED_BYTES)
+
+// Transport a SysEx message arrived on; replies go back on the same port.
+typedef enum {
+    SYSEX_PORT_USB = 0,
+    SYSEX_PORT_BLE,
+    SYSEX_PORT_COUNT,
+} sysex_port_t;
+
+/*
+ * Message layout:
+ *   F0 7D 47 <cmd> <seq_lsb> <seq_msb> <len> <7-bit packed data...> <checksum> F7
+ * `len` is the number of raw bytes before packing, `checksum` is the XOR of all
+ * bytes from <cmd> up to the last data byte.
+ */
+typedef enum {
+    SYSEX_CMD_DUMP_REQUEST = 0x01,  // host -> device: start a dump
+    SYSEX_CMD_LOAD_BEGIN = 0x02,    // host -> device: data = total image length (u16)
+    SYSEX_CMD_DATA = 0x03,          // either way: one chunk of the image
+    SYSEX_CMD_END = 0x04,           // either way: image complete
+    SYSEX_CMD_ACK = 0x05,           // either way: chunk <seq> accepted
+    SYSEX_CMD_NAK = 0x06,           // either way: chunk <seq> rejected, resend
+} sysex_command_t;
+
+#define SYSEX_IMAGE_MAGIC "GHST"
+#define SYSEX_IMAGE_VERSION 2
+#define SYSEX_MAX_TRACKS 16  // Wire format limit, independent of LOOPER_MAX_TRACKS
+
+/*
+ * Wire image of the session, as streamed by DATA chunks. Little-endian,
+ * matching the RP2040/RP2350 layout. A load is refused unless every field
+ * is within the range of the controller that sets it.
+ */
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t num_tracks;  // Tracks in use; the pattern always carries SYSEX_MAX_TRACKS
+    uint8_t total_steps;
+    uint8_t current_track;
+    uint16_t bpm;
+    uint8_t pattern[SYSEX_MAX_TRACKS][LOOPER_TOTAL_STEPS / 8];  // one bit per step
+    float ghost_intensity;
+    float boundary_before_probability;
+    float boundary_after_probability;
+    uint8_t euclid_k_max;
+    uint8_t euclid_k_sufficient;
+    float euclid_k_intensity;
+    float euclid_probability;
+    uint8_t fill_interval_bar;
+    float fill_start_mean;
+    float fill_start_sd;
+    float fill_probability;
+} sysex_image_t;
+
+size_t sysex_pack7(const uint8_t *src, size_t len, uint8_t *dst);
+size_t sysex_unpack7(const uint8_t *src, size_t len, uint8_t *dst);
+
+void sysex_receive(sysex_port_t port, const uint8_t *data, size_t len);
+
+void sysex_task(void);
+
+bool sysex_load_due(void);
+
+void sysex_apply_pending_load(void);
@@ -12,11 +12,13 @@
 typedef enum {
     TAP_NONE = 0,
     TAP_PRELIM,    /* 2-tap provisional BPM  */
-    TAP_FINAL,     /* 3/4-tap averaged BPM   */
+    TAP_FINAL,     /* 3+ tap fitted BPM      */
     TAP_EXIT       /* long-press → leave mode */
 } tap_result_t;
 
 bool taptempo_active(void);
-tap_result_t taptempo_handle_event(button_event_t ev);
+tap_result_t taptempo_handle_event(button_event_t ev, uint64_t time_us);
 uint16_t taptempo_get_bpm(void);
+uint32_t taptempo_get_bpm_x100(void);
+uint8_t taptempo_get_confidence(void);
 bool taptempo_is_ready(void);
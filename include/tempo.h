@@ -0,0 +1,42 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TEMPO_MAX_RAMP_BARS 16
+
+// When a requested tempo change starts.
+typedef enum {
+    TEMPO_APPLY_IMMEDIATE = 0,
+    TEMPO_APPLY_NEXT_BEAT,
+    TEMPO_APPLY_NEXT_BAR,
+} tempo_apply_t;
+
+// Shape of a ramp: constant BPM change per step, or constant ratio per step.
+typedef enum {
+    TEMPO_CURVE_LINEAR = 0,
+    TEMPO_CURVE_EXPONENTIAL,
+} tempo_curve_t;
+
+typedef struct {
+    tempo_apply_t apply;
+    tempo_curve_t curve;
+    uint8_t ramp_bars;  // 0 = jump to the new tempo
+} tempo_settings_t;
+
+const tempo_settings_t *tempo_settings(void);
+
+void tempo_configure(tempo_apply_t apply, tempo_curve_t curve, uint8_t ramp_bars);
+
+bool tempo_is_scheduled(void);
+
+void tempo_request_bpm_x100(uint32_t bpm_x100);
+
+void tempo_cancel(void);
+
+uint32_t tempo_step_duration_us(uint8_t step);
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/time.h"
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0  // Build with -DTRACE_ENABLED=1 to record the timing pipeline
+#endif
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 2048  // power of two; 8 bytes each
+#endif
+
+// What an event marks. Keep in step with EVENT_NAMES in tools/trace_chrome.py.
+typedef enum {
+    TRACE_TICK = 0,       // Step timer; arg = step
+    TRACE_GHOST,          // Ghost note generation; arg = track
+    TRACE_NOTE_SCHEDULE,  // Note handed to the scheduler; arg = note
+    TRACE_WORKER,         // Scheduled note worker fired; arg = note
+    TRACE_DISPATCH,       // Pending notes sent from the main loop
+    TRACE_USB_WRITE,      // Channel message written to USB; arg = status << 8 | data1
+    TRACE_BLE_NOTIFY,     // BLE-MIDI notification sent; arg = messages carried
+    TRACE_BUTTON,         // Button event at its edge time; arg = button_event_t
+    TRACE_MIDI_CLOCK,     // MIDI clock tick received; arg = 0xF8
+    TRACE_EVENT_COUNT,
+} trace_event_id_t;
+
+typedef enum {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+} trace_phase_t;
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t id;
+    uint8_t phase;
+    uint16_t arg;
+} trace_event_t;
+
+void trace_record(uint32_t time_us, trace_event_id_t id, trace_phase_t phase, uint16_t arg);
+
+void trace_start(void);
+
+void trace_stop(void);
+
+void trace_dump(void);
+
+bool trace_dumping(void);
+
+void trace_task(void);
+
+#if TRACE_ENABLED
+#define TRACE_BEGIN(id, arg) trace_record(time_us_32(), id, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(id, arg) trace_record(time_us_32(), id, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(id, arg) trace_record(time_us_32(), id, TRACE_PHASE_INSTANT, arg)
+#define TRACE_INSTANT_AT(time_us, id, arg) \
+    trace_record((uint32_t)(time_us), id, TRACE_PHASE_INSTANT, arg)
+#else
+#define TRACE_BEGIN(id, arg) ((void)0)
+#define TRACE_END(id, arg) ((void)0)
+#define TRACE_INSTANT(id, arg) ((void)0)
+#define TRACE_INSTANT_AT(time_us, id, arg) ((void)0)
+#endif
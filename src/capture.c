@@ -0,0 +1,126 @@
+/*
+ * capture.c
+ *
+ * Retroactive capture: a ring of every track note the looper has played,
+ * ghost notes and fills included, so that a variation that happened once
+ * can still be kept after the fact. note_scheduler_dispatch_pending() adds
+ * each note as it goes out, placed on the step grid of the looper by its
+ * scheduled time: the loop step nearest to it, the distance from that
+ * step, the track and the velocity, in four bytes. Adding a note is a few
+ * loads and two divisions, into a static ring.
+ *
+ * The ring can be frozen into a pattern bank a loop at a time, or exported
+ * as a MIDI file through smf_export_start_capture(). The oldest notes are
+ * overwritten first, and notes from before a long pause are dropped, since
+ * their positions could no longer be told apart from new ones.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "capture.h"
+
+#include <stdio.h>
+
+#include "drivers/async_timer.h"
+#include "hot_path.h"
+#include "pattern_bank.h"
+
+static capture_note_t notes[CAPTURE_NOTES];
+static uint16_t next = 0;   // Slot of the next note
+static uint16_t count = 0;  // Notes held, up to CAPTURE_NOTES
+static uint32_t last_position = 0;  // Unwrapped position of the newest note
+static bool held = false;
+
+// Unwrapped position of the step to be played next.
+static uint32_t HOT_PATH_FUNC(capture_position_next)(const looper_status_t *status) {
+    return (uint32_t)status->loop_count * LOOPER_TOTAL_STEPS + status->current_step;
+}
+
+// Notes older than this many steps are dropped rather than aliased.
+static bool HOT_PATH_FUNC(capture_stale)(uint32_t position) {
+    return count > 0 && (int32_t)(position - last_position) >= CAPTURE_POSITIONS / 2;
+}
+
+/*
+ * Adds a note played at `time_us`. Called with the step timer held off,
+ * by note_scheduler_dispatch_pending(), so the step grid read here is
+ * consistent.
+ */
+void HOT_PATH_FUNC(capture_note)(uint64_t time_us, uint8_t track, uint8_t velocity) {
+    if (held)
+        return;
+    const looper_status_t *status = looper_status_get();
+    int32_t period = status->step_period_us;
+    int32_t delta = (int32_t)(time_us - status->timing.last_step_time_us);
+    int32_t from_half = delta + period / 2;
+    int32_t steps = (from_half >= 0) ? from_half / period : (from_half - period + 1) / period;
+    int32_t offset = (delta - steps * period) * LOOPER_MICROTIMING_ONE / period;
+    uint32_t position = capture_position_next(status) - 1 + steps;
+
+    if (capture_stale(position))
+        count = 0;
+    notes[next] = (capture_note_t){.position = position,
+                                   .track = track,
+                                   .velocity = velocity,
+                                   .offset = (uint8_t)(int8_t)offset};
+    next = (next + 1) % CAPTURE_NOTES;
+    if (count < CAPTURE_NOTES)
+        count++;
+    last_position = position;
+}
+
+// Stops adding notes, e.g. while the ring is being exported.
+void capture_hold(bool hold) { held = hold; }
+
+// Notes held, oldest first from index 0.
+uint16_t capture_count(void) {
+    if (capture_stale(capture_position()))
+        count = 0;
+    return count;
+}
+
+capture_note_t capture_get(uint16_t index) {
+    return notes[(next + CAPTURE_NOTES - count + index) % CAPTURE_NOTES];
+}
+
+// Unwrapped position of the step to be played next.
+uint32_t capture_position(void) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    uint32_t position = capture_position_next(looper_status_get());
+    async_context_release_lock(async_timer_async_context());
+    return position;
+}
+
+/*
+ * Writes the hits played `loops_back` loops ago, 1 being the last complete
+ * loop, into pattern bank `bank`. Returns false if nothing was played then.
+ */
+bool capture_freeze(uint8_t bank, uint8_t loops_back) {
+    uint32_t now = capture_position();
+    uint32_t loop_start = now - now % LOOPER_TOTAL_STEPS - loops_back * LOOPER_TOTAL_STEPS;
+    track_mask_t hits[LOOPER_TOTAL_STEPS] = {0};
+    bool played = false;
+
+    for (uint16_t i = 0; i < capture_count(); i++) {
+        capture_note_t note = capture_get(i);
+        int step = capture_steps_from(loop_start, note);
+        if (step >= 0 && step < LOOPER_TOTAL_STEPS) {
+            hits[step] |= TRACK_BIT(note.track);
+            played = true;
+        }
+    }
+    if (played)
+        pattern_bank_replace(bank, hits);
+    return played;
+}
+
+void capture_status(void) {
+    uint16_t held_notes = capture_count();
+    int steps = (held_notes > 0) ? capture_steps_from(capture_get(0).position,
+                                                      capture_get(held_notes - 1)) + 1
+                                 : 0;
+    printf("[CAPTURE] notes=%u/%u bars=%d\n", held_notes, CAPTURE_NOTES,
+           (steps + LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT - 1) /
+               (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT));
+}
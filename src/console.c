@@ -0,0 +1,284 @@
+/*
+ * console.c
+ *
+ * Line-oriented commands on the USB CDC console. Input is read without
+ * blocking from the main loop, a line at a time; each line is split into a
+ * command word and its arguments and looked up in a small command table.
+ *
+ *   bank <1-16>              switch pattern bank at the next loop start
+ *   song <bank>x<loops> ...  set the song table and play it, e.g. song 1x4 2x2
+ *   song on | off            restart or stop song mode
+ *   tracks <1-16>            set how many tracks are in use
+ *   prof [reset]             print or clear the step tick profile
+ *   catchup [policy | reset] show step clock overruns, set the policy or clear them
+ *   trace on | off | dump    restart, stop or stream the event trace
+ *   record on | off | dump   restart, stop or print the input log for replay
+ *   smf [bars]               stream the loop as a Standard MIDI File, ghosts included
+ *   capture                  show what the capture ring holds
+ *   capture freeze <1-16> [n] keep the loop played n loops back (default 1) in a bank
+ *   capture smf [bars]       stream the last bars as played as a Standard MIDI File
+ *   loop [busy | sleep | reset] show main loop statistics, set the loop mode or clear them
+ *   help                     list the commands
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "console.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "drivers/storage.h"
+#include "input_log.h"
+#include "pattern_bank.h"
+#include "profiler.h"
+#include "run_loop.h"
+#include "smf_export.h"
+#include "trace.h"
+#include "pico/stdlib.h"
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    void (*run)(char *args);
+} console_command_t;
+
+static char line[CONSOLE_LINE_LENGTH + 1];
+static size_t line_length = 0;
+static bool line_overflow = false;
+
+static void console_bank(char *args);
+static void console_song(char *args);
+static void console_tracks(char *args);
+static void console_prof(char *args);
+static void console_catchup(char *args);
+static void console_trace(char *args);
+static void console_record(char *args);
+static void console_smf(char *args);
+static void console_capture(char *args);
+static void console_loop(char *args);
+static void console_help(char *args);
+
+static const console_command_t commands[] = {
+    {"bank", "bank <1-16>", console_bank},
+    {"song", "song <bank>x<loops> ... | on | off", console_song},
+    {"tracks", "tracks <count>", console_tracks},
+    {"prof", "prof [reset]", console_prof},
+    {"catchup", "catchup [skip | burst | stretch | reset]", console_catchup},
+    {"trace", "trace on | off | dump", console_trace},
+    {"record", "record on | off | dump", console_record},
+    {"smf", "smf [bars]", console_smf},
+    {"capture", "capture [freeze <bank> [loops back] | smf [bars]]", console_capture},
+    {"loop", "loop [busy | sleep | reset]", console_loop},
+    {"help", "help", console_help},
+};
+
+static void console_bank(char *args) {
+    long bank = strtol(args, NULL, 10);
+    if (bank < 1 || bank > PATTERN_BANK_COUNT) {
+        printf("[CONSOLE] bank must be 1-%u\n", PATTERN_BANK_COUNT);
+        return;
+    }
+    pattern_bank_select(bank - 1);
+}
+
+static void console_song(char *args) {
+    if (strcmp(args, "on") == 0) {
+        pattern_bank_song_start();
+        return;
+    } else if (strcmp(args, "off") == 0) {
+        pattern_bank_song_stop();
+        return;
+    }
+
+    pattern_bank_song_entry_t entries[PATTERN_BANK_SONG_LENGTH];
+    uint8_t count = 0;
+    for (char *entry = strtok(args, " "); entry != NULL; entry = strtok(NULL, " ")) {
+        char *end;
+        long bank = strtol(entry, &end, 10);
+        long loops = (*end == 'x') ? strtol(end + 1, &end, 10) : 0;
+        if (*end != '\0' || bank < 1 || bank > PATTERN_BANK_COUNT || loops < 1 || loops > 255 ||
+            count >= PATTERN_BANK_SONG_LENGTH) {
+            printf("[CONSOLE] bad song entry '%s'\n", entry);
+            return;
+        }
+        entries[count++] = (pattern_bank_song_entry_t){(uint8_t)(bank - 1), (uint8_t)loops};
+    }
+    if (count == 0) {
+        printf("[CONSOLE] usage: song <bank>x<loops> ...\n");
+        return;
+    }
+    pattern_bank_song_set(entries, count);
+    storage_request_store_tracks();
+    pattern_bank_song_start();
+}
+
+static void console_tracks(char *args) {
+    long count = strtol(args, NULL, 10);
+    if (count < 1 || count > LOOPER_MAX_TRACKS) {
+        printf("[CONSOLE] tracks must be 1-%u\n", LOOPER_MAX_TRACKS);
+        return;
+    }
+    looper_set_num_tracks(count);
+    storage_request_store_tracks();
+}
+
+static void console_prof(char *args) {
+    if (strcmp(args, "reset") == 0)
+        profiler_reset();
+    else
+        profiler_dump();
+}
+
+static const char *const catch_up_names[LOOPER_CATCH_UP_COUNT] = {"skip", "burst", "stretch"};
+
+static void console_catchup(char *args) {
+    if (strcmp(args, "reset") == 0) {
+        looper_overrun_reset();
+        return;
+    }
+    for (int policy = 0; *args != '\0' && policy < LOOPER_CATCH_UP_COUNT; policy++) {
+        if (strcmp(args, catch_up_names[policy]) == 0) {
+            looper_set_catch_up(policy);
+            return;
+        }
+    }
+    if (*args != '\0') {
+        printf("[CONSOLE] usage: catchup [skip | burst | stretch | reset]\n");
+        return;
+    }
+    const looper_overrun_t *overrun = looper_overrun_get();
+    printf("[CLOCK] catchup=%s overruns=%lu skipped=%lu max_late_us=%lu stretched_us=%llu\n",
+           catch_up_names[looper_catch_up_get()], (unsigned long)overrun->overruns,
+           (unsigned long)overrun->skipped, (unsigned long)overrun->max_late_us,
+           (unsigned long long)overrun->stretched_us);
+}
+
+static void console_trace(char *args) {
+    if (strcmp(args, "on") == 0)
+        trace_start();
+    else if (strcmp(args, "off") == 0)
+        trace_stop();
+    else if (strcmp(args, "dump") == 0)
+        trace_dump();
+    else
+        printf("[CONSOLE] usage: trace on | off | dump\n");
+}
+
+static void console_record(char *args) {
+    if (strcmp(args, "on") == 0)
+        input_log_start();
+    else if (strcmp(args, "off") == 0)
+        input_log_stop();
+    else if (strcmp(args, "dump") == 0)
+        input_log_dump();
+    else
+        printf("[CONSOLE] usage: record on | off | dump\n");
+}
+
+static void console_smf(char *args) {
+    long bars = (*args == '\0') ? 8 : strtol(args, NULL, 10);
+    if (bars < 1 || bars > SMF_EXPORT_MAX_BARS) {
+        printf("[CONSOLE] bars must be 1-%u\n", SMF_EXPORT_MAX_BARS);
+        return;
+    }
+    if (!smf_export_start(bars))
+        printf("[CONSOLE] smf export already running\n");
+}
+
+static void console_capture(char *args) {
+    char *command = strtok(args, " ");
+    if (command == NULL) {
+        capture_status();
+    } else if (strcmp(command, "freeze") == 0) {
+        char *bank_arg = strtok(NULL, " ");
+        char *loops_arg = strtok(NULL, " ");
+        long bank = (bank_arg != NULL) ? strtol(bank_arg, NULL, 10) : 0;
+        long loops_back = (loops_arg != NULL) ? strtol(loops_arg, NULL, 10) : 1;
+        if (bank < 1 || bank > PATTERN_BANK_COUNT || loops_back < 1 || loops_back > 255) {
+            printf("[CONSOLE] usage: capture freeze <1-%u> [loops back]\n", PATTERN_BANK_COUNT);
+            return;
+        }
+        if (!capture_freeze(bank - 1, loops_back)) {
+            printf("[CONSOLE] nothing captured in that loop\n");
+            return;
+        }
+        storage_request_store_tracks();
+    } else if (strcmp(command, "smf") == 0) {
+        char *bars_arg = strtok(NULL, " ");
+        long bars = (bars_arg != NULL) ? strtol(bars_arg, NULL, 10) : 8;
+        if (bars < 1 || bars > SMF_EXPORT_MAX_BARS) {
+            printf("[CONSOLE] bars must be 1-%u\n", SMF_EXPORT_MAX_BARS);
+            return;
+        }
+        if (!smf_export_start_capture(bars))
+            printf("[CONSOLE] smf export already running\n");
+    } else {
+        printf("[CONSOLE] usage: capture [freeze <bank> [loops back] | smf [bars]]\n");
+    }
+}
+
+static void console_loop(char *args) {
+    if (strcmp(args, "busy") == 0) {
+        run_loop_set_busy(true);
+        run_loop_stats_reset();
+    } else if (strcmp(args, "sleep") == 0) {
+        run_loop_set_busy(false);
+        run_loop_stats_reset();
+    } else if (strcmp(args, "reset") == 0) {
+        run_loop_stats_reset();
+    } else if (*args == '\0') {
+        run_loop_dump();
+    } else {
+        printf("[CONSOLE] usage: loop [busy | sleep | reset]\n");
+    }
+}
+
+static void console_help(char *args) {
+    (void)args;
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+        printf("[CONSOLE] %s\n", commands[i].usage);
+}
+
+static void console_execute(char *command) {
+    while (*command == ' ') command++;
+    if (*command == '\0')
+        return;
+
+    char *args = strchr(command, ' ');
+    if (args != NULL) {
+        *args++ = '\0';
+        while (*args == ' ') args++;
+    } else {
+        args = command + strlen(command);
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strcmp(command, commands[i].name) == 0) {
+            commands[i].run(args);
+            return;
+        }
+    }
+    printf("[CONSOLE] unknown command '%s'\n", command);
+}
+
+// Called from the main loop: consumes whatever input is waiting, without blocking.
+void console_task(void) {
+    int c;
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        if (c == '\r' || c == '\n') {
+            line[line_length] = '\0';
+            if (!line_overflow)
+                console_execute(line);
+            line_length = 0;
+            line_overflow = false;
+        } else if (line_length < CONSOLE_LINE_LENGTH) {
+            line[line_length++] = (char)c;
+        } else {
+            line_overflow = true;
+        }
+    }
+}
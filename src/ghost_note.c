@@ -9,33 +9,111 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "drivers/async_timer.h"
+#include "hot_path.h"
 #include "looper.h"
+#include "trace.h"
 
 #define DENSITY_WIN_HALF 8
-#define CHANCE(p) ((rand() / (RAND_MAX + 1.0)) < (p))
-
-static float note_density_track_window[4][LOOPER_TOTAL_STEPS];
+#define SWING_CURVE_SHIFT 10  // 16-bit LFO phase -> GHOST_NOTE_SWING_CURVE_SIZE entries
 
 static bool pending_fill_request = false;
 
-static ghost_parameters_t parameters = {
-    .ghost_intensity = 0.843,
-    .swing_ratio = 0.5,
-    .boundary = {.before_probability = 0.10, .after_probability = 0.50},
-    .euclidean = {.k_max = 16, .k_sufficient = 6, .k_intensity = 0.90, .probability = 0.80},
-    .fill = {.interval_bar = 4, .start_mean = 15.0, .start_sd = 5.0, .probability = 0.40},
-};
+#define GHOST_PARAMETERS_DEFAULT                                                                 \
+    {                                                                                            \
+        .ghost_intensity = 0.843, .swing_ratio = 0.5, .swing_ratio_base = 0.5,                   \
+        .boundary = {.before_probability = 0.10, .after_probability = 0.50},                     \
+        .euclidean = {.k_max = 16, .k_sufficient = 6, .k_intensity = 0.90, .probability = 0.80}, \
+        .fill = {.interval_bar = 4, .start_mean = 15.0, .start_sd = 5.0, .probability = 0.40},   \
+    }
+
+/*
+ * Parameters are double-buffered. Writers edit `staged` under the async
+ * context lock and bump `staged_version`; the step timer copies it into
+ * `parameters` at the next step boundary, so ghost generation and playback
+ * always see one consistent set.
+ */
+static ghost_parameters_t parameters = GHOST_PARAMETERS_DEFAULT;
+static ghost_parameters_t staged = GHOST_PARAMETERS_DEFAULT;
+static volatile uint32_t staged_version = 1;
+static uint32_t active_version = 0;
+
+// Tables derived from `parameters`, rebuilt only when their inputs change.
+static uint8_t ghost_threshold[GHOST_NOTE_THRESHOLDS];  // fires when rand_sample < [probability]
+static float swing_curve[GHOST_NOTE_SWING_CURVE_SIZE];
+static float fill_start_sigma;
+static bool derived_ready = false;
 
-ghost_parameters_t *ghost_note_parameters(void) { return &parameters; }
+/*
+ * What a generation draws on: the live parameters, tables and rand() for
+ * the patterns that play, or a ghost_render_t's own copies for a render.
+ */
+typedef struct {
+    const ghost_parameters_t *params;
+    const uint8_t *threshold;
+    float fill_start_sigma;
+    const track_t *tracks;
+    size_t num_tracks;
+    track_mask_t active;
+    uint32_t *seed;  // xorshift32 state; NULL draws from rand()
+} ghost_engine_t;
+
+// The engine of the playing patterns, generating from `params`.
+static ghost_engine_t HOT_PATH_FUNC(live_engine)(const ghost_parameters_t *params) {
+    ghost_engine_t e = {.params = params,
+                        .threshold = ghost_threshold,
+                        .fill_start_sigma = fill_start_sigma,
+                        .active = looper_active_tracks()};
+    e.tracks = looper_tracks_get(&e.num_tracks);
+    return e;
+}
 
-static uint8_t velocity_table[] = {
-    0x20,  // track 1 - Kick
-    0x25,  // track 2 - Snare
-    0x30,  // track 3 - Hi-hat closed
-    0x25   // track 4 - Hi-hat open
-};
+static ghost_engine_t render_engine(ghost_render_t *render) {
+    return (ghost_engine_t){.params = &render->params,
+                            .threshold = render->threshold,
+                            .fill_start_sigma = render->fill_start_sigma,
+                            .tracks = render->tracks,
+                            .num_tracks = render->num_tracks,
+                            .active = render->active,
+                            .seed = &render->seed};
+}
 
-uint8_t *ghost_note_velocity_table(void) { return velocity_table; }
+// A number in [0, RAND_MAX] from the engine's xorshift32 state, or from rand().
+static int ghost_rand(const ghost_engine_t *e) {
+    if (e->seed == NULL)
+        return rand();
+    uint32_t x = *e->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *e->seed = x;
+    return (int)(x % ((uint32_t)RAND_MAX + 1));
+}
+
+static bool chance(const ghost_engine_t *e, float p) {
+    return ghost_rand(e) / (RAND_MAX + 1.0) < p;
+}
+
+static bool engine_is_active(const ghost_engine_t *e, const ghost_note_t *ghost) {
+    return ghost->rand_sample < e->threshold[ghost->probability];
+}
+
+const ghost_parameters_t *HOT_PATH_FUNC(ghost_note_parameters)(void) { return &parameters; }
+
+// Begin editing the staged parameter block. Must be paired with ghost_note_parameters_commit().
+ghost_parameters_t *ghost_note_parameters_edit(void) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    return &staged;
+}
+
+void ghost_note_parameters_commit(void) {
+    staged_version++;
+    async_context_release_lock(async_timer_async_context());
+}
+
+bool HOT_PATH_FUNC(ghost_note_is_active)(const ghost_note_t *ghost) {
+    return ghost->rand_sample < ghost_threshold[ghost->probability];
+}
 
 #define KICK_VEL_BASE 100
 #define KICK_VEL_DEPTH 25
@@ -43,12 +121,13 @@ uint8_t *ghost_note_velocity_table(void) { return velocity_table; }
 #define HH_VEL_BASE 107
 #define HH_VEL_DEPTH 20
 
-uint8_t ghost_note_modulate_base_velocity(uint8_t track_num, uint8_t default_velocity, float lfo) {
-    if (track_num == 0) {                                    // Kick
+uint8_t HOT_PATH_FUNC(ghost_note_modulate_base_velocity)(const track_t *track,
+                                                         uint8_t default_velocity, float lfo) {
+    if (track->velocity_lfo == TRACK_LFO_KICK) {
         float phase = (lfo * 1.25 / 65536.0f) * 2.0f * M_PI; /* 0-2π */
         float kick_s = sinf(phase);
         return KICK_VEL_BASE + (int)(kick_s * KICK_VEL_DEPTH);
-    } else if (track_num == 2) {                           // Closed Hi-hat
+    } else if (track->velocity_lfo == TRACK_LFO_HIHAT) {
         uint16_t hh_phase = (uint32_t)lfo * HH_FREQ_RATIO; /* wrap */
         float hh_s = sinf((hh_phase / 65536.0f) * 2.0f * M_PI);
         return HH_VEL_BASE + (int)(hh_s * HH_VEL_DEPTH);
@@ -56,51 +135,57 @@ uint8_t ghost_note_modulate_base_velocity(uint8_t track_num, uint8_t default_vel
     return default_velocity;
 }
 
-float ghost_note_modulate_swing_ratio(float lfo) {
-    float gi = parameters.ghost_intensity;
-    float swing;
-    if (gi < 0.5f) {
-        swing = 0.5f;
-    } else {
-        float t = (gi - 0.5f) * 2.0f;
-        float base = 0.5f + powf(t, 7.0f) * 0.15f;
+// Swing from ghost intensity and LFO, never below the user swing `swing_min`.
+static float swing_ratio_at(float gi, float swing_min, uint16_t lfo) {
+    if (gi < 0.5f)
+        return swing_min;
 
-        float phase = ((uint32_t)lfo / 65536.0f) * 2.0f * M_PI;
-        float lfo_amt = sinf(phase + M_PI_2) * 0.01f;
-        swing = base + lfo_amt;
+    float t = (gi - 0.5f) * 2.0f;
+    float base = 0.5f + powf(t, 7.0f) * 0.15f;
 
-        if (swing > 0.65f)
-            swing = 0.65f;
-        if (swing < 0.5f)
-            swing = 0.5f;
-    }
+    float phase = (lfo / 65536.0f) * 2.0f * M_PI;
+    float lfo_amt = sinf(phase + M_PI_2) * 0.01f;
+    float swing = base + lfo_amt;
+
+    if (swing > 0.65f)
+        swing = 0.65f;
+    if (swing < swing_min)
+        swing = swing_min;
     return swing;
 }
 
-static double rand_standard_normal(void) {
-    static int has_spare = 0;
-    static double spare;
-    if (has_spare) {
-        has_spare = 0;
-        return spare;
-    }
-    has_spare = 1;
+float HOT_PATH_FUNC(ghost_note_modulate_swing_ratio)(float lfo) {
+    return swing_curve[((uint32_t)lfo >> SWING_CURVE_SHIFT) % GHOST_NOTE_SWING_CURVE_SIZE];
+}
+
+static void derive_threshold(uint8_t *threshold, float ghost_intensity) {
+    for (size_t p = 0; p < GHOST_NOTE_THRESHOLDS; p++)
+        threshold[p] = (uint8_t)ceilf(p * ghost_intensity);
+}
 
+static void derive_swing_curve(float *curve, const ghost_parameters_t *params) {
+    for (size_t i = 0; i < GHOST_NOTE_SWING_CURVE_SIZE; i++)
+        curve[i] = swing_ratio_at(params->ghost_intensity, params->swing_ratio_base,
+                                  i << SWING_CURVE_SHIFT);
+}
+
+/*
+ * Marsaglia polar method. Only one value of each pair is used: a kept
+ * spare would outlive srand(), so the same seed could give another draw.
+ */
+static double rand_standard_normal(const ghost_engine_t *e) {
     double u, v, s;
     do {
-        u = rand() / (double)RAND_MAX * 2.0 - 1.0;
-        v = rand() / (double)RAND_MAX * 2.0 - 1.0;
+        u = ghost_rand(e) / (double)RAND_MAX * 2.0 - 1.0;
+        v = ghost_rand(e) / (double)RAND_MAX * 2.0 - 1.0;
         s = u * u + v * v;
     } while (s >= 1.0 || s == 0.0);
 
-    s = sqrt(-2.0 * log(s) / s);
-    spare = v * s;
-    return u * s;
+    return u * sqrt(-2.0 * log(s) / s);
 }
 
-static double rand_normal(double mu, double sigma2) {
-    double sigma = sqrt(sigma2);
-    return mu + sigma * rand_standard_normal();
+static double rand_normal(const ghost_engine_t *e, double mu, double sigma) {
+    return mu + sigma * rand_standard_normal(e);
 }
 
 static inline int clamp_int(int x, int lo, int hi) {
@@ -111,20 +196,18 @@ static inline int clamp_int(int x, int lo, int hi) {
     return x;
 }
 
-// Count existing user notes
-static uint8_t count_user_notes(const bool note_pattern[], size_t len) {
+// Count existing user notes of track `t`
+static uint8_t count_user_notes(const looper_pattern_t *pattern, uint8_t t) {
     uint8_t n = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (note_pattern[i])
+    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+        if (looper_pattern_hit(pattern, t, i))
             n++;
     }
     return n;
 }
 
 // Determine how many extra notes to add
-static uint8_t calculate_extra_note_count(uint8_t current) {
-    euclidean_parameters_t *euclid = &parameters.euclidean;
-
+static uint8_t calculate_extra_note_count(const euclidean_parameters_t *euclid, uint8_t current) {
     if (current >= euclid->k_sufficient)
         return 0;
 
@@ -133,8 +216,9 @@ static uint8_t calculate_extra_note_count(uint8_t current) {
 }
 
 // Apply the ghost notes
-static void apply_euclidean_ghost_notes(track_t *track, uint8_t total_notes, uint8_t offset) {
-    euclidean_parameters_t *euclid = &parameters.euclidean;
+static void apply_euclidean_ghost_notes(const ghost_engine_t *e, looper_pattern_t *pattern,
+                                        uint8_t t, uint8_t total_notes, uint8_t offset) {
+    const euclidean_parameters_t *euclid = &e->params->euclidean;
     float density = total_notes / (float)LOOPER_TOTAL_STEPS;
     uint32_t euclid_accumulator = 0;
 
@@ -143,196 +227,255 @@ static void apply_euclidean_ghost_notes(track_t *track, uint8_t total_notes, uin
         if (euclid_accumulator >= LOOPER_TOTAL_STEPS) {
             euclid_accumulator -= LOOPER_TOTAL_STEPS;
             size_t pos = (i + offset) % LOOPER_TOTAL_STEPS;
+            ghost_note_t *ghost = &pattern->ghost_notes[pos][t];
 
-            if (!track->pattern[pos] && track->ghost_notes[pos].rand_sample == 0) {
+            if (!looper_pattern_hit(pattern, t, pos) && ghost->rand_sample == 0) {
                 float probability = euclid->probability * (1.0f - density);
                 uint8_t prob = (uint8_t)roundf(clamp_int(probability * 100.0f, 0, 100));
-                track->ghost_notes[pos].probability = prob;
-                track->ghost_notes[pos].rand_sample = rand() % 100;
+                ghost->probability = prob;
+                ghost->rand_sample = ghost_rand(e) % 100;
             }
         }
     }
 }
 
 // Add Euclidean ghost notes to the track
-static void add_euclidean_ghost_notes(track_t *track) {
-    euclidean_parameters_t *euclid = &parameters.euclidean;
-
-    uint8_t n = count_user_notes(track->pattern, LOOPER_TOTAL_STEPS);
+static void add_euclidean_ghost_notes(const ghost_engine_t *e, looper_pattern_t *pattern,
+                                      uint8_t t) {
+    const euclidean_parameters_t *euclid = &e->params->euclidean;
+    uint8_t n = count_user_notes(pattern, t);
     if (n == 0 || n >= LOOPER_TOTAL_STEPS)
         return;
 
-    uint8_t extra_note_count = calculate_extra_note_count(n);
+    uint8_t extra_note_count = calculate_extra_note_count(euclid, n);
     uint8_t target_note_count = clamp_int(n + extra_note_count, 1, euclid->k_max);
 
     uint8_t phase_step_count = LOOPER_TOTAL_STEPS / target_note_count;
-    uint8_t phase_offset = rand() % phase_step_count;
+    uint8_t phase_offset = ghost_rand(e) % phase_step_count;
 
-    apply_euclidean_ghost_notes(track, target_note_count, phase_offset);
+    apply_euclidean_ghost_notes(e, pattern, t, target_note_count, phase_offset);
 }
 
 // 1/16th positions around the user input
-static void add_boundary_notes(track_t *track) {
-    boundary_parameters_t *boundary = &parameters.boundary;
-
+static void add_boundary_notes(const ghost_engine_t *e, looper_pattern_t *pattern, uint8_t t) {
+    const boundary_parameters_t *boundary = &e->params->boundary;
     for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
-        if (track->pattern[i] &&
-            !track->pattern[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS] &&
-            !track->ghost_notes[i].rand_sample) {
-            track->ghost_notes[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS].probability =
+        size_t before = (LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS;
+        size_t after = (i + 1) % LOOPER_TOTAL_STEPS;
+        bool hit = looper_pattern_hit(pattern, t, i);
+
+        if (hit && !looper_pattern_hit(pattern, t, before) &&
+            !pattern->ghost_notes[i][t].rand_sample) {
+            pattern->ghost_notes[before][t].probability =
                 (uint8_t)(boundary->before_probability * 100);
-            track->ghost_notes[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS].rand_sample =
-                rand() % 100;
+            pattern->ghost_notes[before][t].rand_sample = ghost_rand(e) % 100;
         }
-        if (track->pattern[i] && !track->pattern[(i + 1) % LOOPER_TOTAL_STEPS] &&
-            !track->ghost_notes[i].rand_sample) {
-            track->ghost_notes[(i + 1) % LOOPER_TOTAL_STEPS].probability =
+        if (hit && !looper_pattern_hit(pattern, t, after) &&
+            !pattern->ghost_notes[i][t].rand_sample) {
+            pattern->ghost_notes[after][t].probability =
                 (uint8_t)(boundary->after_probability * 100);
-            track->ghost_notes[(i + 1) % LOOPER_TOTAL_STEPS].rand_sample = rand() % 100;
+            pattern->ghost_notes[after][t].rand_sample = ghost_rand(e) % 100;
         }
     }
 }
 
-static float track_window_density(track_t *track, uint8_t step, uint8_t window) {
+static float track_window_density(const looper_pattern_t *pattern, uint8_t t, uint8_t step,
+                                  uint8_t window) {
     uint8_t n = 0;
     for (int i = -window; i <= window; i++) {
         size_t pos = (LOOPER_TOTAL_STEPS + step + i) % LOOPER_TOTAL_STEPS;
-        n += (uint8_t)track->pattern[pos];
+        n += (uint8_t)looper_pattern_hit(pattern, t, pos);
     }
     return (float)n / (float)(window * 2 + 1);
 }
 
-static void update_density_track_window(void) {
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    for (size_t t = 0; t < num_tracks; t++) {
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
-            note_density_track_window[t][i] = track_window_density(&tracks[t], i, DENSITY_WIN_HALF);
-        }
-    }
-}
-
-// Add ghost fill-in notes based on track density and randomized start
-static void add_fillin_notes(void) {
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    fill_parameters_t *fill = &parameters.fill;
-
-    update_density_track_window();
+/*
+ * Add ghost fill-in notes to `pattern` from `fill_start` to the loop end, on
+ * the tracks that play fills. The density window is kept per call, since
+ * the live pattern and an export render can both be filling at once.
+ */
+static void add_fillin_notes_from(const ghost_engine_t *e, looper_pattern_t *pattern,
+                                  uint16_t fill_start) {
+    const fill_parameters_t *fill = &e->params->fill;
 
-    uint16_t fill_start =
-        LOOPER_TOTAL_STEPS - abs((int8_t)rand_normal(fill->start_mean, fill->start_sd));
-    for (size_t t = 0; t < num_tracks; t++) {
-        if (t != 0 && t != 1)
+    for (size_t t = 0; t < e->num_tracks; t++) {
+        if (!e->tracks[t].fill)
             continue;
 
+        float density[LOOPER_TOTAL_STEPS];
+        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++)
+            density[i] = track_window_density(pattern, t, i, DENSITY_WIN_HALF);
+
         for (size_t i = fill_start; i < LOOPER_TOTAL_STEPS; i++) {
-            bool ghost_on = (float)(tracks[t].ghost_notes[i].probability / 100.0f) *
-                                parameters.ghost_intensity >
-                            (float)tracks[t].ghost_notes[i].rand_sample / 100.0f;
-            if (!ghost_on) {
-                tracks[t].ghost_notes[i].probability =
-                    (uint8_t)((1.0 - note_density_track_window[t][i]) * 0.25 * 100.0f);
-                tracks[t].ghost_notes[i].rand_sample = rand() % 100;
+            ghost_note_t *ghost = &pattern->ghost_notes[i][t];
+            if (!engine_is_active(e, ghost)) {
+                ghost->probability = (uint8_t)((1.0 - density[i]) * 0.25 * 100.0f);
+                ghost->rand_sample = ghost_rand(e) % 100;
             }
-            if (((float)tracks[t].ghost_notes[i].probability / 100.0f) *
-                    parameters.ghost_intensity >
-                (float)(tracks[t].ghost_notes[i].rand_sample / 100))
-                tracks[t].fill_pattern[i] = CHANCE(fill->probability * parameters.ghost_intensity);
+            if (e->threshold[ghost->probability] == 0)
+                continue;
+            if (chance(e, fill->probability * e->params->ghost_intensity))
+                pattern->fills[i] |= TRACK_BIT(t);
+            else
+                pattern->fills[i] &= ~TRACK_BIT(t);
         }
     }
 }
 
-static void add_fillin_notes_now(void) {
-    looper_status_t *looper_status = looper_status_get();
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    fill_parameters_t *fill = &parameters.fill;
-
-    update_density_track_window();
-
-    uint16_t fill_start = looper_status->current_step;
-    for (size_t t = 0; t < num_tracks; t++) {
-        if (t != 0 && t != 1)
-            continue;
-
-        for (size_t i = fill_start; i < LOOPER_TOTAL_STEPS; i++) {
-            bool ghost_on = (float)(tracks[t].ghost_notes[i].probability / 100.0f) *
-                                parameters.ghost_intensity >
-                            (float)tracks[t].ghost_notes[i].rand_sample / 100.0f;
-            if (!ghost_on) {
-                tracks[t].ghost_notes[i].probability =
-                    (uint8_t)((1.0 - note_density_track_window[t][i]) * 0.25 * 100.0f);
-                tracks[t].ghost_notes[i].rand_sample = rand() % 100;
-            }
-            if (((float)tracks[t].ghost_notes[i].probability / 100.0f) *
-                    parameters.ghost_intensity >
-                (float)(tracks[t].ghost_notes[i].rand_sample / 100))
-                tracks[t].fill_pattern[i] = CHANCE(fill->probability * parameters.ghost_intensity);
-        }
-    }
+// Add ghost fill-in notes based on track density and randomized start
+static void add_fillin_notes(const ghost_engine_t *e, looper_pattern_t *pattern) {
+    int8_t before_end = (int8_t)rand_normal(e, e->params->fill.start_mean, e->fill_start_sigma);
+    add_fillin_notes_from(e, pattern, LOOPER_TOTAL_STEPS - abs(before_end));
 }
 
-static float pattern_density(void) {
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    uint8_t n = 0;
+static float pattern_density(const ghost_engine_t *e, const looper_pattern_t *pattern) {
+    uint16_t n = 0;
 
-    for (size_t t = 0; t < num_tracks; t++) {
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) n += (uint8_t)tracks[t].pattern[i];
-    }
-    return n / (float)(num_tracks * LOOPER_TOTAL_STEPS);
+    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++)
+        n += __builtin_popcount(pattern->hits[i] & e->active);
+    return n / (float)(e->num_tracks * LOOPER_TOTAL_STEPS);
 }
 
-void ghost_note_create(track_t *track) {
-    memset(track->ghost_notes, 0, sizeof(track->ghost_notes));
+static void engine_create(const ghost_engine_t *e, looper_pattern_t *pattern, uint8_t t) {
+    TRACE_BEGIN(TRACE_GHOST, t);
+    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) pattern->ghost_notes[i][t] = (ghost_note_t){0};
 
-    add_euclidean_ghost_notes(track);
-    add_boundary_notes(track);
+    add_euclidean_ghost_notes(e, pattern, t);
+    add_boundary_notes(e, pattern, t);
+    TRACE_END(TRACE_GHOST, t);
 }
 
-static inline bool is_first_step(looper_status_t *s) { return s->current_step == 0; }
-
-static inline bool is_bar_start(looper_status_t *s) {
-    return s->current_step % (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT) == 0;
+// Regenerate the ghost notes of track `t` in `pattern` from `params`.
+void ghost_note_create_with(looper_pattern_t *pattern, uint8_t t,
+                            const ghost_parameters_t *params) {
+    ghost_engine_t e = live_engine(params);
+    engine_create(&e, pattern, t);
 }
 
-static inline bool is_creation_bar(looper_status_t *s) { return s->ghost_bar_counter == 0; }
+// Regenerate the ghost notes of track `t` in `pattern`.
+void ghost_note_create(looper_pattern_t *pattern, uint8_t t) {
+    ghost_note_create_with(pattern, t, &parameters);
+}
 
-static inline bool is_fillin_bar(looper_status_t *s) {
-    fill_parameters_t *fill = &parameters.fill;
-    return s->ghost_bar_counter == (fill->interval_bar - 2);
+static inline bool is_bar_start(uint8_t step) {
+    return step % (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT) == 0;
 }
 
 void ghost_note_set_pending_fill_request(void) { pending_fill_request = true; }
 
-void ghost_note_maintenance_step(void) {
-    looper_status_t *looper_status = looper_status_get();
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    fill_parameters_t *fill = &parameters.fill;
+/*
+ * Swap in the staged parameters if they changed, rebuilding only the
+ * derived tables whose inputs differ. Call from the step timer context only.
+ */
+void HOT_PATH_FUNC(ghost_note_parameters_sync)(void) {
+    if (staged_version == active_version)
+        return;
 
-    if (is_bar_start(looper_status))
-        looper_status->ghost_bar_counter =
-            (looper_status->ghost_bar_counter + 1) % fill->interval_bar;
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    ghost_parameters_t previous = parameters;
+    parameters = staged;
+    parameters.swing_ratio = previous.swing_ratio;
+    active_version = staged_version;
+    async_context_release_lock(async_timer_async_context());
+
+    bool rebuild_all = !derived_ready;
+    derived_ready = true;
+    bool intensity_changed = parameters.ghost_intensity != previous.ghost_intensity;
+    if (rebuild_all || intensity_changed)
+        derive_threshold(ghost_threshold, parameters.ghost_intensity);
+    if (rebuild_all || intensity_changed ||
+        parameters.swing_ratio_base != previous.swing_ratio_base)
+        derive_swing_curve(swing_curve, &parameters);
+    if (rebuild_all || parameters.fill.start_sd != previous.fill.start_sd)
+        fill_start_sigma = sqrtf(parameters.fill.start_sd);
+    if (parameters.fill.interval_bar == 0)
+        parameters.fill.interval_bar = 1;
+}
 
-    if (is_first_step(looper_status)) {
-        for (size_t i = 0; i < num_tracks; i++)
-            memset(tracks[i].fill_pattern, 0, sizeof(tracks[i].fill_pattern));
+/*
+ * Moves the ghost engine of `pattern` on to `step`: counts bars in
+ * `bar_counter`, clears the fills at the loop start, regenerates the ghost
+ * notes at the start of every fill interval and adds fills in the bar
+ * before its last. Returns true if the step started a generation.
+ */
+static bool HOT_PATH_FUNC(ghost_note_advance)(const ghost_engine_t *e, looper_pattern_t *pattern,
+                                              uint8_t step, uint8_t *bar_counter, bool playing) {
+    const fill_parameters_t *fill = &e->params->fill;
+
+    if (is_bar_start(step))
+        *bar_counter = (*bar_counter + 1) % fill->interval_bar;
+    if (step != 0)
+        return false;
+
+    memset(pattern->fills, 0, sizeof(pattern->fills));
+    if (*bar_counter == 0) {
+        for (size_t i = 0; i < e->num_tracks; i++) {
+            engine_create(e, pattern, i);
+        }
+        return true;
+    } else if (*bar_counter == fill->interval_bar - 2 && playing) {
+        if (pattern_density(e, pattern) > 0)
+            add_fillin_notes(e, pattern);
+        return true;
     }
+    return false;
+}
 
-    if (is_creation_bar(looper_status) && is_first_step(looper_status)) {
-        for (size_t i = 0; i < num_tracks; i++) {
-            ghost_note_create(&tracks[i]);
-        }
-    } else if (is_fillin_bar(looper_status) && is_first_step(looper_status) &&
-               looper_status->state == LOOPER_STATE_PLAYING) {
-        if (pattern_density() > 0)
-            add_fillin_notes();
-    } else if (pending_fill_request) {
-        add_fillin_notes_now();
+void HOT_PATH_FUNC(ghost_note_maintenance_step)(void) {
+    ghost_note_parameters_sync();
+
+    looper_status_t *looper_status = looper_status_get();
+    looper_pattern_t *pattern = looper_pattern_get();
+    ghost_engine_t e = live_engine(&parameters);
+
+    bool generated = ghost_note_advance(&e, pattern, looper_status->current_step,
+                                        &looper_status->ghost_bar_counter,
+                                        looper_status->state == LOOPER_STATE_PLAYING);
+    if (!generated && pending_fill_request) {
+        add_fillin_notes_from(&e, pattern, looper_status->current_step);
         pending_fill_request = false;
     }
 
     parameters.swing_ratio = ghost_note_modulate_swing_ratio(looper_status->lfo_phase);
 }
+
+/*
+ * Starts a render from the parameters and tracks in play and from `seed`.
+ * Call with the async context lock held; the render needs no lock after.
+ */
+void ghost_note_render_init(ghost_render_t *render, uint32_t seed) {
+    render->params = parameters;
+    if (render->params.fill.interval_bar == 0)
+        render->params.fill.interval_bar = 1;
+    derive_threshold(render->threshold, render->params.ghost_intensity);
+    derive_swing_curve(render->swing_curve, &render->params);
+    render->fill_start_sigma = sqrtf(render->params.fill.start_sd);
+    render->tracks = looper_tracks_get(&render->num_tracks);
+    render->active = looper_active_tracks();
+    render->seed = seed ? seed : 1;  // xorshift32 stays at 0 once there
+}
+
+// Generates the ghost notes of every track of the render in `pattern`.
+void ghost_note_render_create(ghost_render_t *render, looper_pattern_t *pattern) {
+    ghost_engine_t e = render_engine(render);
+    for (size_t t = 0; t < e.num_tracks; t++) engine_create(&e, pattern, t);
+}
+
+/*
+ * Advances a pattern that is not playing, e.g. one being rendered for
+ * export, to `step` as the step timer would while playing. The caller
+ * creates the ghost notes of the first loop and counts bars from 0.
+ */
+void ghost_note_render_step(ghost_render_t *render, looper_pattern_t *pattern, uint8_t step,
+                            uint8_t *bar_counter) {
+    ghost_engine_t e = render_engine(render);
+    ghost_note_advance(&e, pattern, step, bar_counter, true);
+}
+
+bool ghost_note_render_is_active(const ghost_render_t *render, const ghost_note_t *ghost) {
+    return ghost->rand_sample < render->threshold[ghost->probability];
+}
+
+float ghost_note_render_swing_ratio(const ghost_render_t *render, float lfo) {
+    return render->swing_curve[((uint32_t)lfo >> SWING_CURVE_SHIFT) % GHOST_NOTE_SWING_CURVE_SIZE];
+}
@@ -0,0 +1,138 @@
+/*
+ * groove.c
+ *
+ * Per-step timing offsets for swing and groove templates.
+ *
+ * Every template describes each step's displacement as a fraction of a
+ * step (Q15). groove_update() keeps a table of these fractions at the base
+ * swing ratio, rebuilt only when the base swing or the template changes,
+ * plus each step's weight of any swing above the base. The LFO-modulated
+ * swing and a tempo ramp thus change no table: playing a step scales its
+ * fraction by the current step period.
+ *
+ * The recorded template is learned from button presses while recording:
+ * each press's distance from the grid is averaged into its step. Offsets
+ * that would play a note early are folded into a common delay for the whole
+ * table, since a step can not be played before its own tick.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "groove.h"
+
+#include <stdbool.h>
+
+#include "hot_path.h"
+#include "looper.h"
+
+#define GROOVE_ONE 32768                // one step in Q15
+#define GROOVE_LEARN_LIMIT (GROOVE_ONE / 2)  // learned offsets stay within half a step
+
+static groove_template_t selected = GROOVE_SWING_16TH;
+static int32_t offsets_q15[LOOPER_TOTAL_STEPS];  // At the base swing, common delay included
+static int8_t swing_weight[LOOPER_TOTAL_STEPS];  // Displacement per unit of swing above the base
+
+// Base swing the table was built from; a mismatch triggers a rebuild.
+static bool table_valid = false;
+static int32_t built_swing_q15;
+
+// Set on every step.
+static uint32_t period_us;
+static int32_t swing_extra_q15;  // Modulated swing above the base
+
+static int16_t recorded_q15[LOOPER_TOTAL_STEPS];
+static uint8_t recorded_count[LOOPER_TOTAL_STEPS];
+
+void groove_select(groove_template_t groove) {
+    if (groove < GROOVE_COUNT && groove != selected) {
+        selected = groove;
+        table_valid = false;
+    }
+}
+
+groove_template_t groove_selected(void) { return selected; }
+
+// Displacement of `step` in Q15 steps for the selected template.
+static int32_t HOT_PATH_FUNC(groove_fraction)(uint8_t step, int32_t swing_q15) {
+    switch (selected) {
+        case GROOVE_SWING_8TH:
+            // The off-beat 8th moves by twice the 16th amount; the 16ths around it follow.
+            if (step % 4 == 2)
+                return 4 * swing_q15;
+            return (step % 2) ? 2 * swing_q15 : 0;
+        case GROOVE_SHUFFLE:
+            return (step % 2) ? GROOVE_ONE / 3 : 0;
+        case GROOVE_RECORDED:
+            return recorded_q15[step];
+        default:
+            return (step % 2) ? 2 * swing_q15 : 0;
+    }
+}
+
+/*
+ * Takes the step period and swing for the next step, and rebuilds the
+ * table if the base swing or the template changed since the last build.
+ * The modulated swing never falls below the base. Called once per step
+ * from the step timer.
+ */
+void HOT_PATH_FUNC(groove_update)(uint32_t step_period_us, float swing_ratio_base,
+                                  float swing_ratio) {
+    int32_t base_q15 = (int32_t)((swing_ratio_base - 0.5f) * GROOVE_ONE);
+    int32_t swing_q15 = (int32_t)((swing_ratio - 0.5f) * GROOVE_ONE);
+    period_us = step_period_us;
+    swing_extra_q15 = (swing_q15 > base_q15) ? swing_q15 - base_q15 : 0;
+    if (table_valid && base_q15 == built_swing_q15)
+        return;
+
+    int32_t earliest = 0;
+    for (uint8_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+        offsets_q15[i] = groove_fraction(i, base_q15);
+        swing_weight[i] = (int8_t)(groove_fraction(i, 1) - groove_fraction(i, 0));
+        if (offsets_q15[i] < earliest)
+            earliest = offsets_q15[i];
+    }
+    for (uint8_t i = 0; i < LOOPER_TOTAL_STEPS; i++) offsets_q15[i] -= earliest;
+
+    built_swing_q15 = base_q15;
+    table_valid = true;
+}
+
+uint32_t HOT_PATH_FUNC(groove_offset_us)(uint8_t step) {
+    step %= LOOPER_TOTAL_STEPS;
+    int32_t q15 = offsets_q15[step] + swing_weight[step] * swing_extra_q15;
+    return (uint32_t)(((int64_t)q15 * period_us) >> 15);
+}
+
+// Displacement of `step` in Q15 steps at `swing_ratio`, before the common delay.
+int32_t groove_step_q15(uint8_t step, float swing_ratio) {
+    return groove_fraction(step % LOOPER_TOTAL_STEPS, (int32_t)((swing_ratio - 0.5f) * GROOVE_ONE));
+}
+
+// Forget the learned microtiming, e.g. when a new recording starts.
+void groove_learn_reset(void) {
+    for (uint8_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+        recorded_q15[i] = 0;
+        recorded_count[i] = 0;
+    }
+    if (selected == GROOVE_RECORDED)
+        table_valid = false;
+}
+
+// Average one press's distance from the grid into the recorded template.
+void groove_learn(uint8_t step, int32_t offset_us, uint32_t step_period_us) {
+    if (step >= LOOPER_TOTAL_STEPS || step_period_us == 0)
+        return;
+    int32_t q15 = (int32_t)(((int64_t)offset_us * GROOVE_ONE) / (int32_t)step_period_us);
+    if (q15 > GROOVE_LEARN_LIMIT)
+        q15 = GROOVE_LEARN_LIMIT;
+    if (q15 < -GROOVE_LEARN_LIMIT)
+        q15 = -GROOVE_LEARN_LIMIT;
+
+    uint8_t n = recorded_count[step];
+    recorded_q15[step] = (int16_t)((recorded_q15[step] * n + q15) / (n + 1));
+    if (n < 255)
+        recorded_count[step] = n + 1;
+    if (selected == GROOVE_RECORDED)
+        table_valid = false;
+}
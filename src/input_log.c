@@ -0,0 +1,108 @@
+/*
+ * input_log.c
+ *
+ * Log of every external input, for replaying a session on the host (see
+ * host/replay). Button events are logged with their edge times, MIDI
+ * channel messages and clock/start with the time they were handled, and
+ * the USB mount state whenever it changes. Recording runs from boot until
+ * the log is full, so a replay can start from the same power-on state.
+ *
+ * `record dump` on the console stops recording and prints the log, one
+ * line per main loop pass, in the text format the replay tool reads:
+ *
+ *   [INPUT] <time_us> button <button_event_t>
+ *   [INPUT] <time_us> midi <status> <data1> <data2>   (hex)
+ *   [INPUT] <time_us> usb <0|1>
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "input_log.h"
+
+#include <stdio.h>
+
+#include "drivers/usb_midi.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+static input_log_event_t events[INPUT_LOG_EVENTS];
+static volatile uint32_t event_count = 0;
+static volatile bool recording = true;
+static bool usb_connected = false;
+static uint32_t dump_position = 0;
+static bool dumping = false;
+
+static void input_log_add(uint64_t time_us, input_log_kind_t kind, uint8_t data0, uint8_t data1,
+                          uint8_t data2) {
+    if (!recording)
+        return;
+    uint32_t flags = save_and_disable_interrupts();
+    uint32_t index = event_count;
+    if (index < INPUT_LOG_EVENTS)
+        event_count = index + 1;
+    restore_interrupts(flags);
+    if (index < INPUT_LOG_EVENTS)
+        events[index] = (input_log_event_t){(uint32_t)time_us, kind, {data0, data1, data2}};
+}
+
+void input_log_button(button_event_t event, uint64_t time_us) {
+    input_log_add(time_us, INPUT_LOG_BUTTON, event, 0, 0);
+}
+
+void input_log_midi(uint64_t time_us, uint8_t status, uint8_t data1, uint8_t data2) {
+    input_log_add(time_us, INPUT_LOG_MIDI, status, data1, data2);
+}
+
+// Clears the log and records from now on.
+void input_log_start(void) {
+    dumping = false;
+    event_count = 0;
+    usb_connected = false;  // logs the current state on the next task
+    recording = true;
+}
+
+void input_log_stop(void) { recording = false; }
+
+void input_log_dump(void) {
+    input_log_stop();
+    dump_position = 0;
+    dumping = true;
+    printf("[INPUT] # %lu events%s\n", (unsigned long)event_count,
+           (event_count == INPUT_LOG_EVENTS) ? ", log full" : "");
+}
+
+bool input_log_dumping(void) { return dumping; }
+
+// Called from the main loop: follows the USB state and streams a dump in progress.
+void input_log_task(void) {
+    bool connected = usb_midi_is_connected();
+    if (connected != usb_connected) {
+        usb_connected = connected;
+        input_log_add(time_us_64(), INPUT_LOG_USB, connected, 0, 0);
+    }
+
+    if (!dumping)
+        return;
+    if (dump_position == event_count) {
+        printf("[INPUT] # end\n");
+        dumping = false;
+        return;
+    }
+
+    const input_log_event_t *e = &events[dump_position++];
+    switch (e->kind) {
+        case INPUT_LOG_BUTTON:
+            printf("[INPUT] %lu button %u\n", (unsigned long)e->time_us, e->data[0]);
+            break;
+        case INPUT_LOG_MIDI:
+            printf("[INPUT] %lu midi %02x %02x %02x\n", (unsigned long)e->time_us, e->data[0],
+                   e->data[1], e->data[2]);
+            break;
+        case INPUT_LOG_USB:
+            printf("[INPUT] %lu usb %u\n", (unsigned long)e->time_us, e->data[0]);
+            break;
+        default:
+            break;
+    }
+}
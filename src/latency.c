@@ -0,0 +1,277 @@
+/*
+ * latency.c
+ *
+ * Recording latency calibration and per-destination output compensation.
+ *
+ * Each output has a measured one-way latency. Notes are scheduled on every
+ * connected output so that they all sound when the slowest one does: a fast
+ * destination (USB) is delayed by the difference to the slowest (BLE). The
+ * player hears the loop that much behind the step clock, plus their own
+ * reaction, so button times are shifted back by an input offset before
+ * being quantized.
+ *
+ * Two calibration modes derive the offsets, driven from the main loop:
+ *  - loopback: probe notes are sent on each connected output and timed until
+ *    they come back on the same port's MIDI IN (patched through by the host);
+ *    half the median round trip is that output's latency.
+ *  - tap-along: a click plays at 120 BPM and the player taps the button on
+ *    it; the median tap-to-click time becomes the input offset.
+ * Results are written to flash and loaded at boot.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "latency.h"
+
+#include <stdio.h>
+
+#include "drivers/ble_midi.h"
+#include "drivers/storage.h"
+#include "drivers/usb_midi.h"
+#include "hot_path.h"
+#include "note_scheduler.h"
+#include "pico/time.h"
+
+#define LATENCY_PROBES 8
+#define LATENCY_PROBE_STATUS 0x9F  // note-on, channel 16
+#define LATENCY_PROBE_NOTE 127
+#define LATENCY_PROBE_INTERVAL_US 100000
+#define LATENCY_PROBE_TIMEOUT_US 500000
+#define LATENCY_PROBE_MAX_MISSES 3
+
+#define LATENCY_TAP_INTERVAL_US 500000  // 120 BPM quarter notes
+#define LATENCY_TAP_COUNT_IN 4          // clicks before taps are measured
+#define LATENCY_TAP_CLICKS 20
+#define LATENCY_TAP_MIN_SAMPLES 8
+#define LATENCY_CLICK_LEAD_US 20000  // clicks are handed to the scheduler this early
+#define LATENCY_CLICK_CHANNEL 0
+#define LATENCY_CLICK_NOTE 37  // rim shot, as the looper click
+
+static latency_offsets_t offsets;
+static volatile latency_calibration_t mode = LATENCY_CALIBRATION_IDLE;
+static int32_t samples[LATENCY_TAP_CLICKS];
+static uint8_t sample_count;
+
+// Loopback state. The probe return is stamped by whichever context parses the input.
+static latency_output_t probe_output;
+static uint8_t probe_measured;  // LATENCY_OUTPUT_BIT() of outputs measured in this run
+static uint8_t probe_misses;
+static bool probe_waiting;
+static uint32_t probe_sent_us;
+static uint32_t probe_next_us;
+static volatile bool probe_returned;
+static volatile uint32_t probe_return_us;
+
+// Tap-along state.
+static uint64_t click_start_us;  // time of click 0
+static uint8_t clicks_scheduled;
+
+static bool HOT_PATH_FUNC(output_connected)(latency_output_t output) {
+    return output == LATENCY_OUTPUT_USB ? usb_midi_is_connected() : ble_midi_is_connected();
+}
+
+static int32_t clamp_offset(int32_t us) {
+    if (us > LATENCY_MAX_US)
+        return LATENCY_MAX_US;
+    if (us < -LATENCY_MAX_US)
+        return -LATENCY_MAX_US;
+    return us;
+}
+
+// Median of the collected samples (sorts them in place).
+static int32_t samples_median(void) {
+    for (uint8_t i = 1; i < sample_count; i++) {
+        int32_t v = samples[i];
+        uint8_t j = i;
+        for (; j > 0 && samples[j - 1] > v; j--)
+            samples[j] = samples[j - 1];
+        samples[j] = v;
+    }
+    return samples[sample_count / 2];
+}
+
+static void calibration_finish(bool changed) {
+    mode = LATENCY_CALIBRATION_IDLE;
+    if (!changed)
+        return;
+    storage_store_latency(&offsets);
+    printf("[LATENCY] input=%ldus usb=%ldus ble=%ldus\n", (long)offsets.input_us,
+           (long)offsets.output_us[LATENCY_OUTPUT_USB], (long)offsets.output_us[LATENCY_OUTPUT_BLE]);
+}
+
+void latency_init(void) {
+    if (!storage_load_latency(&offsets))
+        offsets = (latency_offsets_t){0};
+}
+
+const latency_offsets_t *latency_offsets(void) { return &offsets; }
+
+/*
+ * Extra delay for notes on `output` so that it sounds together with the
+ * slowest connected output.
+ */
+uint32_t HOT_PATH_FUNC(latency_output_delay_us)(latency_output_t output) {
+    int32_t slowest = 0;
+    for (int o = 0; o < LATENCY_OUTPUT_COUNT; o++) {
+        if (output_connected(o) && offsets.output_us[o] > slowest)
+            slowest = offsets.output_us[o];
+    }
+    int32_t delay = slowest - offsets.output_us[output];
+    return delay > 0 ? (uint32_t)delay : 0;
+}
+
+// Moves the loopback run to the next connected output at or after `first`.
+static void loopback_select_output(int first) {
+    for (int o = first; o < LATENCY_OUTPUT_COUNT; o++) {
+        if (output_connected(o)) {
+            probe_output = o;
+            probe_misses = 0;
+            probe_waiting = false;
+            probe_next_us = time_us_32();
+            sample_count = 0;
+            return;
+        }
+    }
+
+    // All outputs done: the player hears the slowest one.
+    int32_t slowest = 0;
+    for (int o = 0; o < LATENCY_OUTPUT_COUNT; o++) {
+        if ((probe_measured & LATENCY_OUTPUT_BIT(o)) && offsets.output_us[o] > slowest)
+            slowest = offsets.output_us[o];
+    }
+    if (probe_measured)
+        offsets.input_us = slowest;
+    calibration_finish(probe_measured != 0);
+}
+
+static void loopback_send_probe(uint32_t now_us) {
+    probe_returned = false;
+    probe_sent_us = now_us;
+    probe_waiting = true;
+    if (probe_output == LATENCY_OUTPUT_USB) {
+        usb_midi_send_message(LATENCY_PROBE_STATUS, LATENCY_PROBE_NOTE, 1);
+        usb_midi_send_message(LATENCY_PROBE_STATUS & 0x8F, LATENCY_PROBE_NOTE, 0);
+    } else {
+        uint64_t time_us = time_us_64();
+        ble_midi_send_message(time_us, LATENCY_PROBE_STATUS, LATENCY_PROBE_NOTE, 1);
+        ble_midi_send_message(time_us, LATENCY_PROBE_STATUS & 0x8F, LATENCY_PROBE_NOTE, 0);
+    }
+}
+
+static void loopback_task(void) {
+    uint32_t now_us = time_us_32();
+
+    if (probe_waiting) {
+        if (probe_returned) {
+            samples[sample_count++] = (int32_t)(probe_return_us - probe_sent_us);
+        } else if (now_us - probe_sent_us > LATENCY_PROBE_TIMEOUT_US) {
+            if (++probe_misses > LATENCY_PROBE_MAX_MISSES) {  // not looped back: keep old value
+                loopback_select_output(probe_output + 1);
+                return;
+            }
+        } else {
+            return;
+        }
+        probe_waiting = false;
+        probe_next_us = now_us + LATENCY_PROBE_INTERVAL_US;
+    }
+
+    if (sample_count >= LATENCY_PROBES) {
+        offsets.output_us[probe_output] = clamp_offset(samples_median() / 2);
+        probe_measured |= LATENCY_OUTPUT_BIT(probe_output);
+        loopback_select_output(probe_output + 1);
+    } else if ((int32_t)(now_us - probe_next_us) >= 0) {
+        loopback_send_probe(now_us);
+    }
+}
+
+static inline uint64_t tap_click_time(uint8_t index) {
+    return click_start_us + (uint64_t)index * LATENCY_TAP_INTERVAL_US;
+}
+
+static void tap_task(void) {
+    uint64_t now_us = time_us_64();
+
+    while (clicks_scheduled < LATENCY_TAP_CLICKS &&
+           now_us + LATENCY_CLICK_LEAD_US >= tap_click_time(clicks_scheduled)) {
+        uint8_t velocity = (clicks_scheduled % 4 == 0) ? 0x40 : 0x20;
+        note_scheduler_schedule_note(tap_click_time(clicks_scheduled), LATENCY_CLICK_CHANNEL,
+                                     LATENCY_CLICK_NOTE, velocity);
+        clicks_scheduled++;
+    }
+
+    if (now_us > tap_click_time(LATENCY_TAP_CLICKS - 1) + LATENCY_TAP_INTERVAL_US / 2 +
+                     LATENCY_MAX_US) {
+        bool enough = sample_count >= LATENCY_TAP_MIN_SAMPLES;
+        if (enough)
+            offsets.input_us = clamp_offset(samples_median());
+        calibration_finish(enough);
+    }
+}
+
+void latency_calibration_start(latency_calibration_t new_mode) {
+    if (mode != LATENCY_CALIBRATION_IDLE || new_mode == LATENCY_CALIBRATION_IDLE)
+        return;
+
+    sample_count = 0;
+    if (new_mode == LATENCY_CALIBRATION_LOOPBACK) {
+        probe_measured = 0;
+        mode = new_mode;
+        loopback_select_output(0);
+    } else {
+        click_start_us = time_us_64() + LATENCY_TAP_INTERVAL_US;
+        clicks_scheduled = 0;
+        mode = new_mode;
+    }
+}
+
+latency_calibration_t HOT_PATH_FUNC(latency_calibration_mode)(void) { return mode; }
+
+/*
+ * Takes over the button while calibrating. In tap-along mode each press is
+ * matched to the nearest click; any hold cancels the calibration.
+ */
+bool latency_calibration_handle_button(button_event_t event, uint64_t time_us) {
+    if (mode == LATENCY_CALIBRATION_IDLE)
+        return false;
+
+    if (event == BUTTON_EVENT_HOLD_RELEASE || event == BUTTON_EVENT_LONG_HOLD_RELEASE ||
+        event == BUTTON_EVENT_VERY_LONG_HOLD_RELEASE) {
+        calibration_finish(false);
+    } else if (mode == LATENCY_CALIBRATION_TAP && event == BUTTON_EVENT_DOWN &&
+               time_us + LATENCY_TAP_INTERVAL_US / 2 >= click_start_us) {
+        uint32_t index = (time_us + LATENCY_TAP_INTERVAL_US / 2 - click_start_us) /
+                         LATENCY_TAP_INTERVAL_US;
+        if (index >= LATENCY_TAP_COUNT_IN && index < LATENCY_TAP_CLICKS &&
+            sample_count < LATENCY_TAP_CLICKS)
+            samples[sample_count++] = (int32_t)(time_us - tap_click_time(index));
+    }
+    return true;
+}
+
+/*
+ * Claims returning probe notes while a loopback run is active, so they are
+ * neither forwarded by MIDI thru nor mistaken for input. Safe from any context.
+ */
+bool latency_calibration_receive(latency_output_t port, uint8_t status, uint8_t data1,
+                                 uint8_t data2) {
+    uint8_t type = status & 0xF0;
+    if (mode != LATENCY_CALIBRATION_LOOPBACK || (status & 0x0F) != (LATENCY_PROBE_STATUS & 0x0F) ||
+        data1 != LATENCY_PROBE_NOTE || (type != 0x80 && type != 0x90))
+        return false;
+
+    if (type == 0x90 && data2 > 0 && port == probe_output && !probe_returned) {
+        probe_return_us = time_us_32();
+        probe_returned = true;
+    }
+    return true;
+}
+
+// Called from the main loop: advances a running calibration.
+void latency_task(void) {
+    if (mode == LATENCY_CALIBRATION_LOOPBACK)
+        loopback_task();
+    else if (mode == LATENCY_CALIBRATION_TAP)
+        tap_task();
+}
@@ -0,0 +1,73 @@
+/*
+ * led_pattern.c
+ *
+ * Status LED patterns. The looper selects a pattern for its state on every
+ * step tick. Steady patterns are set once. Patterns that follow the steps
+ * are evaluated on each tick against the step just started, so the LED
+ * stays lit for that whole step and no timer of its own wakes the core in
+ * between. The driver writes the LED only when its level changes.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "led_pattern.h"
+
+#include <stdbool.h>
+
+#include "drivers/led.h"
+#include "hot_path.h"
+#include "looper.h"
+
+static led_pattern_t selected = LED_PATTERN_OFF;
+static bool engine_started = false;
+
+static bool HOT_PATH_FUNC(led_pattern_follows_steps)(led_pattern_t pattern) {
+    return pattern == LED_PATTERN_BAR || pattern == LED_PATTERN_BEAT ||
+           pattern == LED_PATTERN_TRACK;
+}
+
+// LED level of `pattern` now. The step timer has moved current_step past the step being played.
+static bool HOT_PATH_FUNC(led_pattern_level)(led_pattern_t pattern) {
+    const looper_status_t *status = looper_status_get();
+    uint8_t step = (status->current_step + LOOPER_TOTAL_STEPS - 1) % LOOPER_TOTAL_STEPS;
+
+    switch (pattern) {
+        case LED_PATTERN_ON:
+            return true;
+        case LED_PATTERN_BAR:
+            return (step % (LOOPER_CLICK_DIV * LOOPER_BEATS_PER_BAR)) == 0;
+        case LED_PATTERN_BEAT:
+            return (step % LOOPER_CLICK_DIV) == 0;
+        case LED_PATTERN_TRACK:
+            return status->current_track < status->num_tracks &&
+                   (looper_active_tracks() & TRACK_BIT(status->current_track)) &&
+                   looper_pattern_hit(looper_pattern_get(), status->current_track, step);
+        default:
+            return false;
+    }
+}
+
+// Starts the pattern engine: the LED shows the selected pattern from now on.
+void led_pattern_init(void) {
+    engine_started = true;
+    led_set(led_pattern_level(selected));
+}
+
+/*
+ * Selects the LED pattern; called by the step timer on every step, right
+ * after it has moved on. Selecting the current pattern again does nothing
+ * unless the pattern follows the steps, in which case the LED is set for
+ * the new step.
+ */
+void HOT_PATH_FUNC(led_pattern_set)(led_pattern_t pattern) {
+    if (pattern >= LED_PATTERN_COUNT)
+        return;
+    if (pattern == selected && !led_pattern_follows_steps(pattern))
+        return;
+    selected = pattern;
+    if (engine_started)
+        led_set(led_pattern_level(pattern));
+}
+
+led_pattern_t led_pattern_get(void) { return selected; }
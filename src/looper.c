@@ -23,8 +23,19 @@
 #include "drivers/storage.h"
 #include "drivers/usb_midi.h"
 #include "ghost_note.h"
+#include "groove.h"
+#include "hot_path.h"
+#include "input_log.h"
+#include "latency.h"
+#include "led_pattern.h"
+#include "midi_control.h"
 #include "note_scheduler.h"
+#include "pattern_bank.h"
+#include "profiler.h"
+#include "sysex.h"
 #include "tap_tempo.h"
+#include "tempo.h"
+#include "trace.h"
 
 enum {
     MIDI_CHANNEL1 = 0,
@@ -37,128 +48,224 @@ enum {
     SNARE_DRUM = 38,
     HAND_CLAP = 39,
     CLOSED_HIHAT = 42,
+    LOW_TOM = 45,
     OPEN_HIHAT = 46,
+    MID_TOM = 47,
     CYMBAL = 49,
+    HIGH_TOM = 50,
+    RIDE_CYMBAL = 51,
+    TAMBOURINE = 54,
+    COWBELL = 56,
+    HIGH_CONGA = 62,
+    LOW_CONGA = 64,
+    MARACAS = 70,
 };
 
-static looper_status_t looper_status = {.bpm = LOOPER_DEFAULT_BPM, .state = LOOPER_STATE_WAITING};
-
-static track_t tracks[] = {
-    {"Bass", BASS_DRUM, MIDI_CHANNEL10, {0}, {0}},
-    {"Snare", SNARE_DRUM, MIDI_CHANNEL10, {0}, {0}},
-    {"Hi-hat", CLOSED_HIHAT, MIDI_CHANNEL10, {0}, {0}},
-    {"Hand-clap", HAND_CLAP, MIDI_CHANNEL10, {0}, {0}},
+static looper_status_t looper_status = {.bpm = LOOPER_DEFAULT_BPM,
+                                        .bpm_x100 = LOOPER_DEFAULT_BPM * 100,
+                                        .state = LOOPER_STATE_WAITING,
+                                        .num_tracks = LOOPER_DEFAULT_TRACKS,
+                                        .quantize_strength = 100};
+
+// Tracks beyond looper_status.num_tracks are silent and hidden.
+static track_t tracks[LOOPER_MAX_TRACKS] = {
+    {"Bass", BASS_DRUM, MIDI_CHANNEL10, 0x20, true, TRACK_LFO_KICK},
+    {"Snare", SNARE_DRUM, MIDI_CHANNEL10, 0x25, true, TRACK_LFO_NONE},
+    {"Hi-hat", CLOSED_HIHAT, MIDI_CHANNEL10, 0x30, false, TRACK_LFO_HIHAT},
+    {"Hand-clap", HAND_CLAP, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+#if LOOPER_MAX_TRACKS > 4
+    {"Open hi-hat", OPEN_HIHAT, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+    {"Low tom", LOW_TOM, MIDI_CHANNEL10, 0x25, true, TRACK_LFO_NONE},
+    {"Mid tom", MID_TOM, MIDI_CHANNEL10, 0x25, true, TRACK_LFO_NONE},
+    {"High tom", HIGH_TOM, MIDI_CHANNEL10, 0x25, true, TRACK_LFO_NONE},
+#endif
+#if LOOPER_MAX_TRACKS > 8
+    {"Ride", RIDE_CYMBAL, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_HIHAT},
+    {"Crash", CYMBAL, MIDI_CHANNEL10, 0x20, false, TRACK_LFO_NONE},
+    {"Rim shot", RIM_SHOT, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+    {"Cowbell", COWBELL, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+    {"Tambourine", TAMBOURINE, MIDI_CHANNEL10, 0x30, false, TRACK_LFO_HIHAT},
+    {"Maracas", MARACAS, MIDI_CHANNEL10, 0x30, false, TRACK_LFO_HIHAT},
+    {"High conga", HIGH_CONGA, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+    {"Low conga", LOW_CONGA, MIDI_CHANNEL10, 0x25, false, TRACK_LFO_NONE},
+#endif
 };
-static const size_t NUM_TRACKS = sizeof(tracks) / sizeof(track_t);
+
+/*
+ * Two pattern buffers: `pattern` points at the live one, the other is the
+ * standby buffer a pattern bank is preloaded into. Swapping them switches banks.
+ */
+static looper_pattern_t patterns[2];
+static looper_pattern_t *pattern = &patterns[0];
+static bool swap_at_downbeat = false;  // The standby pattern plays from the coming step 0
+static track_mask_t hold_hits[LOOPER_TOTAL_STEPS];  // Pattern saved on button down (undo)
 
 static uint32_t midi_clock_tick_count = 0;
 static uint64_t midi_clock_last_tick_us = 0;
 
+// What the status LED shows in each state.
+static const led_pattern_t state_led_patterns[] HOT_PATH_DATA = {
+    [LOOPER_STATE_WAITING] = LED_PATTERN_BAR,
+    [LOOPER_STATE_PLAYING] = LED_PATTERN_TRACK,
+    [LOOPER_STATE_RECORDING] = LED_PATTERN_ON,
+    [LOOPER_STATE_TRACK_SWITCH] = LED_PATTERN_TRACK,
+    [LOOPER_STATE_TAP_TEMPO] = LED_PATTERN_BEAT,
+    [LOOPER_STATE_CLEAR_TRACKS] = LED_PATTERN_TRACK,
+    [LOOPER_STATE_SYNC_MUTE] = LED_PATTERN_OFF,
+    [LOOPER_STATE_SYNC_PLAYING] = LED_PATTERN_ON,
+};
+
+static looper_catch_up_t catch_up = LOOPER_CATCH_UP_SKIP;
+static looper_overrun_t overrun;
+
 // Check if the note output destination is ready.
-static bool looper_perform_ready(void) {
+static bool HOT_PATH_FUNC(looper_perform_ready)(void) {
     return usb_midi_is_connected() || ble_midi_is_connected();
 }
 
 // Send a note event to the output destination.
-void looper_perform_note(uint8_t channel, uint8_t note, uint8_t velocity) {
-    usb_midi_send_note(channel, note, velocity);
-    ble_midi_send_note(channel, note, velocity);
+void HOT_PATH_FUNC(looper_perform_note)(uint8_t outputs, uint64_t time_us, uint8_t channel,
+                                        uint8_t note, uint8_t velocity) {
+    if (outputs & LATENCY_OUTPUT_BIT(LATENCY_OUTPUT_USB))
+        usb_midi_send_note(channel, note, velocity);
+    if (outputs & LATENCY_OUTPUT_BIT(LATENCY_OUTPUT_BLE))
+        ble_midi_send_note(time_us, channel, note, velocity);
 }
 
-static void looper_schedule_note_now(uint8_t channel, uint8_t note, uint8_t velocity) {
+static void HOT_PATH_FUNC(looper_schedule_note_now)(uint8_t channel, uint8_t note,
+                                                    uint8_t velocity) {
     uint64_t time_us = time_us_64();
     note_scheduler_schedule_note(time_us, channel, note, velocity);
 }
 
 // Sends a MIDI click at specific steps to indicate rhythm.
-static void send_click_if_needed(void) {
+static void HOT_PATH_FUNC(send_click_if_needed)(void) {
     if ((looper_status.current_step % LOOPER_CLICK_DIV) == 0 && looper_status.current_step == 0)
         looper_schedule_note_now(MIDI_CHANNEL1, RIM_SHOT, 0x20);
     else if ((looper_status.current_step % LOOPER_CLICK_DIV) == 0)
         looper_schedule_note_now(MIDI_CHANNEL1, RIM_SHOT, 0x05);
 }
 
-static uint64_t looper_get_swing_offset_us(uint8_t step_index) {
-    ghost_parameters_t *params = ghost_note_parameters();
-    float swing_ratio = params->swing_ratio;
-    float pair_length = looper_status.step_period_ms * 2.0f;
+// Index of the lowest track in `mask`.
+static inline uint8_t track_mask_first(track_mask_t mask) { return (uint8_t)__builtin_ctz(mask); }
 
-    if (step_index % 2 == 1) {
-        float offset_ms = pair_length * (swing_ratio - 0.5f);
-        return (uint64_t)(offset_ms * 1000.0f);  // ms → us
-    }
-    return 0;
+/*
+ * Schedules recorded hit `record` of track `t` at `time_us` moved by its
+ * microtiming. Only a hit recorded without velocity follows the track's
+ * velocity LFO; a played velocity is kept as it was played.
+ */
+static void HOT_PATH_FUNC(looper_schedule_hit)(uint8_t t, const step_record_t *record,
+                                               uint64_t time_us, bool modulate) {
+    uint32_t period_us = looper_status.step_period_us;
+    time_us += (int32_t)(record->offset * (int32_t)period_us) / LOOPER_MICROTIMING_ONE;
+    uint8_t velocity = record->velocity;
+    if (velocity == 0)
+        velocity = modulate ? ghost_note_modulate_base_velocity(&tracks[t], 0x7f,
+                                                                looper_status.lfo_phase)
+                            : 0x7f;
+    note_scheduler_schedule_track_note(time_us, t, tracks[t].channel, tracks[t].note, velocity);
 }
 
-// Perform all note events for the current step across all tracks.
-// If the current track is active, also update the status LED.
-static void looper_perform_step(void) {
-    ghost_parameters_t *params = ghost_note_parameters();
+// Pattern the next step plays from: the incoming one when the loop wraps into a swap.
+static const looper_pattern_t *HOT_PATH_FUNC(looper_upcoming_pattern)(void) {
+    return swap_at_downbeat ? looper_pattern_standby() : pattern;
+}
 
+/*
+ * Schedules the recorded hits that belong to the tick at `now`: a track's
+ * hit on the current step if it is on time or late, and its hit on the
+ * next step in `upcoming` if that was played early, since that one has to
+ * sound before the next tick. A track may have both.
+ */
+static void HOT_PATH_FUNC(looper_schedule_hits)(track_mask_t tracks_mask,
+                                                const looper_pattern_t *upcoming, uint64_t now,
+                                                uint64_t groove_us, bool modulate) {
+    uint8_t step = looper_status.current_step;
+    uint8_t next = (step + 1) % LOOPER_TOTAL_STEPS;
+    uint64_t next_us = now + looper_status.step_period_us + groove_offset_us(next);
+
+    for (track_mask_t mask = tracks_mask; mask != 0; mask &= mask - 1) {
+        uint8_t t = track_mask_first(mask);
+        if (looper_pattern_hit(pattern, t, step) && pattern->records[step][t].offset >= 0)
+            looper_schedule_hit(t, &pattern->records[step][t], now + groove_us, modulate);
+        if (looper_pattern_hit(upcoming, t, next) && upcoming->records[next][t].offset < 0)
+            looper_schedule_hit(t, &upcoming->records[next][t], next_us, modulate);
+    }
+}
+
+/*
+ * Perform all note events for the current step across all tracks: recorded
+ * hits, then ghost notes except where a fill plays, then fills where no hit
+ * plays.
+ */
+static void HOT_PATH_FUNC(looper_perform_step)(void) {
+    if (latency_calibration_mode() != LATENCY_CALIBRATION_IDLE)
+        return;  // keep the loop out of the calibration click and probes
     uint64_t now = time_us_64();
-    uint64_t swing_offset_us = looper_get_swing_offset_us(looper_status.current_step);
-
-    for (uint8_t i = 0; i < NUM_TRACKS; i++) {
-        bool note_on = tracks[i].pattern[looper_status.current_step];
-        if (note_on) {
-            uint8_t velocity = ghost_note_modulate_base_velocity(i, 0x7f, looper_status.lfo_phase);
-            note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
-                                         velocity);
-
-            if (i == looper_status.current_track)
-                led_set(1);
-        } else if (i == looper_status.current_track) {
-            led_set(0);
-        }
-        uint8_t *ghost_note_velocity = ghost_note_velocity_table();
-        bool ghost_note_on =
-            ((float)tracks[i].ghost_notes[looper_status.current_step].probability / 100.0f) *
-                params->ghost_intensity >
-            (float)tracks[i].ghost_notes[looper_status.current_step].rand_sample / 100.0f;
-
-        if (ghost_note_on && !tracks[i].fill_pattern[looper_status.current_step])
-            note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
-                                         ghost_note_velocity[i]);
-        if (tracks[i].fill_pattern[looper_status.current_step] && !note_on)
-            note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
-                                         0x7f);
+    uint8_t step = looper_status.current_step;
+    uint64_t groove_us = groove_offset_us(step);
+    track_mask_t active = looper_active_tracks();
+    track_mask_t hits = pattern->hits[step] & active;
+    track_mask_t fills = pattern->fills[step] & active;
+    const looper_pattern_t *upcoming = looper_upcoming_pattern();
+
+    looper_schedule_hits((hits | upcoming->hits[(step + 1) % LOOPER_TOTAL_STEPS]) & active,
+                         upcoming, now, groove_us, true);
+
+    for (track_mask_t mask = active & ~fills; mask != 0; mask &= mask - 1) {
+        uint8_t t = track_mask_first(mask);
+        if (ghost_note_is_active(&pattern->ghost_notes[step][t]))
+            note_scheduler_schedule_track_note(now + groove_us, t, tracks[t].channel,
+                                               tracks[t].note, tracks[t].ghost_velocity);
+    }
+    for (track_mask_t mask = fills & ~hits; mask != 0; mask &= mask - 1) {
+        uint8_t t = track_mask_first(mask);
+        note_scheduler_schedule_track_note(now + groove_us, t, tracks[t].channel, tracks[t].note,
+                                           0x7f);
     }
 }
 
 // Perform note events for the current step while recording.
-// In recording mode, the status LED is always turned on.
-static void looper_perform_step_recording(void) {
+static void HOT_PATH_FUNC(looper_perform_step_recording)(void) {
     uint64_t now = time_us_64();
-    uint64_t swing_offset_us = looper_get_swing_offset_us(looper_status.current_step);
-
-    led_set(1);
-    for (uint8_t i = 0; i < NUM_TRACKS; i++) {
-        bool note_on = tracks[i].pattern[looper_status.current_step];
-        if (note_on)
-            note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
-                                         0x7f);
-    }
+    uint8_t step = looper_status.current_step;
+    uint64_t groove_us = groove_offset_us(step);
+    const looper_pattern_t *upcoming = looper_upcoming_pattern();
+    track_mask_t hits = pattern->hits[step] | upcoming->hits[(step + 1) % LOOPER_TOTAL_STEPS];
+
+    looper_schedule_hits(hits & looper_active_tracks(), upcoming, now, groove_us, false);
 }
 
 // Updates the current step index and timestamp based on current loop progress.
-static void looper_advance_step(uint64_t now_us) {
+static void HOT_PATH_FUNC(looper_advance_step)(uint64_t now_us) {
     looper_status.timing.last_step_time_us = now_us;
     looper_status.current_step = (looper_status.current_step + 1) % LOOPER_TOTAL_STEPS;
+    if (looper_status.current_step == 0)
+        looper_status.loop_count++;
+}
+
+// Starts the loop over from step 0; a loop cut short still counts as a loop.
+static void HOT_PATH_FUNC(looper_restart_loop)(void) {
+    if (looper_status.current_step != 0)
+        looper_status.loop_count++;
+    looper_status.current_step = 0;
 }
 
 /*
- * Returns the step index nearest to the stored `button_press_start_us` timestamp.
- * The result is quantized to the nearest step relative to the last tick.
+ * Returns the step index nearest to the `press_us` timestamp,
+ * moved back by the calibrated input latency (what the player hears lags the step clock).
+ * The result is quantized to the nearest step relative to the last tick; the
+ * press's distance from that step is stored in `offset_us`.
  */
-static uint8_t looper_quantize_step() {
+static uint8_t looper_quantize_step(uint64_t press_us, int32_t *offset_us) {
     uint8_t previous_step =
         (looper_status.current_step + LOOPER_TOTAL_STEPS - 1) % LOOPER_TOTAL_STEPS;
-    int64_t delta_us =
-        looper_status.timing.button_press_start_us - looper_status.timing.last_step_time_us;
+    int64_t delta_us = (int64_t)(press_us - looper_status.timing.last_step_time_us) -
+                       latency_offsets()->input_us;
 
-    float step_period_ms = looper_status.step_period_ms;
     // Convert to step offset using rounding (nearest step)
-    int32_t relative_steps = (int32_t)round((double)delta_us / 1000.0 / step_period_ms);
+    int32_t relative_steps = (int32_t)round((double)delta_us / looper_status.step_period_us);
+    *offset_us = (int32_t)(delta_us - (int64_t)relative_steps * looper_status.step_period_us);
     uint8_t estimated_step =
         (previous_step + relative_steps + LOOPER_TOTAL_STEPS) % LOOPER_TOTAL_STEPS;
     return estimated_step;
@@ -166,21 +273,28 @@ static uint8_t looper_quantize_step() {
 
 // Clear all patterns in every track
 static void looper_clear_all_tracks() {
-    for (size_t i = 0; i < NUM_TRACKS; i++) {
-        memset(tracks[i].pattern, 0, sizeof(tracks[i].pattern));
-        memset(tracks[i].ghost_notes, 0, sizeof(tracks[i].ghost_notes));
-        memset(tracks[i].fill_pattern, 0, sizeof(tracks[i].fill_pattern));
+    memset(pattern, 0, sizeof(*pattern));
+    storage_request_store_tracks();
+}
+
+// Removes everything track `t` plays from the live pattern.
+static void looper_clear_track(uint8_t t) {
+    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+        pattern->hits[i] &= ~TRACK_BIT(t);
+        pattern->fills[i] &= ~TRACK_BIT(t);
+        pattern->records[i][t] = (step_record_t){0};
+        pattern->ghost_notes[i][t] = (ghost_note_t){0};
     }
-    storage_store_tracks();
 }
 
 // Routes button events related to tap-tempo mode.
-static tap_result_t taptempo_handle_button_event(button_event_t event) {
-    tap_result_t result = taptempo_handle_event(event);
+static tap_result_t taptempo_handle_button_event(button_event_t event, uint64_t time_us) {
+    tap_result_t result = taptempo_handle_event(event, time_us);
     switch (result) {
         case TAP_PRELIM:
         case TAP_FINAL:
-            looper_update_bpm(taptempo_get_bpm());
+            tempo_cancel();
+            looper_update_bpm_x100(taptempo_get_bpm_x100());
             break;
         case TAP_EXIT: /* leave mode */
             break;
@@ -191,32 +305,104 @@ static tap_result_t taptempo_handle_button_event(button_event_t event) {
 }
 
 // Return a pointer to the current looper status.
-looper_status_t *looper_status_get(void) { return &looper_status; }
+looper_status_t *HOT_PATH_FUNC(looper_status_get)(void) { return &looper_status; }
 
-track_t *looper_tracks_get(size_t *num) {
-    *num = NUM_TRACKS;
+track_t *HOT_PATH_FUNC(looper_tracks_get)(size_t *num) {
+    *num = looper_status.num_tracks;
     return tracks;
 }
 
+// Mask of the tracks in use.
+track_mask_t HOT_PATH_FUNC(looper_active_tracks)(void) {
+    return (track_mask_t)((1u << looper_status.num_tracks) - 1);
+}
+
+// Sets how many tracks are in use; the patterns of the others are kept, but not played.
+void looper_set_num_tracks(uint8_t num_tracks) {
+    if (num_tracks < 1 || num_tracks > LOOPER_MAX_TRACKS)
+        return;
+    looper_status.num_tracks = num_tracks;
+    if (looper_status.current_track >= num_tracks)
+        looper_status.current_track = 0;
+}
+
+looper_pattern_t *HOT_PATH_FUNC(looper_pattern_get)(void) { return pattern; }
+
+// The pattern buffer that is not playing, where the next pattern bank is prepared.
+looper_pattern_t *HOT_PATH_FUNC(looper_pattern_standby)(void) {
+    return (pattern == &patterns[0]) ? &patterns[1] : &patterns[0];
+}
+
+// Makes the standby pattern live. Called by the step timer at a loop start.
+void HOT_PATH_FUNC(looper_pattern_swap)(void) { pattern = looper_pattern_standby(); }
+
 // Update the looper BPM and recalculate the step duration.
-void looper_update_bpm(uint32_t bpm) {
-    looper_status.bpm = bpm;
-    looper_status.step_period_ms = 60000 / (bpm * LOOPER_STEPS_PER_BEAT);
+void looper_update_bpm(uint32_t bpm) { looper_update_bpm_x100(bpm * 100); }
+
+// Same, with a fractional BPM in hundredths (e.g. 12050 = 120.5 BPM).
+void looper_update_bpm_x100(uint32_t bpm_x100) {
+    if (bpm_x100 == 0)
+        return;
+    looper_status.bpm_x100 = bpm_x100;
+    looper_status.bpm = (bpm_x100 + 50) / 100;
+    looper_status.step_period_us =
+        (uint32_t)(60ull * 1000 * 1000 * 100 / ((uint64_t)bpm_x100 * LOOPER_STEPS_PER_BEAT));
+}
+
+// Arms the step timer for one step period from now.
+static void looper_start_step_timer(async_context_t *ctx) {
+    looper_status.timing.next_step_us = time_us_64() + looper_status.step_period_us;
+    async_context_add_at_time_worker_at(ctx, &looper_status.tick_timer,
+                                        from_us_since_boot(looper_status.timing.next_step_us));
+}
+
+/*
+ * Work every step ends with, played or skipped: the LFO, the controller
+ * slew, the ghost engine's bar count, regeneration and fills, and the
+ * groove table they feed.
+ */
+static void HOT_PATH_FUNC(looper_step_maintenance)(void) {
+    looper_status.lfo_phase += LFO_RATE;
+    midi_control_step();
+    ghost_note_maintenance_step();
+    const ghost_parameters_t *params = ghost_note_parameters();
+    groove_update(looper_status.step_period_us, params->swing_ratio_base, params->swing_ratio);
+}
+
+/*
+ * Loop start work, done before the step is performed. The last step decides
+ * whether a bank switch or a SysEx load swaps in at the downbeat, so its
+ * look-ahead takes the early hits of step 0 from the pattern that plays
+ * it; step 0 makes the swap.
+ */
+static void HOT_PATH_FUNC(looper_apply_pending)(void) {
+    if (looper_status.current_step == LOOPER_TOTAL_STEPS - 1) {
+        bool bank_due = pattern_bank_swap_due();
+        bool load_due = sysex_load_due();
+        swap_at_downbeat = bank_due || load_due;
+    } else if (looper_status.current_step == 0) {
+        pattern_bank_apply_pending();
+        sysex_apply_pending_load();
+        swap_at_downbeat = false;
+    }
 }
 
 // Processes the looper's main state machine, called by the step timer.
-void looper_process_state(uint64_t start_us) {
+void HOT_PATH_FUNC(looper_process_state)(uint64_t start_us) {
+    looper_apply_pending();
+    PROFILER_TICK_PHASE(PROFILER_PHASE_PENDING);
+
     bool ready = looper_perform_ready();
-    display_update_looper_status(ready, &looper_status, tracks, NUM_TRACKS);
+    display_update_looper_status(ready, &looper_status, tracks, pattern);
+    PROFILER_TICK_PHASE(PROFILER_PHASE_DISPLAY);
     if (!ready)
         looper_status.state = LOOPER_STATE_WAITING;
     switch (looper_status.state) {
         case LOOPER_STATE_WAITING:
             if (ready) {
                 looper_status.state = LOOPER_STATE_PLAYING;
-                looper_status.current_step = 0;
+                looper_restart_loop();
             }
-            led_set((looper_status.current_step % (LOOPER_CLICK_DIV * 4)) == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_PLAYING:
@@ -228,22 +414,21 @@ void looper_process_state(uint64_t start_us) {
             send_click_if_needed();
             looper_perform_step_recording();
             if (looper_status.recording_step_count >= LOOPER_TOTAL_STEPS) {
-                led_set(0);
                 looper_status.state = LOOPER_STATE_PLAYING;
-                storage_store_tracks();
+                storage_request_store_tracks();
             }
             looper_advance_step(start_us);
             looper_status.recording_step_count++;
             break;
         case LOOPER_STATE_TRACK_SWITCH:
-            looper_status.current_track = (looper_status.current_track + 1) % NUM_TRACKS;
+            looper_status.current_track =
+                (looper_status.current_track + 1) % looper_status.num_tracks;
             looper_schedule_note_now(MIDI_CHANNEL10, OPEN_HIHAT, 0x7f);
             looper_advance_step(start_us);
             looper_status.state = LOOPER_STATE_PLAYING;
             break;
         case LOOPER_STATE_TAP_TEMPO:
             send_click_if_needed();
-            led_set((looper_status.current_step % LOOPER_CLICK_DIV) == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_CLEAR_TRACKS:
@@ -256,70 +441,121 @@ void looper_process_state(uint64_t start_us) {
         default:
             break;
     }
+    led_pattern_set(state_led_patterns[looper_status.state]);
+    PROFILER_TICK_PHASE(PROFILER_PHASE_PERFORM);
 
-    looper_status.lfo_phase += LFO_RATE;
-    ghost_note_maintenance_step();
+    looper_step_maintenance();
+    PROFILER_TICK_PHASE(PROFILER_PHASE_GHOST);
 }
 
-static void looper_process_state_external_clock(uint64_t start_us) {
+static void HOT_PATH_FUNC(looper_process_state_external_clock)(uint64_t start_us) {
+    looper_apply_pending();
+    PROFILER_TICK_PHASE(PROFILER_PHASE_PENDING);
+
     bool ready = looper_perform_ready();
-    display_update_looper_status(ready, &looper_status, tracks, NUM_TRACKS);
+    display_update_looper_status(ready, &looper_status, tracks, pattern);
+    PROFILER_TICK_PHASE(PROFILER_PHASE_DISPLAY);
     if (!ready)
         looper_status.state = LOOPER_STATE_WAITING;
     switch (looper_status.state) {
         case LOOPER_STATE_WAITING:
             if (ready) {
                 looper_status.state = LOOPER_STATE_PLAYING;
-                looper_status.current_step = 0;
+                looper_restart_loop();
             }
-            led_set((looper_status.current_step % (LOOPER_CLICK_DIV * 4)) == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_SYNC_PLAYING:
             looper_perform_step();
-            led_set(1);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_SYNC_MUTE:
-            led_set(0);
             looper_advance_step(start_us);
             break;
         default:
             break;
     }
+    led_pattern_set(state_led_patterns[looper_status.state]);
+    PROFILER_TICK_PHASE(PROFILER_PHASE_PERFORM);
 
-    looper_status.lfo_phase += LFO_RATE;
-    ghost_note_maintenance_step();
+    looper_step_maintenance();
+    PROFILER_TICK_PHASE(PROFILER_PHASE_GHOST);
 }
 
-// Handles button events and updates the looper state accordingly.
-void looper_handle_button_event(button_event_t event) {
+/*
+ * Records a hit at `press_us` on the current track, starting a new recording
+ * if needed. The step keeps the velocity (0 = default) and whatever share of
+ * the distance from the grid the quantize strength leaves.
+ */
+static void looper_record_hit(uint64_t press_us, uint8_t velocity) {
+    uint8_t t = looper_status.current_track;
+
+    if (looper_status.state != LOOPER_STATE_RECORDING) {
+        looper_status.recording_step_count = 0;
+        looper_status.state = LOOPER_STATE_RECORDING;
+        looper_clear_track(t);
+        groove_learn_reset();
+    }
+    int32_t offset_us;
+    uint8_t quantized_step = looper_quantize_step(press_us, &offset_us);
+    pattern->hits[quantized_step] |= TRACK_BIT(t);
+    groove_learn(quantized_step, offset_us, looper_status.step_period_us);
+
+    int32_t kept_us = offset_us * (100 - looper_status.quantize_strength) / 100;
+    int32_t offset = kept_us * LOOPER_MICROTIMING_ONE / (int32_t)looper_status.step_period_us;
+    if (offset > LOOPER_MICROTIMING_ONE / 2 - 1)
+        offset = LOOPER_MICROTIMING_ONE / 2 - 1;
+    if (offset < -LOOPER_MICROTIMING_ONE / 2)
+        offset = -LOOPER_MICROTIMING_ONE / 2;
+    pattern->records[quantized_step][t] = (step_record_t){velocity, (int8_t)offset};
+}
+
+/*
+ * Records an incoming MIDI note-on like a button click, on the track that
+ * plays `note`, keeping its velocity. Ignored unless the looper is playing
+ * or recording on its own clock.
+ */
+void looper_record_note(uint64_t time_us, uint8_t note, uint8_t velocity) {
+    if (looper_status.clock_source != LOOPER_CLOCK_INTERNAL ||
+        (looper_status.state != LOOPER_STATE_PLAYING &&
+         looper_status.state != LOOPER_STATE_RECORDING))
+        return;
+
+    for (uint8_t i = 0; i < looper_status.num_tracks; i++) {
+        if (tracks[i].note != note)
+            continue;
+        if (i != looper_status.current_track) {
+            looper_status.current_track = i;
+            if (looper_status.state == LOOPER_STATE_RECORDING)
+                looper_status.state = LOOPER_STATE_PLAYING;  // new track: start it afresh
+        }
+        looper_record_hit(time_us, velocity);
+        return;
+    }
+}
+
+// Handles button events (stamped with their raw edge time) and updates the looper state.
+void looper_handle_button_event(button_event_t event, uint64_t time_us) {
     track_t *track = &tracks[looper_status.current_track];
+    track_mask_t bit = TRACK_BIT(looper_status.current_track);
 
     switch (event) {
         case BUTTON_EVENT_DOWN:
             // Button pressed: start timing and preview sound
-            looper_status.timing.button_press_start_us = time_us_64();
-            looper_schedule_note_now(track->channel, track->note, 0x7f);
-            // Backup track pattern in case this press becomes a long-press (undo)
-            memcpy(track->hold_pattern, track->pattern, LOOPER_TOTAL_STEPS);
+            looper_status.timing.button_press_start_us = time_us;
+            note_scheduler_schedule_track_note(time_us_64(), looper_status.current_track,
+                                               track->channel, track->note, 0x7f);
+            // Backup pattern in case this press becomes a long-press (undo)
+            memcpy(hold_hits, pattern->hits, sizeof(hold_hits));
             break;
         case BUTTON_EVENT_CLICK_RELEASE:
             // Short press release: quantize and record step
-            if (looper_status.state != LOOPER_STATE_RECORDING) {
-                looper_status.recording_step_count = 0;
-                looper_status.state = LOOPER_STATE_RECORDING;
-                memset(track->pattern, 0, LOOPER_TOTAL_STEPS);
-                memset(track->ghost_notes, 0, sizeof(track->ghost_notes));
-                memset(track->fill_pattern, 0, LOOPER_TOTAL_STEPS);
-                storage_erase_tracks();
-            }
-            uint8_t quantized_step = looper_quantize_step();
-            track->pattern[quantized_step] = true;
+            looper_record_hit(looper_status.timing.button_press_start_us, 0);
             break;
         case BUTTON_EVENT_HOLD_RELEASE:
             // Long press release: revert track and switch
-            memcpy(track->pattern, track->hold_pattern, LOOPER_TOTAL_STEPS);
+            for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++)
+                pattern->hits[i] = (pattern->hits[i] & ~bit) | (hold_hits[i] & bit);
             looper_status.state = LOOPER_STATE_TRACK_SWITCH;
             break;
         case BUTTON_EVENT_LONG_HOLD_RELEASE:
@@ -337,18 +573,90 @@ void looper_handle_button_event(button_event_t event) {
     }
 }
 
-// Runs `looper_process_state()` and reschedules tick timer.
-void looper_handle_tick(async_context_t *ctx, async_at_time_worker_t *worker) {
+void looper_set_catch_up(looper_catch_up_t policy) {
+    if (policy < LOOPER_CATCH_UP_COUNT)
+        catch_up = policy;
+}
+
+looper_catch_up_t looper_catch_up_get(void) { return catch_up; }
+
+const looper_overrun_t *looper_overrun_get(void) { return &overrun; }
+
+void looper_overrun_reset(void) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    overrun = (looper_overrun_t){0};
+    async_context_release_lock(async_timer_async_context());
+}
+
+/*
+ * Passes over the step due at `next_step_us` without playing it. Everything
+ * but the notes still runs: the loop start work that decides what plays
+ * next, so bank switches and song mode keep their place, the length of a
+ * take being recorded, and the step maintenance, so bars, fills and
+ * controller slews keep counting.
+ */
+static void HOT_PATH_FUNC(looper_skip_step)(void) {
+    uint8_t step = looper_status.current_step;
+    looper_apply_pending();
+    looper_advance_step(looper_status.timing.next_step_us);
+    looper_status.timing.next_step_us += tempo_step_duration_us(step);
+    if (looper_status.state == LOOPER_STATE_RECORDING)
+        looper_status.recording_step_count++;
+    looper_step_maintenance();
+    overrun.skipped++;
+}
+
+/*
+ * Called when a step has finished at `now_us`, past the deadline of the
+ * next one: moves the step clock on by the catch-up policy.
+ */
+static void HOT_PATH_FUNC(looper_catch_up)(uint64_t now_us) {
+    looper_timing_t *timing = &looper_status.timing;
+    uint32_t late_steps = 1 + (now_us - timing->next_step_us) / looper_status.step_period_us;
+
+    overrun.overruns++;
+    switch (catch_up) {
+        case LOOPER_CATCH_UP_SKIP:
+            while (timing->next_step_us <= now_us) looper_skip_step();
+            break;
+        case LOOPER_CATCH_UP_BURST:
+            for (; late_steps > LOOPER_CATCH_UP_BURST_STEPS; late_steps--) looper_skip_step();
+            break;
+        case LOOPER_CATCH_UP_STRETCH:
+            overrun.stretched_us += now_us - timing->next_step_us;
+            timing->next_step_us = now_us;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Runs `looper_process_state()` and reschedules tick timer. Steps follow
+ * absolute deadlines, each one step long as given by the tempo engine, so
+ * handler time, sub-millisecond step periods and tempo ramps do not
+ * accumulate as drift. A step that ends past the next deadline is an
+ * overrun, and the catch-up policy decides where the clock goes on from.
+ */
+void HOT_PATH_FUNC(looper_handle_tick)(async_context_t *ctx, async_at_time_worker_t *worker) {
     uint64_t start_us = time_us_64();
+    uint8_t step = looper_status.current_step;
+    if (start_us > looper_status.timing.next_step_us &&
+        start_us - looper_status.timing.next_step_us > overrun.max_late_us)
+        overrun.max_late_us = start_us - looper_status.timing.next_step_us;
 
+    TRACE_BEGIN(TRACE_TICK, step);
+    PROFILER_TICK_BEGIN(looper_status.timing.next_step_us);
     looper_process_state(start_us);
 
-    float step_delay = looper_status.step_period_ms;
-    uint64_t handler_delay_ms = (time_us_64() - start_us) / 1000;
-    uint32_t delay =
-        (handler_delay_ms >= (uint32_t)step_delay) ? 1 : (uint32_t)step_delay - handler_delay_ms;
-
-    async_context_add_at_time_worker_in_ms(ctx, worker, delay);
+    looper_status.timing.next_step_us += tempo_step_duration_us(step);
+    uint64_t now_us = time_us_64();
+    if (looper_status.timing.next_step_us <= now_us)
+        looper_catch_up(now_us);
+    async_context_add_at_time_worker_at(ctx, worker,
+                                        from_us_since_boot(looper_status.timing.next_step_us));
+    PROFILER_TICK_END(step);
+    TRACE_END(TRACE_TICK, step);
 }
 
 static void looper_audit_midi_sync(async_context_t *ctx, async_at_time_worker_t *worker) {
@@ -356,27 +664,30 @@ static void looper_audit_midi_sync(async_context_t *ctx, async_at_time_worker_t
 
     if (looper_status.clock_source == LOOPER_CLOCK_EXTERNAL) {
         if (now_us - midi_clock_last_tick_us > 250000) {
-            looper_status.current_step = 0;
+            looper_restart_loop();
             looper_status.ghost_bar_counter = 0;
             looper_status.lfo_phase = 0;
 
             looper_status.state = LOOPER_STATE_WAITING;
             looper_status.clock_source = LOOPER_CLOCK_INTERNAL;
 
-            async_context_add_at_time_worker_in_ms(ctx, &looper_status.tick_timer,
-                                                   looper_status.step_period_ms);
+            looper_start_step_timer(ctx);
         }
     }
     async_context_add_at_time_worker_in_ms(ctx, worker, 1000);
 }
 
-void looper_handle_midi_tick(void) {
-    uint64_t start_us = time_us_64();
+// Handles one 0xF8 clock tick that occurred at `time_us` (arrival time, or the
+// de-jittered send time for BLE MIDI).
+void looper_handle_midi_tick(uint64_t time_us) {
+    uint64_t start_us = time_us;
     midi_clock_tick_count++;
+    TRACE_INSTANT_AT(time_us, TRACE_MIDI_CLOCK, 0xF8);
     static uint64_t accumulated_tick_interval_us = 0;
 
     if (looper_status.clock_source == LOOPER_CLOCK_INTERNAL) {
         looper_status.clock_source = LOOPER_CLOCK_EXTERNAL;
+        tempo_cancel();  // the clock source owns the tempo now
 
         async_context_t *ctx = async_timer_async_context();
         async_context_remove_at_time_worker(ctx, &looper_status.tick_timer);
@@ -391,10 +702,15 @@ void looper_handle_midi_tick(void) {
     accumulated_tick_interval_us += delta_us;
 
     if (midi_clock_tick_count % 6 == 0) {
+        uint8_t step = looper_status.current_step;
+        TRACE_BEGIN(TRACE_TICK, step);
+        PROFILER_TICK_BEGIN(start_us);
         looper_process_state_external_clock(start_us);
+        PROFILER_TICK_END(step);
+        TRACE_END(TRACE_TICK, step);
 
         float bpm = 60000000.0f / ((accumulated_tick_interval_us / 6) * 24.0f);
-        looper_update_bpm(bpm);
+        looper_update_bpm_x100((uint32_t)(bpm * 100.0f + 0.5f));
         accumulated_tick_interval_us = 0;
     }
 
@@ -402,18 +718,18 @@ void looper_handle_midi_tick(void) {
 }
 
 void looper_handle_midi_start(void) {
-    looper_status.current_step = 0;
+    looper_restart_loop();
     looper_status.ghost_bar_counter = 0;
     looper_status.lfo_phase = 0;
     midi_clock_tick_count = 0;
 }
 
-static void looper_handle_input_internal_clock(button_event_t event) {
+static void looper_handle_input_internal_clock(button_event_t event, uint64_t time_us) {
     if (looper_status.state == LOOPER_STATE_TAP_TEMPO) {
-        if (taptempo_handle_button_event(event) == TAP_EXIT)
+        if (taptempo_handle_button_event(event, time_us) == TAP_EXIT)
             looper_status.state = LOOPER_STATE_PLAYING;
     } else {
-        looper_handle_button_event(event);
+        looper_handle_button_event(event, time_us);
     }
 }
 
@@ -431,9 +747,14 @@ static void looper_handle_input_external_clock(button_event_t event) {
 
 // Poll button events, process them, and update the status LED.
 void looper_handle_input(void) {
-    button_event_t event = button_poll_event();
+    uint64_t time_us = time_us_64();  // kept for BUTTON_EVENT_NONE
+    button_event_t event = button_poll_event(&time_us);
+    if (event != BUTTON_EVENT_NONE)
+        input_log_button(event, time_us);
+    if (latency_calibration_handle_button(event, time_us))
+        event = BUTTON_EVENT_NONE;
     if (looper_status.clock_source == LOOPER_CLOCK_INTERNAL)
-        looper_handle_input_internal_clock(event);
+        looper_handle_input_internal_clock(event, time_us);
     else
         looper_handle_input_external_clock(event);
 
@@ -442,11 +763,11 @@ void looper_handle_input(void) {
 
 void looper_schedule_step_timer(void) {
     looper_update_bpm(LOOPER_DEFAULT_BPM);
+    ghost_note_parameters_sync();
 
     looper_status.tick_timer.do_work = looper_handle_tick;
     async_context_t *ctx = async_timer_async_context();
-    async_context_add_at_time_worker_in_ms(ctx, &looper_status.tick_timer,
-                                           looper_status.step_period_ms);
+    looper_start_step_timer(ctx);
 
     looper_status.sync_timer.do_work = looper_audit_midi_sync;
     async_context_add_at_time_worker_in_ms(ctx, &looper_status.sync_timer, 1000);
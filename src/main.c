@@ -10,12 +10,19 @@
 
 #include "drivers/async_timer.h"
 #include "drivers/ble_midi.h"
+#include "drivers/button.h"
 #include "drivers/led.h"
 #include "drivers/storage.h"
 #include "drivers/usb_midi.h"
+#include "latency.h"
+#include "led_pattern.h"
 #include "looper.h"
+#include "main_tasks.h"
+#include "midi_control.h"
+#include "midi_thru.h"
 #include "note_scheduler.h"
 #include "pico/stdlib.h"
+#include "run_loop.h"
 
 /*
  * Entry point for the Pico MIDI Looper application.
@@ -31,17 +38,21 @@ int main(void) {
     led_init();
 
     storage_load_tracks();
+    latency_init();
 
     // Async timer + sequencer tick setup
     async_timer_init();
+    button_init();
+    led_pattern_init();
     looper_schedule_step_timer();
+    midi_control_init();
     note_scheduler_init();
+    midi_thru_init();
 
     printf("[MAIN] Pico MIDI Looper start\n");
-    while (true) {
-        looper_handle_input();
-        usb_midi_task();
-        note_scheduler_dispatch_pending();
-    }
+    size_t task_count;
+    const run_loop_task_t *tasks = main_tasks_get(&task_count);
+    run_loop_init(tasks, task_count);
+    run_loop_run();
     return 0;
 }
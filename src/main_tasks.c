@@ -0,0 +1,51 @@
+/*
+ * main_tasks.c
+ *
+ * The main loop's task table, shared by the firmware's main() and the
+ * host replay, so a replay polls the same tasks at the same rates.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "main_tasks.h"
+
+#include "console.h"
+#include "drivers/storage.h"
+#include "drivers/usb_midi.h"
+#include "input_log.h"
+#include "latency.h"
+#include "looper.h"
+#include "midi_thru.h"
+#include "pattern_bank.h"
+#include "profiler.h"
+#include "smf_export.h"
+#include "sysex.h"
+#include "trace.h"
+
+static void usb_task(void) { PROFILER_MEASURE(PROFILER_SECTION_USB_MIDI, usb_midi_task()); }
+
+/*
+ * Main loop tasks, in the order they run within a pass. Note dispatch is
+ * not among them: the run loop does it first and after every task. BLE
+ * needs no task, the CYW43 async context services it in the background.
+ * The streaming tasks run on every pass while they have lines to send.
+ */
+static const run_loop_task_t tasks[] = {
+    {"usb_midi", usb_task, usb_midi_task_ready, 250, 1000},
+    {"input", looper_handle_input, NULL, 1000, 1000},
+    {"midi_thru", midi_thru_task, midi_thru_pending, 100, 1000},
+    {"sysex", sysex_task, NULL, 1000, 1000},
+    {"latency", latency_task, NULL, 1000, 1000},
+    {"bank", pattern_bank_task, NULL, 1000, 1000},
+    {"storage", storage_task, NULL, 10000, 10000},
+    {"console", console_task, NULL, 10000, 10000},
+    {"trace", trace_task, trace_dumping, 0, 10000},
+    {"input_log", input_log_task, input_log_dumping, 0, 10000},
+    {"smf", smf_export_task, smf_export_busy, 0, 10000},
+};
+
+const run_loop_task_t *main_tasks_get(size_t *count) {
+    *count = sizeof(tasks) / sizeof(tasks[0]);
+    return tasks;
+}
@@ -0,0 +1,291 @@
+/*
+ * midi_control.c
+ *
+ * MIDI control surface for the ghost parameters, BPM and swing.
+ * Accepts the original 7-bit CC70-80, 14-bit CC pairs and NRPN.
+ *
+ * Incoming messages only store a 14-bit target; nothing is converted or
+ * recomputed per message. Once per step, midi_control_step() slews each
+ * current value towards its target in fixed point and writes only the
+ * parameters that actually moved, so a fast knob sweep costs a handful of
+ * integer operations per step on the timing path.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "midi_control.h"
+
+#include "ghost_note.h"
+#include "groove.h"
+#include "hot_path.h"
+#include "latency.h"
+#include "looper.h"
+#include "midi_thru.h"
+#include "tempo.h"
+
+#define CONTROL_MAX 16383          // 14-bit full scale
+#define CONTROL_FRACTION_BITS 8    // extra slew resolution below 1 LSB
+#define CONTROL_SLEW_SHIFT 1       // close half of the remaining distance per step
+#define NRPN_NULL 0x7F
+
+enum {
+    MIDI_CC_DATA_ENTRY_MSB = 6,
+    MIDI_CC_14BIT_MSB_BASE = 14,  // CC14-31: MSB of the 14-bit pairs
+    MIDI_CC_DATA_ENTRY_LSB = 38,
+    MIDI_CC_14BIT_LSB_BASE = 46,  // CC46-63: LSB of the 14-bit pairs
+    MIDI_CC_SOUND_CONTROLLER1 = 70,
+    MIDI_CC_SOUND_CONTROLLER11 = 80,
+    MIDI_CC_GENERAL_PURPOSE6 = 81,
+    MIDI_CC_GENERAL_PURPOSE7 = 82,
+    MIDI_CC_GENERAL_PURPOSE8 = 83,
+    MIDI_CC_NRPN_LSB = 98,
+    MIDI_CC_NRPN_MSB = 99,
+    MIDI_CC_RPN_LSB = 100,
+    MIDI_CC_RPN_MSB = 101,
+};
+_Static_assert(MIDI_CC_14BIT_MSB_BASE + MIDI_CONTROL_COUNT <= 32 &&
+                   MIDI_CC_14BIT_LSB_BASE + MIDI_CONTROL_COUNT <= 64,
+               "the 14-bit pairs must end at CC31 and CC63");
+
+typedef struct {
+    float min;
+    float max;
+    bool smooth;     // slew towards the target, or jump (integer parameters)
+    bool raw_7bit;   // legacy 7-bit CC carries the value itself, not a 0-127 scale
+} control_range_t;
+
+static const control_range_t ranges[MIDI_CONTROL_COUNT] HOT_PATH_DATA = {
+    [MIDI_CONTROL_GHOST_INTENSITY] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_EUCLID_K_MAX] = {1.0f, 16.0f, false, true},
+    [MIDI_CONTROL_EUCLID_K_SUFFICIENT] = {0.0f, 16.0f, false, true},
+    [MIDI_CONTROL_EUCLID_K_INTENSITY] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_EUCLID_PROBABILITY] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_BOUNDARY_BEFORE] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_BOUNDARY_AFTER] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_FILL_START_MEAN] = {0.0f, 32.0f, true, false},
+    [MIDI_CONTROL_FILL_START_SD] = {0.0f, 16.0f, true, false},
+    [MIDI_CONTROL_FILL_PROBABILITY] = {0.0f, 1.0f, true, false},
+    [MIDI_CONTROL_FILL_INTERVAL_BAR] = {0.0f, 16.0f, false, false},
+    [MIDI_CONTROL_BPM] = {40.0f, 240.0f, true, false},
+    [MIDI_CONTROL_SWING] = {0.5f, 0.75f, true, false},
+    [MIDI_CONTROL_TEMPO_APPLY] = {0.0f, 2.0f, false, false},
+    [MIDI_CONTROL_TEMPO_CURVE] = {0.0f, 1.0f, false, false},
+    [MIDI_CONTROL_TEMPO_RAMP_BARS] = {0.0f, TEMPO_MAX_RAMP_BARS, false, false},
+    [MIDI_CONTROL_GROOVE] = {0.0f, GROOVE_COUNT - 1, false, false},
+    [MIDI_CONTROL_QUANTIZE_STRENGTH] = {0.0f, 100.0f, false, false},
+};
+
+static volatile uint16_t target[MIDI_CONTROL_COUNT];
+static uint32_t current[MIDI_CONTROL_COUNT];  // 14-bit value << CONTROL_FRACTION_BITS
+static uint32_t applied[MIDI_CONTROL_COUNT];
+static uint8_t cc14_msb[MIDI_CONTROL_COUNT];
+static uint8_t nrpn_msb = NRPN_NULL;
+static uint8_t nrpn_lsb = NRPN_NULL;
+static uint8_t data_entry_msb = 0;
+
+static uint16_t control_from_value(midi_control_t id, float value) {
+    const control_range_t *r = &ranges[id];
+    float x = (value - r->min) / (r->max - r->min);
+    if (x < 0.0f)
+        x = 0.0f;
+    if (x > 1.0f)
+        x = 1.0f;
+    return (uint16_t)(x * CONTROL_MAX + 0.5f);
+}
+
+static float HOT_PATH_FUNC(control_to_value)(midi_control_t id, uint32_t fixed) {
+    const control_range_t *r = &ranges[id];
+    float x = fixed / (float)(CONTROL_MAX << CONTROL_FRACTION_BITS);
+    return r->min + x * (r->max - r->min);
+}
+
+// Current value of a discrete parameter, rounded to an integer.
+static uint8_t HOT_PATH_FUNC(control_to_index)(midi_control_t id) {
+    return (uint8_t)(control_to_value(id, current[id]) + 0.5f);
+}
+
+static void control_set_target(midi_control_t id, uint16_t value14) {
+    if (id < MIDI_CONTROL_COUNT)
+        target[id] = value14 > CONTROL_MAX ? CONTROL_MAX : value14;
+}
+
+static void control_set_7bit(midi_control_t id, uint8_t value) {
+    const control_range_t *r = &ranges[id];
+    if (r->raw_7bit)
+        control_set_target(id, control_from_value(id, value));
+    else
+        control_set_target(id, (uint16_t)((value * CONTROL_MAX + 63) / 127));
+}
+
+// Seed targets from the live parameters, e.g. at boot or after a SysEx load.
+void midi_control_init(void) {
+    const ghost_parameters_t *p = ghost_note_parameters();
+    float values[MIDI_CONTROL_COUNT] = {
+        [MIDI_CONTROL_GHOST_INTENSITY] = p->ghost_intensity,
+        [MIDI_CONTROL_EUCLID_K_MAX] = p->euclidean.k_max,
+        [MIDI_CONTROL_EUCLID_K_SUFFICIENT] = p->euclidean.k_sufficient,
+        [MIDI_CONTROL_EUCLID_K_INTENSITY] = p->euclidean.k_intensity,
+        [MIDI_CONTROL_EUCLID_PROBABILITY] = p->euclidean.probability,
+        [MIDI_CONTROL_BOUNDARY_BEFORE] = p->boundary.before_probability,
+        [MIDI_CONTROL_BOUNDARY_AFTER] = p->boundary.after_probability,
+        [MIDI_CONTROL_FILL_START_MEAN] = p->fill.start_mean,
+        [MIDI_CONTROL_FILL_START_SD] = p->fill.start_sd,
+        [MIDI_CONTROL_FILL_PROBABILITY] = p->fill.probability,
+        [MIDI_CONTROL_FILL_INTERVAL_BAR] = p->fill.interval_bar,
+        [MIDI_CONTROL_BPM] = looper_status_get()->bpm_x100 / 100.0f,
+        [MIDI_CONTROL_SWING] = p->swing_ratio_base,
+        [MIDI_CONTROL_TEMPO_APPLY] = tempo_settings()->apply,
+        [MIDI_CONTROL_TEMPO_CURVE] = tempo_settings()->curve,
+        [MIDI_CONTROL_TEMPO_RAMP_BARS] = tempo_settings()->ramp_bars,
+        [MIDI_CONTROL_GROOVE] = groove_selected(),
+        [MIDI_CONTROL_QUANTIZE_STRENGTH] = looper_status_get()->quantize_strength,
+    };
+    for (size_t i = 0; i < MIDI_CONTROL_COUNT; i++) {
+        target[i] = control_from_value(i, values[i]);
+        current[i] = applied[i] = (uint32_t)target[i] << CONTROL_FRACTION_BITS;
+    }
+}
+
+// Handles one Control Change; returns false for controllers the looper does not use.
+bool midi_control_handle_cc(uint8_t channel, uint8_t cc, uint8_t value) {
+    (void)channel;
+    if (cc >= MIDI_CC_SOUND_CONTROLLER1 && cc <= MIDI_CC_SOUND_CONTROLLER11) {
+        control_set_7bit(cc - MIDI_CC_SOUND_CONTROLLER1, value);
+    } else if (cc >= MIDI_CC_14BIT_MSB_BASE && cc < MIDI_CC_14BIT_MSB_BASE + MIDI_CONTROL_COUNT) {
+        midi_control_t id = cc - MIDI_CC_14BIT_MSB_BASE;
+        cc14_msb[id] = value;
+        control_set_target(id, value << 7);  // a new MSB clears the LSB
+    } else if (cc >= MIDI_CC_14BIT_LSB_BASE && cc < MIDI_CC_14BIT_LSB_BASE + MIDI_CONTROL_COUNT) {
+        midi_control_t id = cc - MIDI_CC_14BIT_LSB_BASE;
+        control_set_target(id, cc14_msb[id] << 7 | value);
+    } else if (cc == MIDI_CC_NRPN_MSB) {
+        nrpn_msb = value;
+    } else if (cc == MIDI_CC_NRPN_LSB) {
+        nrpn_lsb = value;
+    } else if (cc == MIDI_CC_RPN_MSB || cc == MIDI_CC_RPN_LSB) {
+        nrpn_msb = nrpn_lsb = NRPN_NULL;  // RPN selected: stop routing data entry here
+        return false;
+    } else if (cc == MIDI_CC_DATA_ENTRY_MSB || cc == MIDI_CC_DATA_ENTRY_LSB) {
+        if (nrpn_msb != 0 || nrpn_lsb >= MIDI_CONTROL_COUNT)
+            return false;
+        if (cc == MIDI_CC_DATA_ENTRY_MSB) {
+            data_entry_msb = value;
+            control_set_target(nrpn_lsb, value << 7);
+        } else {
+            control_set_target(nrpn_lsb, data_entry_msb << 7 | value);
+        }
+    } else if (cc == MIDI_CC_GENERAL_PURPOSE6) {  // MIDI thru (0-63 off, 64-127 on)
+        midi_thru_set_enabled(value >= 64);
+    } else if (cc == MIDI_CC_GENERAL_PURPOSE7) {  // latency calibration (64-127 starts)
+        if (value >= 64)
+            latency_calibration_start(LATENCY_CALIBRATION_LOOPBACK);
+    } else if (cc == MIDI_CC_GENERAL_PURPOSE8) {
+        if (value >= 64)
+            latency_calibration_start(LATENCY_CALIBRATION_TAP);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void control_apply(ghost_parameters_t *p, midi_control_t id, float v) {
+    switch (id) {
+        case MIDI_CONTROL_GHOST_INTENSITY:
+            p->ghost_intensity = v;
+            break;
+        case MIDI_CONTROL_EUCLID_K_MAX:
+            p->euclidean.k_max = (uint8_t)(v + 0.5f);
+            if (p->euclidean.k_sufficient > p->euclidean.k_max)
+                p->euclidean.k_sufficient = p->euclidean.k_max;
+            break;
+        case MIDI_CONTROL_EUCLID_K_SUFFICIENT:
+            p->euclidean.k_sufficient = (uint8_t)(v + 0.5f);
+            if (p->euclidean.k_sufficient > p->euclidean.k_max)
+                p->euclidean.k_sufficient = p->euclidean.k_max;
+            break;
+        case MIDI_CONTROL_EUCLID_K_INTENSITY:
+            p->euclidean.k_intensity = v;
+            break;
+        case MIDI_CONTROL_EUCLID_PROBABILITY:
+            p->euclidean.probability = v;
+            break;
+        case MIDI_CONTROL_BOUNDARY_BEFORE:
+            p->boundary.before_probability = v;
+            break;
+        case MIDI_CONTROL_BOUNDARY_AFTER:
+            p->boundary.after_probability = v;
+            break;
+        case MIDI_CONTROL_FILL_START_MEAN:
+            p->fill.start_mean = v;
+            break;
+        case MIDI_CONTROL_FILL_START_SD:
+            p->fill.start_sd = v;
+            break;
+        case MIDI_CONTROL_FILL_PROBABILITY:
+            p->fill.probability = v;
+            break;
+        case MIDI_CONTROL_FILL_INTERVAL_BAR:
+            p->fill.interval_bar = (uint8_t)v;
+            break;
+        case MIDI_CONTROL_SWING:
+            p->swing_ratio_base = v;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Slew every parameter one step towards its target and stage the ones that
+ * moved. Called once per step from the step timer, before the ghost
+ * parameters are synchronised.
+ */
+void HOT_PATH_FUNC(midi_control_step)(void) {
+    ghost_parameters_t *params = NULL;
+
+    for (size_t i = 0; i < MIDI_CONTROL_COUNT; i++) {
+        uint32_t goal = (uint32_t)target[i] << CONTROL_FRACTION_BITS;
+        int32_t diff = (int32_t)(goal - current[i]);
+        if (diff == 0 && current[i] == applied[i])
+            continue;
+
+        bool smooth = ranges[i].smooth && !(i == MIDI_CONTROL_BPM && tempo_is_scheduled());
+        if (!smooth ||
+            (diff < (1 << CONTROL_FRACTION_BITS) && diff > -(1 << CONTROL_FRACTION_BITS)))
+            current[i] = goal;
+        else
+            current[i] += diff >> CONTROL_SLEW_SHIFT;
+
+        if (current[i] == applied[i])
+            continue;
+        applied[i] = current[i];
+
+        float value = control_to_value(i, current[i]);
+        if (i == MIDI_CONTROL_BPM) {
+            if (looper_status_get()->clock_source == LOOPER_CLOCK_INTERNAL)
+                tempo_request_bpm_x100((uint32_t)(value * 100.0f + 0.5f));
+            continue;
+        }
+        if (i == MIDI_CONTROL_GROOVE) {
+            groove_select(control_to_index(MIDI_CONTROL_GROOVE));
+            continue;
+        }
+        if (i == MIDI_CONTROL_QUANTIZE_STRENGTH) {
+            looper_status_get()->quantize_strength = control_to_index(i);
+            continue;
+        }
+        if (i >= MIDI_CONTROL_TEMPO_APPLY) {
+            tempo_configure(control_to_index(MIDI_CONTROL_TEMPO_APPLY),
+                            control_to_index(MIDI_CONTROL_TEMPO_CURVE),
+                            control_to_index(MIDI_CONTROL_TEMPO_RAMP_BARS));
+            continue;
+        }
+        if (params == NULL)
+            params = ghost_note_parameters_edit();
+        control_apply(params, i, value);
+    }
+
+    if (params != NULL)
+        ghost_note_parameters_commit();
+}
@@ -0,0 +1,99 @@
+/*
+ * midi_thru.c
+ *
+ * MIDI thru/merge: forwards incoming channel messages to the USB and BLE
+ * outputs alongside the looper's own notes. Received messages are queued
+ * and drained from the main loop only after due looper notes have been
+ * dispatched, one whole message per USB-MIDI packet, so thru traffic merges
+ * at message boundaries and never delays the scheduled note path. A received
+ * message wakes the main loop, which runs the thru task as soon as the
+ * queue holds anything rather than on its period.
+ *
+ * Added latency is bounded: a queued message that could not be written
+ * within MIDI_THRU_MAX_LATENCY_US is dropped, except note-offs which are
+ * always delivered to avoid stuck notes.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "midi_thru.h"
+
+#include "drivers/ble_midi.h"
+#include "drivers/usb_midi.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+#define MIDI_THRU_QUEUE_SIZE 32  // power of two
+#define MIDI_THRU_BURST 8        // messages written per main-loop pass
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint32_t received_us;
+} thru_message_t;
+
+static thru_message_t queue[MIDI_THRU_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+static critical_section_t queue_cs;
+static bool thru_enabled = MIDI_THRU_DEFAULT_ENABLED;
+static midi_thru_stats_t stats;
+
+static inline bool is_note_off(const thru_message_t *m) {
+    return (m->status & 0xF0) == 0x80 || ((m->status & 0xF0) == 0x90 && m->data2 == 0);
+}
+
+void midi_thru_init(void) { critical_section_init(&queue_cs); }
+
+void midi_thru_set_enabled(bool enabled) { thru_enabled = enabled; }
+
+bool midi_thru_is_enabled(void) { return thru_enabled; }
+
+// Queue a channel message for forwarding. Safe to call from any input context.
+void midi_thru_receive(uint8_t status, uint8_t data1, uint8_t data2) {
+    if (!thru_enabled || status < 0x80 || status >= 0xF0)
+        return;
+
+    critical_section_enter_blocking(&queue_cs);
+    uint8_t next = (queue_head + 1) & (MIDI_THRU_QUEUE_SIZE - 1);
+    if (next == queue_tail) {
+        stats.dropped++;
+    } else {
+        queue[queue_head] = (thru_message_t){status, data1, data2, time_us_32()};
+        queue_head = next;
+    }
+    critical_section_exit(&queue_cs);
+    __sev();  // Wake a main loop waiting in __wfe()
+}
+
+// Messages waiting to be forwarded.
+bool midi_thru_pending(void) { return queue_tail != queue_head; }
+
+// Called from the main loop after note dispatch: drain a bounded burst.
+void midi_thru_task(void) {
+    for (int n = 0; n < MIDI_THRU_BURST && queue_tail != queue_head; n++) {
+        thru_message_t *m = &queue[queue_tail];
+        uint32_t start_us = time_us_32();
+        uint32_t latency_us = start_us - m->received_us;
+
+        if (latency_us > MIDI_THRU_MAX_LATENCY_US && !is_note_off(m)) {
+            stats.dropped++;
+        } else {
+            if (usb_midi_is_connected() && !usb_midi_send_message(m->status, m->data1, m->data2))
+                break;  // endpoint FIFO full; retry on the next pass
+            ble_midi_send_message(time_us_64() - latency_us, m->status, m->data1, m->data2);
+
+            uint32_t write_us = time_us_32() - start_us;
+            if (write_us > stats.max_write_us)
+                stats.max_write_us = write_us;
+            if (latency_us > stats.max_latency_us)
+                stats.max_latency_us = latency_us;
+            stats.forwarded++;
+        }
+        queue_tail = (queue_tail + 1) & (MIDI_THRU_QUEUE_SIZE - 1);
+    }
+}
+
+const midi_thru_stats_t *midi_thru_stats(void) { return &stats; }
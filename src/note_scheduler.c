@@ -14,18 +14,24 @@
  */
 #include "note_scheduler.h"
 
+#include "capture.h"
 #include "drivers/async_timer.h"
+#include "hardware/sync.h"
+#include "hot_path.h"
+#include "latency.h"
 #include "looper.h"
 #include "pico/multicore.h"
 #include "pico/time.h"
-
-#define MAX_SCHEDULED_NOTES 24
+#include "trace.h"
 
 // One-time pending note event to be dispatched from the main loop
 typedef struct {
+    uint64_t time_us;  // scheduled time, carried to timestamped outputs
+    uint8_t outputs;   // LATENCY_OUTPUT_BIT() of the destinations to play on
     uint8_t channel;
     uint8_t note;
     uint8_t velocity;
+    uint8_t track;  // Looper track the note belongs to, or NOTE_SCHEDULER_NO_TRACK
     bool valid;
 } pending_note_t;
 
@@ -35,9 +41,13 @@ typedef struct {
     pending_note_t pending;
 } scheduled_note_slot_t;
 
-static scheduled_note_slot_t scheduled_slots[MAX_SCHEDULED_NOTES];
-static pending_note_t pending_notes[MAX_SCHEDULED_NOTES];
+static scheduled_note_slot_t scheduled_slots[NOTE_SCHEDULER_MAX_NOTES];
+static pending_note_t pending_notes[NOTE_SCHEDULER_MAX_NOTES];
+static pending_note_t dispatch_batch[NOTE_SCHEDULER_MAX_NOTES];  // Main loop only
 static critical_section_t pending_notes_cs;
+static volatile bool notes_pending = false;
+static uint32_t slots_taken = 0;
+static note_scheduler_latency_t dispatch_latency;
 
 // Initialize the note scheduler
 void note_scheduler_init(void) { critical_section_init(&pending_notes_cs); }
@@ -46,53 +56,130 @@ void note_scheduler_init(void) { critical_section_init(&pending_notes_cs); }
  * Worker callback invoked by async_context at the scheduled time.
  * Adds the pending note to the pending_notes to be executed from the main loop.
  */
-static void note_worker_enqueue_pending(async_context_t *ctx, async_at_time_worker_t *worker) {
+static void HOT_PATH_FUNC(note_worker_enqueue_pending)(async_context_t *ctx,
+                                                       async_at_time_worker_t *worker) {
     (void)ctx;
     scheduled_note_slot_t *slot = (scheduled_note_slot_t *)worker;
+    TRACE_INSTANT(TRACE_WORKER, slot->pending.note);
 
     critical_section_enter_blocking(&pending_notes_cs);
-    for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
-        if (!pending_notes[i].valid) {
-            pending_notes[i] = (pending_note_t){slot->pending.channel, slot->pending.note,
-                                                slot->pending.velocity, true};
-            break;
-        }
+    size_t i = 0;
+    while (i < NOTE_SCHEDULER_MAX_NOTES && pending_notes[i].valid) i++;
+    if (i < NOTE_SCHEDULER_MAX_NOTES) {
+        pending_notes[i] = slot->pending;
+        pending_notes[i].valid = true;
+        notes_pending = true;
+    } else {
+        dispatch_latency.lost++;
     }
 
     slot->worker.do_work = NULL;  // mark as unused
+    slots_taken--;
     critical_section_exit(&pending_notes_cs);
+    __sev();  // Wake a main loop waiting in __wfe()
 }
 
-/*
- * Schedule a note to be triggered at a specific absolute time in microseconds.
- * Returns false if the scheduling queue is full.
- */
-bool note_scheduler_schedule_note(uint64_t time_us, uint8_t channel, uint8_t note,
-                                  uint8_t velocity) {
+static bool HOT_PATH_FUNC(note_scheduler_schedule_slot)(uint64_t time_us, uint8_t outputs,
+                                                        uint8_t track, uint8_t channel,
+                                                        uint8_t note, uint8_t velocity) {
     absolute_time_t note_at = to_us_since_boot(time_us);
 
-    for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
+    for (size_t i = 0; i < NOTE_SCHEDULER_MAX_NOTES; i++) {
         if (scheduled_slots[i].worker.do_work == NULL) {
             scheduled_slots[i] = (scheduled_note_slot_t){
-                .pending = {.channel = channel, .note = note, .velocity = velocity},
+                .pending = {.time_us = time_us,
+                            .outputs = outputs,
+                            .channel = channel,
+                            .note = note,
+                            .velocity = velocity,
+                            .track = track},
                 .worker = {.do_work = note_worker_enqueue_pending}};
             async_context_add_at_time_worker_at(async_timer_async_context(),
                                                 &scheduled_slots[i].worker, note_at);
+            if (++slots_taken > dispatch_latency.peak)
+                dispatch_latency.peak = slots_taken;
+            TRACE_INSTANT(TRACE_NOTE_SCHEDULE, note);
             return true;
         }
     }
+    dispatch_latency.refused++;
     return false;
 }
 
-// Called from the main loop to process all pending scheduled notes.
-void note_scheduler_dispatch_pending(void) {
+/*
+ * Schedule a note of looper track `track` to be triggered at a specific
+ * absolute time in microseconds. Each output is delayed by its latency
+ * compensation, so a note may take one slot per output. Returns false if
+ * the scheduling queue is full.
+ */
+bool HOT_PATH_FUNC(note_scheduler_schedule_track_note)(uint64_t time_us, uint8_t track,
+                                                       uint8_t channel, uint8_t note,
+                                                       uint8_t velocity) {
+    uint32_t usb_delay_us = latency_output_delay_us(LATENCY_OUTPUT_USB);
+    uint32_t ble_delay_us = latency_output_delay_us(LATENCY_OUTPUT_BLE);
+
+    if (usb_delay_us == ble_delay_us)
+        return note_scheduler_schedule_slot(time_us + usb_delay_us, LATENCY_OUTPUT_ALL, track,
+                                            channel, note, velocity);
+    bool usb = note_scheduler_schedule_slot(time_us + usb_delay_us,
+                                            LATENCY_OUTPUT_BIT(LATENCY_OUTPUT_USB), track, channel,
+                                            note, velocity);
+    bool ble = note_scheduler_schedule_slot(time_us + ble_delay_us,
+                                            LATENCY_OUTPUT_BIT(LATENCY_OUTPUT_BLE), track, channel,
+                                            note, velocity);
+    return usb && ble;
+}
+
+// Schedule a note that belongs to no track, such as a click.
+bool HOT_PATH_FUNC(note_scheduler_schedule_note)(uint64_t time_us, uint8_t channel, uint8_t note,
+                                                 uint8_t velocity) {
+    return note_scheduler_schedule_track_note(time_us, NOTE_SCHEDULER_NO_TRACK, channel, note,
+                                              velocity);
+}
+
+// True while notes are waiting for note_scheduler_dispatch_pending().
+bool HOT_PATH_FUNC(note_scheduler_pending)(void) { return notes_pending; }
+
+/*
+ * Called from the main loop to process all pending scheduled notes. The due
+ * notes are copied out under the critical section and played after it, so
+ * a slow USB or BLE write never holds off the note workers. Track notes
+ * are also kept in the capture ring, once each, by their USB slot and
+ * without the USB latency compensation.
+ */
+void HOT_PATH_FUNC(note_scheduler_dispatch_pending)(void) {
+    TRACE_BEGIN(TRACE_DISPATCH, 0);
+    size_t count = 0;
     critical_section_enter_blocking(&pending_notes_cs);
-    for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
+    for (size_t i = 0; i < NOTE_SCHEDULER_MAX_NOTES; i++) {
         if (pending_notes[i].valid) {
-            looper_perform_note(pending_notes[i].channel, pending_notes[i].note,
-                                pending_notes[i].velocity);
+            dispatch_batch[count++] = pending_notes[i];
             pending_notes[i].valid = false;
         }
     }
+    notes_pending = false;
     critical_section_exit(&pending_notes_cs);
+
+    uint64_t now_us = time_us_64();
+    for (size_t i = 0; i < count; i++) {
+        const pending_note_t *pending = &dispatch_batch[i];
+        uint32_t late_us = (now_us > pending->time_us) ? now_us - pending->time_us : 0;
+        dispatch_latency.notes++;
+        dispatch_latency.total_us += late_us;
+        if (late_us > dispatch_latency.max_us)
+            dispatch_latency.max_us = late_us;
+        looper_perform_note(pending->outputs, pending->time_us, pending->channel, pending->note,
+                            pending->velocity);
+        if (pending->track != NOTE_SCHEDULER_NO_TRACK &&
+            (pending->outputs & LATENCY_OUTPUT_BIT(LATENCY_OUTPUT_USB)))
+            capture_note(pending->time_us - latency_output_delay_us(LATENCY_OUTPUT_USB),
+                         pending->track, pending->velocity);
+    }
+    TRACE_END(TRACE_DISPATCH, 0);
+}
+
+const note_scheduler_latency_t *note_scheduler_latency_get(void) { return &dispatch_latency; }
+
+void note_scheduler_latency_reset(void) {
+    dispatch_latency = (note_scheduler_latency_t){0};
 }
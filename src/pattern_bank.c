@@ -0,0 +1,228 @@
+/*
+ * pattern_bank.c
+ *
+ * Pattern banks and song mode. Every bank keeps only its per-step track
+ * masks; the playing bank is expanded into the looper's live pattern. A
+ * selected bank is copied into the standby pattern and given its ghost
+ * notes from the main loop, ahead of time, and the step timer merely swaps
+ * the live and standby patterns when the loop wraps, so a switch costs the
+ * downbeat a pointer exchange.
+ *
+ * Song mode walks a small sequence table (bank, loops). The next entry's
+ * bank is requested at the start of the current entry's last loop, which
+ * leaves that whole loop for the preload.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "pattern_bank.h"
+
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "ghost_note.h"
+#include "hot_path.h"
+
+typedef struct {
+    bool playing;
+    uint8_t position;    // Entry being played; PATTERN_BANK_SONG_LENGTH before the first
+    uint8_t loops_left;  // Loops of the entry still to play, including the current one
+} song_state_t;
+
+static pattern_bank_set_t set;
+static song_state_t song;
+static volatile int requested_bank = -1;       // Bank to switch to at the next loop start
+static volatile int standby_bank = -1;         // Bank ready in the standby pattern
+static volatile bool standby_claimed = false;  // Standby filled outside the banks
+static volatile bool swap_due = false;         // Standby swaps in at the coming loop start
+
+pattern_bank_set_t *pattern_bank_set(void) { return &set; }
+
+// Stores the hits of `pattern` as bank `bank`.
+void pattern_bank_pack(uint8_t bank, const looper_pattern_t *pattern) {
+    memcpy(set.hits[bank], pattern->hits, sizeof(set.hits[bank]));
+}
+
+// Loads bank `bank` into `pattern`, dropping its recorded detail and fills.
+void pattern_bank_unpack(uint8_t bank, looper_pattern_t *pattern) {
+    memcpy(pattern->hits, set.hits[bank], sizeof(pattern->hits));
+    memset(pattern->fills, 0, sizeof(pattern->fills));
+    memset(pattern->records, 0, sizeof(pattern->records));
+}
+
+uint8_t pattern_bank_current(void) { return set.current; }
+
+/*
+ * Replaces the hits of bank `bank`. The playing bank takes them at once,
+ * with new ghost notes, and a preload of the bank is made again.
+ */
+void pattern_bank_replace(uint8_t bank, const track_mask_t *hits) {
+    if (bank >= PATTERN_BANK_COUNT)
+        return;
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    memcpy(set.hits[bank], hits, sizeof(set.hits[bank]));
+    if (bank == set.current) {
+        size_t num_tracks;
+        looper_tracks_get(&num_tracks);
+        looper_pattern_t *pattern = looper_pattern_get();
+        pattern_bank_unpack(bank, pattern);
+        for (size_t t = 0; t < num_tracks; t++) ghost_note_create(pattern, t);
+    }
+    if (bank == standby_bank)
+        standby_bank = -1;
+    async_context_release_lock(async_timer_async_context());
+}
+
+// Bank waiting for the next loop start, or -1.
+int pattern_bank_pending(void) { return requested_bank; }
+
+// A request for the bank that plays the coming loop is no switch.
+static void HOT_PATH_FUNC(bank_request)(uint8_t bank) {
+    uint8_t upcoming = swap_due ? (uint8_t)standby_bank : set.current;
+    requested_bank = (bank == upcoming) ? -1 : bank;
+}
+
+// Switches to `bank` at the next loop start. Manual selection ends song mode.
+void pattern_bank_select(uint8_t bank) {
+    if (bank >= PATTERN_BANK_COUNT)
+        return;
+    song.playing = false;
+    bank_request(bank);
+}
+
+// Program Change 0-15 selects a bank; returns false for programs beyond the banks.
+bool pattern_bank_handle_program_change(uint8_t channel, uint8_t program) {
+    (void)channel;
+    if (program >= PATTERN_BANK_COUNT)
+        return false;
+    pattern_bank_select(program);
+    return true;
+}
+
+static uint8_t HOT_PATH_FUNC(song_next_position)(uint8_t position) {
+    uint8_t next = position + 1;
+    if (next >= PATTERN_BANK_SONG_LENGTH || set.song[next].loops == 0)
+        return 0;
+    return next;
+}
+
+// Replaces the song table; entries after the first with no loops or an unknown bank are dropped.
+void pattern_bank_song_set(const pattern_bank_song_entry_t *entries, uint8_t count) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    memset(set.song, 0, sizeof(set.song));
+    for (uint8_t i = 0; i < count && i < PATTERN_BANK_SONG_LENGTH; i++) {
+        if (entries[i].loops == 0 || entries[i].bank >= PATTERN_BANK_COUNT)
+            break;
+        set.song[i] = entries[i];
+    }
+    song.playing = false;
+    async_context_release_lock(async_timer_async_context());
+}
+
+// Plays the song table from the top; the first entry starts at the next loop start.
+void pattern_bank_song_start(void) {
+    if (set.song[0].loops == 0)
+        return;
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    song = (song_state_t){.playing = true, .position = PATTERN_BANK_SONG_LENGTH, .loops_left = 1};
+    bank_request(set.song[0].bank);
+    async_context_release_lock(async_timer_async_context());
+}
+
+void pattern_bank_song_stop(void) { song.playing = false; }
+
+bool pattern_bank_song_playing(void) { return song.playing; }
+
+uint8_t pattern_bank_song_position(void) { return song.position; }
+
+/*
+ * Called from the main loop: builds the requested bank in the standby
+ * pattern, ghost notes included. Holds the async context lock so the step
+ * timer never sees it half done, and leaves a standby that is due to swap in
+ * alone.
+ */
+void pattern_bank_task(void) {
+    int bank = requested_bank;
+    if (bank < 0 || bank == standby_bank || standby_claimed || swap_due)
+        return;
+
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    if (swap_due) {  // decided while the lock was being taken
+        async_context_release_lock(async_timer_async_context());
+        return;
+    }
+    size_t num_tracks;
+    looper_tracks_get(&num_tracks);
+    looper_pattern_t *standby = looper_pattern_standby();
+    pattern_bank_unpack(bank, standby);
+    for (size_t t = 0; t < num_tracks; t++) ghost_note_create(standby, t);
+    standby_bank = bank;
+    async_context_release_lock(async_timer_async_context());
+}
+
+/*
+ * Hands the standby pattern to a caller that fills it itself, such as a
+ * SysEx load. Ends song mode and drops any bank switch in flight; preloads
+ * wait until pattern_bank_swap_claimed() has put the pattern in play. Call
+ * with the async context lock held.
+ */
+looper_pattern_t *pattern_bank_claim_standby(void) {
+    song.playing = false;
+    requested_bank = standby_bank = -1;
+    standby_claimed = true;
+    swap_due = false;
+    return looper_pattern_standby();
+}
+
+/*
+ * Called by the step timer on a loop boundary: plays the claimed standby
+ * pattern in place of the current bank, which takes its hits.
+ */
+void HOT_PATH_FUNC(pattern_bank_swap_claimed)(void) {
+    looper_pattern_swap();
+    pattern_bank_pack(set.current, looper_pattern_get());
+    standby_claimed = false;
+}
+
+/*
+ * Called by the step timer on the last step of the loop: decides whether
+ * the preloaded bank swaps in at the coming loop start, so the early hits
+ * of its downbeat can be scheduled from it. A switch waits while a
+ * recording is in progress, or if the preload has not finished yet.
+ */
+bool HOT_PATH_FUNC(pattern_bank_swap_due)(void) {
+    swap_due = requested_bank >= 0 && standby_bank == requested_bank &&
+               looper_status_get()->state != LOOPER_STATE_RECORDING;
+    return swap_due;
+}
+
+/*
+ * Called by the step timer right before step 0 is performed: swaps in the
+ * bank decided on the last step and advances song mode. The outgoing
+ * pattern is written back to its bank here, so takes recorded up to the
+ * swap are kept. A take started within the last step holds the switch
+ * back a loop. While a switch waits, song mode plays the entry's last loop
+ * again, and the next entry starts with the switch.
+ */
+void HOT_PATH_FUNC(pattern_bank_apply_pending)(void) {
+    if (swap_due && looper_status_get()->state != LOOPER_STATE_RECORDING) {
+        pattern_bank_pack(set.current, looper_pattern_get());
+        looper_pattern_swap();
+        set.current = standby_bank;
+        if (requested_bank == standby_bank)
+            requested_bank = -1;
+        standby_bank = -1;
+    }
+    swap_due = false;
+    bool switching = requested_bank >= 0;
+    if (!song.playing || (switching && song.loops_left == 1))
+        return;
+
+    if (--song.loops_left == 0) {
+        song.position = song_next_position(song.position);
+        song.loops_left = set.song[song.position].loops;
+    }
+    if (song.loops_left == 1)
+        bank_request(set.song[song_next_position(song.position)].bank);
+}
@@ -0,0 +1,147 @@
+/*
+ * profiler.c
+ *
+ * Step tick profiler. The tick handler marks the end of each of its phases;
+ * the time since the previous mark is charged to that phase. Finished ticks
+ * update running statistics, and the slowest ones are kept, with their
+ * phase breakdown, in a small table that always drops its fastest entry.
+ * The main loop tasks that share the core with the tick are timed as a
+ * whole. Times are in microseconds from the system timer.
+ *
+ * With PROFILER_ENABLED at 0 the PROFILER_ macros expand to the bare code
+ * and only the console entry points remain.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "hot_path.h"
+#include "note_scheduler.h"
+
+#if PROFILER_ENABLED
+
+static const char *const phase_names[PROFILER_PHASE_COUNT] = {
+    "pending", "display", "perform", "ghost", "timer",
+};
+
+static const char *const section_names[PROFILER_SECTION_COUNT] = {"dispatch", "usb_midi"};
+
+static profiler_tick_t tick;          // Tick being measured
+static uint32_t tick_mark_us;         // End of the last phase marked
+static profiler_stats_t tick_stats;
+static uint32_t tick_late_max_us;
+static profiler_tick_t worst[PROFILER_WORST_COUNT];  // Unordered; empty slots have total 0
+static profiler_stats_t section_stats[PROFILER_SECTION_COUNT];
+
+static void stats_add(profiler_stats_t *stats, uint32_t elapsed_us) {
+    stats->count++;
+    stats->total_us += elapsed_us;
+    if (elapsed_us > stats->max_us)
+        stats->max_us = elapsed_us;
+}
+
+// Called by the step timer on entry; `deadline_us` is when the step was due.
+void HOT_PATH_FUNC(profiler_tick_begin)(uint64_t deadline_us) {
+    uint64_t now_us = time_us_64();
+    memset(&tick, 0, sizeof(tick));
+    tick.start_us = (uint32_t)now_us;
+    tick.late_us = (now_us > deadline_us) ? (uint32_t)(now_us - deadline_us) : 0;
+    tick_mark_us = tick.start_us;
+}
+
+// Charges the time since the previous mark to `phase`.
+void HOT_PATH_FUNC(profiler_tick_phase)(profiler_phase_t phase) {
+    uint32_t now_us = time_us_32();
+    uint32_t elapsed_us = now_us - tick_mark_us;
+    tick.phase_us[phase] += (elapsed_us > UINT16_MAX) ? UINT16_MAX : elapsed_us;
+    tick_mark_us = now_us;
+}
+
+// Closes the tick of step `step`, charging the rest to the timer phase.
+void HOT_PATH_FUNC(profiler_tick_end)(uint8_t step) {
+    profiler_tick_phase(PROFILER_PHASE_TIMER);
+    tick.step = step;
+    tick.total_us = tick_mark_us - tick.start_us;
+    stats_add(&tick_stats, tick.total_us);
+    if (tick.late_us > tick_late_max_us)
+        tick_late_max_us = tick.late_us;
+
+    size_t fastest = 0;
+    for (size_t i = 1; i < PROFILER_WORST_COUNT; i++) {
+        if (worst[i].total_us < worst[fastest].total_us)
+            fastest = i;
+    }
+    if (tick.total_us > worst[fastest].total_us)
+        worst[fastest] = tick;
+}
+
+void HOT_PATH_FUNC(profiler_section_record)(profiler_section_t section, uint32_t elapsed_us) {
+    stats_add(&section_stats[section], elapsed_us);
+}
+
+void profiler_reset(void) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    memset(&tick_stats, 0, sizeof(tick_stats));
+    tick_late_max_us = 0;
+    memset(worst, 0, sizeof(worst));
+    memset(section_stats, 0, sizeof(section_stats));
+    async_context_release_lock(async_timer_async_context());
+}
+
+static void stats_print(const char *name, const profiler_stats_t *stats) {
+    printf("[PROF] %-8s n=%lu avg=%luus max=%luus\n", name, (unsigned long)stats->count,
+           (unsigned long)(stats->count ? stats->total_us / stats->count : 0),
+           (unsigned long)stats->max_us);
+}
+
+// Prints the statistics and the worst ticks, slowest first.
+void profiler_dump(void) {
+    profiler_stats_t ticks;
+    uint32_t late_max_us;
+    profiler_tick_t table[PROFILER_WORST_COUNT];
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    ticks = tick_stats;
+    late_max_us = tick_late_max_us;
+    memcpy(table, worst, sizeof(table));
+    async_context_release_lock(async_timer_async_context());
+
+    stats_print("tick", &ticks);
+    printf("[PROF] %-8s max=%luus\n", "late", (unsigned long)late_max_us);
+    const note_scheduler_latency_t *notes = note_scheduler_latency_get();
+    printf("[PROF] %-8s refused=%lu lost=%lu\n", "notes", (unsigned long)notes->refused,
+           (unsigned long)notes->lost);
+    for (size_t s = 0; s < PROFILER_SECTION_COUNT; s++)
+        stats_print(section_names[s], &section_stats[s]);
+
+    for (size_t rank = 0; rank < PROFILER_WORST_COUNT; rank++) {
+        size_t slowest = rank;
+        for (size_t i = rank + 1; i < PROFILER_WORST_COUNT; i++) {
+            if (table[i].total_us > table[slowest].total_us)
+                slowest = i;
+        }
+        profiler_tick_t t = table[slowest];
+        table[slowest] = table[rank];
+        if (t.total_us == 0)
+            break;
+        printf("[PROF] #%u at=%lu step=%2u late=%lu total=%lu", (unsigned)rank + 1,
+               (unsigned long)t.start_us, t.step, (unsigned long)t.late_us,
+               (unsigned long)t.total_us);
+        for (size_t p = 0; p < PROFILER_PHASE_COUNT; p++)
+            printf(" %s=%u", phase_names[p], t.phase_us[p]);
+        printf("\n");
+    }
+}
+
+#else
+
+void profiler_reset(void) {}
+
+void profiler_dump(void) { printf("[PROF] built without PROFILER_ENABLED\n"); }
+
+#endif
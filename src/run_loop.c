@@ -0,0 +1,114 @@
+/*
+ * run_loop.c
+ *
+ * Cooperative main loop. Due notes come first: they are dispatched at the
+ * top of every pass and again after each task, so a slow task delays a
+ * note by at most its own run. The other tasks are polled on a period and
+ * rate-bounded, and a task with a `ready` check runs as soon as it has
+ * work. When a pass runs nothing and no note is waiting, the core sleeps
+ * in __wfe() until the next task is due; the note workers and the USB,
+ * BLE and button interrupts end the sleep early.
+ *
+ * In busy mode every task runs on every pass and the core never sleeps,
+ * as the loop did before, so the two can be compared on the device.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "run_loop.h"
+
+#include <stdio.h>
+
+#include "note_scheduler.h"
+#include "pico/time.h"
+#include "profiler.h"
+
+static const run_loop_task_t *loop_tasks;
+static size_t loop_task_count;
+static uint64_t last_run_us[RUN_LOOP_MAX_TASKS];
+static run_loop_stats_t stats;
+static bool busy = false;
+
+void run_loop_init(const run_loop_task_t *tasks, size_t count) {
+    loop_tasks = tasks;
+    loop_task_count = (count < RUN_LOOP_MAX_TASKS) ? count : RUN_LOOP_MAX_TASKS;
+    run_loop_stats_reset();
+}
+
+static void run_loop_dispatch(void) {
+    if (busy || note_scheduler_pending())
+        PROFILER_MEASURE(PROFILER_SECTION_DISPATCH, note_scheduler_dispatch_pending());
+}
+
+// One pass: runs the tasks that are due, or sleeps until one is.
+void run_loop_poll(void) {
+    stats.iterations++;
+    run_loop_dispatch();
+
+    bool ran = false;
+    uint64_t wake_us = UINT64_MAX;
+    for (size_t i = 0; i < loop_task_count; i++) {
+        const run_loop_task_t *task = &loop_tasks[i];
+        uint64_t now_us = time_us_64();
+        uint64_t elapsed_us = now_us - last_run_us[i];
+        bool ready = task->ready != NULL && task->ready();
+        if (busy || (elapsed_us >= task->min_interval_us &&
+                     (elapsed_us >= task->interval_us || ready))) {
+            last_run_us[i] = now_us;
+            task->run();
+            stats.runs[i]++;
+            ran = true;
+            run_loop_dispatch();
+            continue;
+        }
+        uint64_t due_us = last_run_us[i] + (ready ? task->min_interval_us : task->interval_us);
+        if (due_us < wake_us)
+            wake_us = due_us;
+    }
+
+    if (busy || ran || note_scheduler_pending())
+        return;
+    uint64_t sleep_start_us = time_us_64();
+    best_effort_wfe_or_timeout(from_us_since_boot(wake_us));
+    stats.sleeps++;
+    stats.sleep_us += time_us_64() - sleep_start_us;
+}
+
+void run_loop_run(void) {
+    while (true) run_loop_poll();
+}
+
+// Busy mode polls every task on every pass and never sleeps, as the old loop did.
+void run_loop_set_busy(bool value) { busy = value; }
+
+bool run_loop_busy(void) { return busy; }
+
+const run_loop_stats_t *run_loop_stats_get(void) { return &stats; }
+
+void run_loop_stats_reset(void) {
+    stats = (run_loop_stats_t){.since_us = time_us_64()};
+    note_scheduler_latency_reset();
+}
+
+// Prints the loop statistics and the note dispatch latency over the same span.
+void run_loop_dump(void) {
+    uint64_t span_us = time_us_64() - stats.since_us;
+    uint32_t per_second = (span_us > 0) ? (uint32_t)(stats.iterations * 1000000ull / span_us) : 0;
+    uint32_t sleep_permille = (span_us > 0) ? (uint32_t)(stats.sleep_us * 1000 / span_us) : 0;
+    printf("[LOOP] mode=%s iterations=%lu per_s=%lu sleeps=%lu asleep=%lu.%lu%%\n",
+           busy ? "busy" : "sleep", (unsigned long)stats.iterations, (unsigned long)per_second,
+           (unsigned long)stats.sleeps, (unsigned long)(sleep_permille / 10),
+           (unsigned long)(sleep_permille % 10));
+
+    const note_scheduler_latency_t *latency = note_scheduler_latency_get();
+    uint32_t avg_us = (latency->notes > 0) ? (uint32_t)(latency->total_us / latency->notes) : 0;
+    printf("[LOOP] dispatch notes=%lu avg_late=%luus max_late=%luus refused=%lu lost=%lu "
+           "peak=%lu/%u\n",
+           (unsigned long)latency->notes, (unsigned long)avg_us, (unsigned long)latency->max_us,
+           (unsigned long)latency->refused, (unsigned long)latency->lost,
+           (unsigned long)latency->peak, (unsigned)NOTE_SCHEDULER_MAX_NOTES);
+
+    for (size_t i = 0; i < loop_task_count; i++)
+        printf("[LOOP] %-10s runs=%lu\n", loop_tasks[i].name, (unsigned long)stats.runs[i]);
+}
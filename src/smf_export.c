@@ -0,0 +1,401 @@
+/*
+ * smf_export.c
+ *
+ * Exports the current loop as a Type-0 Standard MIDI File, rendered through
+ * the ghost engine as it would play: recorded hits with their velocity and
+ * microtiming, LFO velocities, ghost notes, fills and swing.
+ *
+ * The export never touches what is playing. The live pattern is copied,
+ * and the copy is advanced bar by bar with ghost_note_render_step(), by a
+ * ghost engine of its own: a snapshot of the parameters and a random state
+ * taken with the copy, so rendering holds no lock. Only the ghost and fill
+ * decisions of every step are kept, as two track masks.
+ * Everything else about a note follows from the pattern, so the file is
+ * generated twice from the masks, once to measure the track chunk for its
+ * header and once to stream it. Each of these runs a bar per main loop
+ * pass, so the main loop is never held up for long and the file is never
+ * in RAM. It goes out over the CDC console as hex lines;
+ * tools/smf_extract.py turns a captured console log back into a .mid file.
+ *
+ * The notes can also come from the capture ring (see capture.c) instead,
+ * as they were played, in which case nothing is rendered and the ring is
+ * held until the export is done.
+ *
+ *   [SMF] begin bars=<n> bytes=<n>
+ *   [SMF] <up to 32 bytes of the file in hex>
+ *   [SMF] end
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "smf_export.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "drivers/async_timer.h"
+#include "ghost_note.h"
+#include "groove.h"
+#include "looper.h"
+
+#define SMF_EXPORT_BAR_STEPS (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT)
+#define SMF_EXPORT_MAX_STEPS (SMF_EXPORT_MAX_BARS * SMF_EXPORT_BAR_STEPS)
+#define SMF_EXPORT_STEP_TICKS (SMF_EXPORT_PPQN / LOOPER_STEPS_PER_BEAT)
+#define SMF_EXPORT_GATE_TICKS (SMF_EXPORT_STEP_TICKS / 2)
+#define SMF_EXPORT_LINE_BYTES 32
+#define SMF_EXPORT_WINDOW_EVENTS (LOOPER_MAX_TRACKS * 8)  // Events sounding within one step
+/*
+ * Notes stay within a few steps of their own: swing and microtiming move
+ * them by less than two steps, and the gate adds half a step.
+ */
+#define SMF_EXPORT_SPREAD_BEFORE 2
+#define SMF_EXPORT_SPREAD_AFTER 1
+
+typedef struct {
+    int32_t tick;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} smf_event_t;
+
+typedef enum {
+    SMF_EXPORT_IDLE = 0,
+    SMF_EXPORT_RENDER,  // ghost and fill decisions, a bar per pass
+    SMF_EXPORT_COUNT,   // measuring the track chunk, a bar per pass
+    SMF_EXPORT_HEADER,
+    SMF_EXPORT_EVENTS,
+} smf_export_state_t;
+
+static looper_pattern_t render;  // Copy of the live pattern advanced by the export
+static ghost_render_t ghost;     // Ghost engine of the copy
+static track_mask_t ghost_plays[SMF_EXPORT_MAX_STEPS];
+static track_mask_t fill_plays[SMF_EXPORT_MAX_STEPS];
+static track_t tracks[LOOPER_MAX_TRACKS];
+static track_mask_t active;
+static uint32_t bpm_x100;
+
+static smf_export_state_t state = SMF_EXPORT_IDLE;
+static bool from_capture;
+static uint32_t capture_start;  // Capture position of the first exported step
+static uint16_t capture_notes;  // Notes held in the capture ring
+static uint16_t capture_cursor;  // Oldest capture note the current window may need
+static uint8_t total_bars;
+static uint16_t total_steps;
+static uint16_t rendered_steps;
+static uint8_t bar_counter;
+static uint16_t window;  // Step whose tick range is written next
+static int32_t last_tick;
+static bool counting;
+static uint32_t counted_bytes;
+static uint8_t line[SMF_EXPORT_LINE_BYTES];
+static uint8_t line_length;
+static smf_event_t events[SMF_EXPORT_WINDOW_EVENTS];
+
+static void smf_flush(void) {
+    if (line_length == 0)
+        return;
+    printf("[SMF] ");
+    for (uint8_t i = 0; i < line_length; i++) printf("%02x", line[i]);
+    printf("\n");
+    line_length = 0;
+}
+
+static void smf_put(uint8_t byte) {
+    if (counting) {
+        counted_bytes++;
+        return;
+    }
+    line[line_length++] = byte;
+    if (line_length == SMF_EXPORT_LINE_BYTES)
+        smf_flush();
+}
+
+static void smf_put32(uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) smf_put((uint8_t)(value >> shift));
+}
+
+static void smf_put_vlq(uint32_t value) {
+    int shift = 21;
+    while (shift > 0 && (value >> shift) == 0) shift -= 7;
+    for (; shift > 0; shift -= 7) smf_put(0x80 | ((value >> shift) & 0x7F));
+    smf_put(value & 0x7F);
+}
+
+static void smf_put_event(int32_t tick, uint8_t status, uint8_t data1, uint8_t data2) {
+    smf_put_vlq((uint32_t)(tick - last_tick));
+    last_tick = tick;
+    smf_put(status);
+    smf_put(data1);
+    smf_put(data2);
+}
+
+// Tempo and time signature at the start of the track.
+static void smf_put_meta(void) {
+    uint32_t us_per_quarter = (uint32_t)(6000000000ull / bpm_x100);
+    const uint8_t meta[] = {
+        0x00, 0xFF, 0x51, 0x03, us_per_quarter >> 16, us_per_quarter >> 8, us_per_quarter,
+        0x00, 0xFF, 0x58, 0x04, LOOPER_BEATS_PER_BAR, 0x02, 0x18, 0x08,
+    };
+    for (size_t i = 0; i < sizeof(meta); i++) smf_put(meta[i]);
+}
+
+static void smf_put_end(void) {
+    int32_t end = total_steps * SMF_EXPORT_STEP_TICKS;
+    smf_put_event(end > last_tick ? end : last_tick, 0xFF, 0x2F, 0x00);
+}
+
+static uint16_t step_lfo(uint16_t step) { return (uint16_t)(step * LFO_RATE); }
+
+// Tick of `step` on the grid moved by swing and groove.
+static int32_t step_tick(uint16_t step) {
+    float swing_ratio = ghost_note_render_swing_ratio(&ghost, step_lfo(step));
+    int32_t q15 = groove_step_q15(step % LOOPER_TOTAL_STEPS, swing_ratio);
+    return step * SMF_EXPORT_STEP_TICKS + ((q15 * SMF_EXPORT_STEP_TICKS) >> 15);
+}
+
+static void window_add(size_t *count, int32_t tick, uint8_t t, uint8_t velocity) {
+    int32_t begin = window * SMF_EXPORT_STEP_TICKS;
+    int32_t end = begin + SMF_EXPORT_STEP_TICKS;
+    if (tick < 0)
+        tick = 0;
+    const track_t *track = &tracks[t];
+    if (tick >= begin && tick < end && *count < SMF_EXPORT_WINDOW_EVENTS)
+        events[(*count)++] = (smf_event_t){tick, 0x90 | track->channel, track->note, velocity};
+    tick += SMF_EXPORT_GATE_TICKS;
+    if (tick >= begin && tick < end && *count < SMF_EXPORT_WINDOW_EVENTS)
+        events[(*count)++] = (smf_event_t){tick, 0x80 | track->channel, track->note, 0};
+}
+
+// Adds the note-ons and note-offs of `step` that fall in the current window.
+static void window_add_step(size_t *count, uint16_t step) {
+    uint8_t s = step % LOOPER_TOTAL_STEPS;
+    int32_t tick = step_tick(step);
+    track_mask_t hits = render.hits[s] & active;
+
+    for (track_mask_t mask = hits; mask != 0; mask &= mask - 1) {
+        uint8_t t = __builtin_ctz(mask);
+        const step_record_t *record = &render.records[s][t];
+        int32_t offset = record->offset * SMF_EXPORT_STEP_TICKS / LOOPER_MICROTIMING_ONE;
+        uint8_t velocity = record->velocity;
+        if (velocity == 0) {
+            // An early hit is scheduled, and modulated, on the tick before its step
+            uint16_t lfo = step_lfo(record->offset < 0 ? step - 1 : step);
+            velocity = ghost_note_modulate_base_velocity(&tracks[t], 0x7f, lfo);
+        }
+        window_add(count, tick + offset, t, velocity);
+    }
+    for (track_mask_t mask = ghost_plays[step]; mask != 0; mask &= mask - 1) {
+        uint8_t t = __builtin_ctz(mask);
+        window_add(count, tick, t, tracks[t].ghost_velocity);
+    }
+    for (track_mask_t mask = fill_plays[step]; mask != 0; mask &= mask - 1)
+        window_add(count, tick, __builtin_ctz(mask), 0x7f);
+}
+
+/*
+ * Adds the captured notes that fall in the current window. The ring is in
+ * the order the notes were played, which is step order give or take a
+ * step, so the search starts from the oldest note still in reach.
+ */
+static void window_add_captured(size_t *count) {
+    int first = window - SMF_EXPORT_SPREAD_BEFORE;
+    int last = window + SMF_EXPORT_SPREAD_AFTER;
+    while (capture_cursor < capture_notes &&
+           capture_steps_from(capture_start, capture_get(capture_cursor)) < first - 1)
+        capture_cursor++;
+
+    for (uint16_t i = capture_cursor; i < capture_notes; i++) {
+        capture_note_t note = capture_get(i);
+        int step = capture_steps_from(capture_start, note);
+        if (step > last + 1)
+            break;
+        if (step < first || step > last || step < 0 || step >= total_steps)
+            continue;
+        int32_t offset = (int8_t)note.offset * SMF_EXPORT_STEP_TICKS / LOOPER_MICROTIMING_ONE;
+        window_add(count, step * SMF_EXPORT_STEP_TICKS + offset, note.track, note.velocity);
+    }
+}
+
+// Writes every event within the tick range of step `window`, in time order.
+static void smf_put_window(void) {
+    size_t count = 0;
+    if (from_capture) {
+        window_add_captured(&count);
+    } else {
+        for (int step = window - SMF_EXPORT_SPREAD_BEFORE;
+             step <= window + SMF_EXPORT_SPREAD_AFTER; step++) {
+            if (step >= 0 && step < total_steps)
+                window_add_step(&count, step);
+        }
+    }
+
+    for (size_t i = 1; i < count; i++) {  // note-offs before note-ons on the same tick
+        smf_event_t e = events[i];
+        size_t j = i;
+        for (; j > 0 && (events[j - 1].tick > e.tick ||
+                         (events[j - 1].tick == e.tick && events[j - 1].status > e.status));
+             j--)
+            events[j] = events[j - 1];
+        events[j] = e;
+    }
+    for (size_t i = 0; i < count; i++)
+        smf_put_event(events[i].tick, events[i].status, events[i].data1, events[i].data2);
+}
+
+// Steps spilling past the last one: its microtiming, swing and gate.
+static uint16_t smf_last_window(void) { return total_steps + SMF_EXPORT_SPREAD_BEFORE; }
+
+// Plays the copied pattern through the export's ghost engine for one more bar.
+static void smf_render_bar(void) {
+    if (rendered_steps == 0) {
+        memset(render.fills, 0, sizeof(render.fills));
+        ghost_note_render_create(&ghost, &render);
+    }
+    for (uint16_t n = 0; n < SMF_EXPORT_BAR_STEPS; n++) {
+        uint16_t step = rendered_steps++;
+        uint8_t s = step % LOOPER_TOTAL_STEPS;
+        if (step > 0)
+            ghost_note_render_step(&ghost, &render, s, &bar_counter);
+        track_mask_t hits = render.hits[s] & active;
+        track_mask_t fills = render.fills[s] & active;
+        track_mask_t ghosts = 0;
+        for (track_mask_t mask = active & ~fills; mask != 0; mask &= mask - 1) {
+            uint8_t t = __builtin_ctz(mask);
+            if (ghost_note_render_is_active(&ghost, &render.ghost_notes[s][t]))
+                ghosts |= TRACK_BIT(t);
+        }
+        ghost_plays[step] = ghosts;
+        fill_plays[step] = fills & ~hits;
+    }
+}
+
+// Starts the pass that measures the track chunk.
+static void smf_count_begin(void) {
+    counting = true;
+    counted_bytes = 0;
+    last_tick = 0;
+    smf_put_meta();
+    window = 0;
+    capture_cursor = 0;
+    state = SMF_EXPORT_COUNT;
+}
+
+// Writes the windows of one bar, or whatever is left of the track.
+static bool smf_put_bar(void) {
+    for (uint16_t n = 0; n < SMF_EXPORT_BAR_STEPS; n++) {
+        if (window > smf_last_window()) {
+            smf_put_end();
+            return true;
+        }
+        smf_put_window();
+        window++;
+    }
+    return false;
+}
+
+/*
+ * Starts exporting `bars` bars of the current loop from the next loop
+ * start. Only the copies of the pattern and of the ghost parameters are
+ * made here, under the timer lock, with a seed drawn from rand(); rendering
+ * and streaming are spread over the following main loop passes.
+ * Returns false while another export is running.
+ */
+bool smf_export_start(uint8_t bars) {
+    if (state != SMF_EXPORT_IDLE || bars == 0 || bars > SMF_EXPORT_MAX_BARS)
+        return false;
+
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    size_t num_tracks;
+    memcpy(tracks, looper_tracks_get(&num_tracks), sizeof(tracks));
+    render = *looper_pattern_get();
+    active = looper_active_tracks();
+    bpm_x100 = looper_status_get()->bpm_x100;
+    ghost_note_render_init(&ghost, (uint32_t)rand());
+    async_context_release_lock(async_timer_async_context());
+
+    from_capture = false;
+    total_bars = bars;
+    total_steps = bars * SMF_EXPORT_BAR_STEPS;
+    rendered_steps = 0;
+    bar_counter = 0;
+    state = SMF_EXPORT_RENDER;
+    return true;
+}
+
+/*
+ * Starts exporting the last `bars` complete bars of the capture ring, as
+ * they were played. Returns false while another export is running.
+ */
+bool smf_export_start_capture(uint8_t bars) {
+    if (state != SMF_EXPORT_IDLE || bars == 0 || bars > SMF_EXPORT_MAX_BARS)
+        return false;
+
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    size_t num_tracks;
+    memcpy(tracks, looper_tracks_get(&num_tracks), sizeof(tracks));
+    bpm_x100 = looper_status_get()->bpm_x100;
+    async_context_release_lock(async_timer_async_context());
+
+    capture_hold(true);
+    uint32_t now = capture_position();
+    capture_start = now - now % SMF_EXPORT_BAR_STEPS - bars * SMF_EXPORT_BAR_STEPS;
+    capture_notes = capture_count();
+    from_capture = true;
+    total_bars = bars;
+    total_steps = bars * SMF_EXPORT_BAR_STEPS;
+    smf_count_begin();
+    return true;
+}
+
+bool smf_export_busy(void) { return state != SMF_EXPORT_IDLE; }
+
+// Called from the main loop: does the next bar's worth of an export in progress.
+void smf_export_task(void) {
+    switch (state) {
+        case SMF_EXPORT_RENDER:
+            smf_render_bar();
+            if (rendered_steps < total_steps)
+                break;
+            smf_count_begin();
+            break;
+        case SMF_EXPORT_COUNT:
+            if (!smf_put_bar())
+                break;
+            counting = false;
+            printf("[SMF] begin bars=%u bytes=%lu\n", total_bars,
+                   (unsigned long)(14 + 8 + counted_bytes));
+            state = SMF_EXPORT_HEADER;
+            break;
+        case SMF_EXPORT_HEADER: {
+            static const uint8_t header[] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1};
+            for (size_t i = 0; i < sizeof(header); i++) smf_put(header[i]);
+            smf_put(SMF_EXPORT_PPQN >> 8);
+            smf_put(SMF_EXPORT_PPQN & 0xFF);
+            smf_put('M');
+            smf_put('T');
+            smf_put('r');
+            smf_put('k');
+            smf_put32(counted_bytes);
+            last_tick = 0;
+            smf_put_meta();
+            window = 0;
+            capture_cursor = 0;
+            state = SMF_EXPORT_EVENTS;
+            break;
+        }
+        case SMF_EXPORT_EVENTS:
+            if (!smf_put_bar())
+                break;
+            smf_flush();
+            printf("[SMF] end\n");
+            if (from_capture)
+                capture_hold(false);
+            state = SMF_EXPORT_IDLE;
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,433 @@
+/*
+ * sysex.c
+ *
+ * SysEx bulk dump and load of patterns, ghost parameters and session state.
+ * The session is serialised into a small fixed image that is streamed in
+ * 7-bit packed chunks, one chunk in flight at a time. Every chunk carries a
+ * checksum and must be acknowledged before the next one is sent, so neither
+ * side ever holds more than one encoded message.
+ *
+ * All transfer work runs from the main loop via sysex_task(). A completed
+ * load is built there into the standby pattern, ghost notes included, the
+ * way pattern banks preload; the step timer merely swaps it in at the next
+ * loop boundary through sysex_apply_pending_load(), and flash persistence is
+ * deferred back to the main loop so the tick never waits on a flash erase.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "sysex.h"
+
+#include <string.h>
+
+#include "drivers/async_timer.h"
+#include "drivers/ble_midi.h"
+#include "drivers/storage.h"
+#include "drivers/usb_midi.h"
+#include "ghost_note.h"
+#include "hot_path.h"
+#include "looper.h"
+#include "midi_control.h"
+#include "pattern_bank.h"
+#include "pico/time.h"
+
+#define SYSEX_RETRY_TIMEOUT_US (500 * 1000)
+#define SYSEX_MAX_RETRIES 3
+#define SYSEX_MIN_BPM 40  // Tempo range of the BPM controller and tap tempo
+#define SYSEX_MAX_BPM 240
+
+typedef enum {
+    SYSEX_STATE_IDLE = 0,
+    SYSEX_STATE_DUMP_WAIT_ACK,  // DATA sent, waiting for ACK
+    SYSEX_STATE_DUMP_WAIT_END,  // END sent, waiting for ACK
+    SYSEX_STATE_LOAD,           // receiving DATA chunks
+} sysex_state_t;
+
+// Reassembly buffer for one incoming SysEx stream
+typedef struct {
+    uint8_t buffer[SYSEX_MAX_MESSAGE_BYTES];
+    size_t length;
+    bool active;
+} sysex_rx_t;
+
+typedef struct {
+    sysex_state_t state;
+    sysex_port_t port;
+    uint16_t seq;
+    uint16_t total_length;
+    uint8_t retries;
+    uint64_t deadline_us;
+    uint8_t tx[SYSEX_MAX_MESSAGE_BYTES];
+    size_t tx_length;
+    size_t tx_offset;
+} sysex_session_t;
+
+static sysex_rx_t rx[SYSEX_PORT_COUNT];
+static sysex_session_t session;
+static sysex_image_t dump_image;
+static sysex_image_t load_image;
+static volatile bool load_pending = false;  // Image received, standby not built yet
+static volatile bool load_ready = false;    // Standby built, swap at the next loop start
+static volatile bool load_due = false;      // Swap decided on the last step of the loop
+
+// Pack 8-bit data into 7-bit groups: one MSB byte followed by up to 7 data bytes.
+size_t sysex_pack7(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i += 7) {
+        size_t group = (len - i < 7) ? len - i : 7;
+        uint8_t msb = 0;
+        for (size_t j = 0; j < group; j++) {
+            if (src[i + j] & 0x80)
+                msb |= 1u << j;
+        }
+        dst[out++] = msb;
+        for (size_t j = 0; j < group; j++) dst[out++] = src[i + j] & 0x7F;
+    }
+    return out;
+}
+
+// Inverse of sysex_pack7(). Returns the number of raw bytes written.
+size_t sysex_unpack7(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i += 8) {
+        uint8_t msb = src[i];
+        for (size_t j = 1; j < 8 && i + j < len; j++)
+            dst[out++] = src[i + j] | (((msb >> (j - 1)) & 0x01) << 7);
+    }
+    return out;
+}
+
+static uint8_t sysex_checksum(const uint8_t *data, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) sum ^= data[i];
+    return sum & 0x7F;
+}
+
+// Encode one message into the session transmit buffer.
+static void sysex_queue_message(sysex_command_t cmd, uint16_t seq, const uint8_t *data,
+                                size_t len) {
+    uint8_t *m = session.tx;
+    size_t n = 0;
+    m[n++] = 0xF0;
+    m[n++] = SYSEX_MANUFACTURER_ID;
+    m[n++] = SYSEX_DEVICE_ID;
+    m[n++] = cmd;
+    m[n++] = seq & 0x7F;
+    m[n++] = (seq >> 7) & 0x7F;
+    m[n++] = (uint8_t)len;
+    n += sysex_pack7(data, len, &m[n]);
+    m[n] = sysex_checksum(&m[3], n - 3);
+    n++;
+    m[n++] = 0xF7;
+    session.tx_length = n;
+    session.tx_offset = 0;
+}
+
+static void sysex_send_reply(sysex_command_t cmd, uint16_t seq) {
+    sysex_queue_message(cmd, seq, NULL, 0);
+}
+
+// Push as much of the transmit buffer as the port accepts without blocking.
+static void sysex_flush(void) {
+    if (session.tx_offset >= session.tx_length)
+        return;
+    const uint8_t *data = &session.tx[session.tx_offset];
+    size_t remaining = session.tx_length - session.tx_offset;
+    if (session.port == SYSEX_PORT_USB) {
+        session.tx_offset += usb_midi_send_sysex(data, remaining);
+    } else if (ble_midi_send_sysex(data, remaining)) {
+        session.tx_offset = session.tx_length;
+    }
+}
+
+static void sysex_image_capture(sysex_image_t *image) {
+    looper_status_t *looper = looper_status_get();
+    const ghost_parameters_t *params = ghost_note_parameters();
+    const looper_pattern_t *pattern = looper_pattern_get();
+
+    memset(image, 0, sizeof(*image));
+    memcpy(image->magic, SYSEX_IMAGE_MAGIC, sizeof(image->magic));
+    image->version = SYSEX_IMAGE_VERSION;
+    image->num_tracks = looper->num_tracks;
+    image->total_steps = LOOPER_TOTAL_STEPS;
+    image->current_track = looper->current_track;
+    image->bpm = (uint16_t)looper->bpm;
+    for (size_t t = 0; t < LOOPER_MAX_TRACKS && t < SYSEX_MAX_TRACKS; t++) {
+        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+            if (looper_pattern_hit(pattern, t, i))
+                image->pattern[t][i / 8] |= 1u << (i % 8);
+        }
+    }
+    image->ghost_intensity = params->ghost_intensity;
+    image->boundary_before_probability = params->boundary.before_probability;
+    image->boundary_after_probability = params->boundary.after_probability;
+    image->euclid_k_max = params->euclidean.k_max;
+    image->euclid_k_sufficient = params->euclidean.k_sufficient;
+    image->euclid_k_intensity = params->euclidean.k_intensity;
+    image->euclid_probability = params->euclidean.probability;
+    image->fill_interval_bar = params->fill.interval_bar;
+    image->fill_start_mean = params->fill.start_mean;
+    image->fill_start_sd = params->fill.start_sd;
+    image->fill_probability = params->fill.probability;
+}
+
+// False for NaN as well, which compares false with everything.
+static bool in_range(float value, float min, float max) { return value >= min && value <= max; }
+
+// The ranges are those of the MIDI controllers that set each parameter.
+static bool sysex_image_is_valid(const sysex_image_t *image) {
+    return memcmp(image->magic, SYSEX_IMAGE_MAGIC, sizeof(image->magic)) == 0 &&
+           image->version == SYSEX_IMAGE_VERSION && image->num_tracks >= 1 &&
+           image->num_tracks <= LOOPER_MAX_TRACKS && image->total_steps == LOOPER_TOTAL_STEPS &&
+           image->current_track < image->num_tracks && image->bpm >= SYSEX_MIN_BPM &&
+           image->bpm <= SYSEX_MAX_BPM && image->euclid_k_max >= 1 && image->euclid_k_max <= 16 &&
+           image->euclid_k_sufficient <= image->euclid_k_max && image->fill_interval_bar > 0 &&
+           in_range(image->ghost_intensity, 0.0f, 1.0f) &&
+           in_range(image->boundary_before_probability, 0.0f, 1.0f) &&
+           in_range(image->boundary_after_probability, 0.0f, 1.0f) &&
+           in_range(image->euclid_k_intensity, 0.0f, 1.0f) &&
+           in_range(image->euclid_probability, 0.0f, 1.0f) &&
+           in_range(image->fill_start_mean, 0.0f, LOOPER_TOTAL_STEPS) &&
+           in_range(image->fill_start_sd, 0.0f, LOOPER_TOTAL_STEPS / 2) &&
+           in_range(image->fill_probability, 0.0f, 1.0f);
+}
+
+// Copies the ghost parameters of `image` into `params`, leaving the others as they are.
+static void sysex_image_parameters(const sysex_image_t *image, ghost_parameters_t *params) {
+    params->ghost_intensity = image->ghost_intensity;
+    params->boundary.before_probability = image->boundary_before_probability;
+    params->boundary.after_probability = image->boundary_after_probability;
+    params->euclidean.k_max = image->euclid_k_max;
+    params->euclidean.k_sufficient = image->euclid_k_sufficient;
+    params->euclidean.k_intensity = image->euclid_k_intensity;
+    params->euclidean.probability = image->euclid_probability;
+    params->fill.interval_bar = image->fill_interval_bar;
+    params->fill.start_mean = image->fill_start_mean;
+    params->fill.start_sd = image->fill_start_sd;
+    params->fill.probability = image->fill_probability;
+}
+
+static void sysex_dump_send_chunk(void) {
+    size_t offset = (size_t)session.seq * SYSEX_CHUNK_BYTES;
+    if (offset >= sizeof(dump_image)) {
+        uint8_t length[2] = {sizeof(dump_image) & 0xFF, sizeof(dump_image) >> 8};
+        sysex_queue_message(SYSEX_CMD_END, session.seq, length, sizeof(length));
+        session.state = SYSEX_STATE_DUMP_WAIT_END;
+    } else {
+        size_t len = sizeof(dump_image) - offset;
+        if (len > SYSEX_CHUNK_BYTES)
+            len = SYSEX_CHUNK_BYTES;
+        sysex_queue_message(SYSEX_CMD_DATA, session.seq, (const uint8_t *)&dump_image + offset,
+                            len);
+        session.state = SYSEX_STATE_DUMP_WAIT_ACK;
+    }
+    session.deadline_us = time_us_64() + SYSEX_RETRY_TIMEOUT_US;
+}
+
+static void sysex_handle_dump(sysex_command_t cmd, uint16_t seq) {
+    switch (cmd) {
+        case SYSEX_CMD_ACK:
+            if (seq != session.seq)
+                break;
+            if (session.state == SYSEX_STATE_DUMP_WAIT_END) {
+                session.state = SYSEX_STATE_IDLE;
+                break;
+            }
+            session.seq++;
+            session.retries = 0;
+            sysex_dump_send_chunk();
+            break;
+        case SYSEX_CMD_NAK:
+            if (seq == session.seq)
+                sysex_dump_send_chunk();
+            break;
+        default:
+            break;
+    }
+}
+
+static void sysex_handle_load(sysex_command_t cmd, uint16_t seq, const uint8_t *data,
+                              size_t len) {
+    switch (cmd) {
+        case SYSEX_CMD_DATA: {
+            size_t offset = (size_t)seq * SYSEX_CHUNK_BYTES;
+            if (seq + 1 == session.seq) {  // duplicate after a lost ACK
+                sysex_send_reply(SYSEX_CMD_ACK, seq);
+            } else if (seq != session.seq || offset + len > session.total_length) {
+                sysex_send_reply(SYSEX_CMD_NAK, session.seq);
+            } else {
+                memcpy((uint8_t *)&load_image + offset, data, len);
+                sysex_send_reply(SYSEX_CMD_ACK, seq);
+                session.seq++;
+            }
+            break;
+        }
+        case SYSEX_CMD_END:
+            if ((size_t)session.seq * SYSEX_CHUNK_BYTES >= session.total_length &&
+                sysex_image_is_valid(&load_image)) {
+                load_pending = true;
+                sysex_send_reply(SYSEX_CMD_ACK, seq);
+            } else {
+                sysex_send_reply(SYSEX_CMD_NAK, seq);
+            }
+            session.state = SYSEX_STATE_IDLE;
+            break;
+        default:
+            break;
+    }
+    session.deadline_us = time_us_64() + SYSEX_RETRY_TIMEOUT_US * SYSEX_MAX_RETRIES;
+}
+
+// Decode a complete F0..F7 message and advance the transfer state machine.
+static void sysex_handle_message(sysex_port_t port, const uint8_t *m, size_t len) {
+    if (len < 9 || m[1] != SYSEX_MANUFACTURER_ID || m[2] != SYSEX_DEVICE_ID)
+        return;
+    size_t encoded_length = len - 9;
+    if (sysex_checksum(&m[3], 4 + encoded_length) != m[len - 2])
+        return;
+
+    sysex_command_t cmd = m[3];
+    uint16_t seq = m[4] | (m[5] << 7);
+    uint8_t data[SYSEX_CHUNK_BYTES + 1];
+    size_t data_length = sysex_unpack7(&m[7], encoded_length, data);
+    if (data_length != m[6])
+        return;
+
+    if (session.state != SYSEX_STATE_IDLE && port != session.port)
+        return;  // one transfer at a time
+
+    switch (cmd) {
+        case SYSEX_CMD_DUMP_REQUEST:
+            session = (sysex_session_t){.port = port};
+            sysex_image_capture(&dump_image);
+            sysex_dump_send_chunk();
+            return;
+        case SYSEX_CMD_LOAD_BEGIN:
+            session = (sysex_session_t){.port = port};
+            session.total_length = (data_length == 2) ? (data[0] | (data[1] << 8)) : 0;
+            if (load_pending || load_ready || session.total_length != sizeof(load_image)) {
+                sysex_send_reply(SYSEX_CMD_NAK, seq);
+                return;
+            }
+            memset(&load_image, 0, sizeof(load_image));
+            session.state = SYSEX_STATE_LOAD;
+            session.deadline_us = time_us_64() + SYSEX_RETRY_TIMEOUT_US * SYSEX_MAX_RETRIES;
+            sysex_send_reply(SYSEX_CMD_ACK, seq);
+            return;
+        default:
+            break;
+    }
+
+    if (session.state == SYSEX_STATE_LOAD)
+        sysex_handle_load(cmd, seq, data, data_length);
+    else if (session.state != SYSEX_STATE_IDLE)
+        sysex_handle_dump(cmd, seq);
+}
+
+/*
+ * Feed raw MIDI bytes received on `port`. Bytes outside F0..F7 are ignored,
+ * so callers may pass whole USB-MIDI packet payloads.
+ */
+void sysex_receive(sysex_port_t port, const uint8_t *data, size_t len) {
+    sysex_rx_t *r = &rx[port];
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = data[i];
+        if (b == 0xF0) {
+            r->active = true;
+            r->length = 0;
+        } else if (!r->active || b >= 0xF8) {
+            continue;  // not in a message, or real-time interleaved in it
+        } else if (b & 0x80 && b != 0xF7) {
+            r->active = false;  // stray status byte aborts the message
+            continue;
+        }
+        if (r->length >= sizeof(r->buffer)) {
+            r->active = false;
+            continue;
+        }
+        r->buffer[r->length++] = b;
+        if (b == 0xF7) {
+            r->active = false;
+            sysex_handle_message(port, r->buffer, r->length);
+        }
+    }
+}
+
+/*
+ * Builds the received image in the standby pattern, ghost notes included,
+ * with the image's own ghost parameters. Holds the async context lock, as
+ * a bank preload does, so the step timer never sees it half done.
+ */
+static void sysex_prepare_load(void) {
+    async_context_acquire_lock_blocking(async_timer_async_context());
+    ghost_parameters_t params = *ghost_note_parameters();
+    sysex_image_parameters(&load_image, &params);
+
+    looper_pattern_t *standby = pattern_bank_claim_standby();
+    memset(standby, 0, sizeof(*standby));
+    for (size_t t = 0; t < LOOPER_MAX_TRACKS && t < SYSEX_MAX_TRACKS; t++) {
+        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+            if ((load_image.pattern[t][i / 8] >> (i % 8)) & 0x01)
+                standby->hits[i] |= TRACK_BIT(t);
+        }
+    }
+    for (size_t t = 0; t < load_image.num_tracks; t++) ghost_note_create_with(standby, t, &params);
+    load_pending = false;
+    load_ready = true;
+    async_context_release_lock(async_timer_async_context());
+}
+
+// Called from the main loop: push pending output, retry on timeout, stage loads.
+void sysex_task(void) {
+    sysex_flush();
+
+    if (session.state != SYSEX_STATE_IDLE && time_us_64() > session.deadline_us) {
+        if (session.state != SYSEX_STATE_LOAD && session.retries < SYSEX_MAX_RETRIES) {
+            session.retries++;
+            sysex_dump_send_chunk();
+        } else {
+            session.state = SYSEX_STATE_IDLE;  // peer went away
+        }
+    }
+
+    if (load_pending)
+        sysex_prepare_load();
+}
+
+/*
+ * Called by the step timer on the last step of the loop: decides whether a
+ * prepared load swaps in at the coming loop start, so the early hits of its
+ * downbeat can be scheduled from it.
+ */
+bool HOT_PATH_FUNC(sysex_load_due)(void) {
+    load_due = load_ready;
+    return load_due;
+}
+
+/*
+ * Swap the load decided on the last step into the live session. Called by
+ * the step timer right before step 0 is performed, so the new loop starts
+ * on a downbeat.
+ */
+void HOT_PATH_FUNC(sysex_apply_pending_load)(void) {
+    if (!load_due)
+        return;
+    load_due = false;
+
+    looper_status_t *looper = looper_status_get();
+
+    sysex_image_parameters(&load_image, ghost_note_parameters_edit());
+    ghost_note_parameters_commit();
+    ghost_note_parameters_sync();  // already on the loop boundary: take effect now
+
+    looper_set_num_tracks(load_image.num_tracks);
+    pattern_bank_swap_claimed();
+    looper->current_track = load_image.current_track;
+    if (looper->clock_source == LOOPER_CLOCK_INTERNAL)
+        looper_update_bpm(load_image.bpm);
+    midi_control_init();  // knobs continue from the loaded values
+
+    load_ready = false;
+    storage_request_store_tracks();
+}
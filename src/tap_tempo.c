@@ -5,7 +5,8 @@
  *
  * ENTER : BUTTON_EVENT_LONG_HOLD_RELEASE (≥ 2 s)
  * EXIT : BUTTON_EVENT_HOLD_RELEASE (≥ 0.5 s)
- * Resets after 1 s inactivity or after 4 taps.
+ * Resets after 2 s inactivity. The tempo is refitted on every tap over the
+ * last 16 taps, so a longer tap run keeps refining it.
  *
  * Copyright 2025, Hiroyuki OYAMA
  *
@@ -22,8 +23,26 @@
 enum {
     TAP_MIN_BPM = 40,  // clamp lower bound
     TAP_MAX_BPM = 240,
-    TAP_MAX_TAPS = 4,
-    TIMEOUT_US = 1000 * 1000,  // 1 s idle-timeout
+    TAP_MAX_TAPS = 16,              // rolling regression window
+    TAP_OUTLIER_MIN_US = 15 * 1000,  // never reject taps closer than this to the fit
+    TIMEOUT_US = 2000 * 1000,       // 2 s idle-timeout (longer than a beat at TAP_MIN_BPM)
+};
+
+#define TAP_FIT_FRACTION_BITS 8  // period is computed in 1/256 µs
+
+/*
+ * Confidence is 100 when the period is known to within 0.25 % (95 %
+ * interval), where a two-bar loop drifts less than 10 ms a pass against the
+ * tapped beat, and 0 at 2 %, where it drifts by more than half a sixteenth
+ * at 120 BPM. In 1/10000 of the period. test_tap_tempo checks the reported
+ * confidence against the actual error of jittered taps.
+ */
+#define TAP_CONFIDENCE_FULL_BP 25
+#define TAP_CONFIDENCE_NONE_BP 200
+
+// Two-sided 95 % Student t quantiles x100 by degrees of freedom (taps in the fit - 2).
+static const uint16_t t95_x100[TAP_MAX_TAPS - 1] = {
+    0, 1271, 430, 318, 278, 257, 245, 236, 231, 226, 223, 220, 218, 216, 214,
 };
 
 typedef enum { TT_IDLE, TT_COLLECT } tt_state_t;
@@ -31,36 +50,170 @@ typedef enum { TT_IDLE, TT_COLLECT } tt_state_t;
 // Internal state
 typedef struct {
     tt_state_t state;
-    uint64_t stamp[TAP_MAX_TAPS];
-    uint8_t count;   // current tap count [0-4]
-    bool is_active;  // detect COLLECT mode
+    uint64_t stamp[TAP_MAX_TAPS];  // ring buffer of tap times
+    uint8_t head;                  // next slot to write
+    uint8_t count;                 // taps in the window [0-TAP_MAX_TAPS]
+    bool is_active;                // detect COLLECT mode
 } tap_ctx_t;
 
+typedef struct {
+    int64_t intercept_q8;  // µs since the first tap
+    int64_t period_q8;     // µs per beat
+} tap_fit_t;
+
 static tap_ctx_t ctx = {0};
-static uint16_t latest_bpm = 120;
+static uint32_t latest_bpm_x100 = 12000;
+static uint8_t latest_confidence = 0;
 
-// convert intervals to BPM and clamp to range
-static uint16_t calc_bpm(uint64_t first_us, uint64_t last_us, uint8_t intervals) {
-    uint64_t delta_us = last_us - first_us;
-    if (delta_us == 0)
-        return TAP_MIN_BPM;
+static int32_t median(int32_t *v, uint8_t n) {
+    for (uint8_t i = 1; i < n; i++) {
+        int32_t x = v[i];
+        uint8_t j = i;
+        for (; j > 0 && v[j - 1] > x; j--)
+            v[j] = v[j - 1];
+        v[j] = x;
+    }
+    return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
 
-    // Convert µs interval to BPM using integer math
-    uint32_t delta_ms = (uint32_t)((delta_us + 500) / 1000);
-    uint32_t bpm = (60000U * intervals + delta_ms / 2) / delta_ms;
+static uint32_t isqrt64(uint64_t x) {
+    uint64_t r = 0;
+    for (uint64_t bit = 1ull << 62; bit != 0; bit >>= 2) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+    }
+    return (uint32_t)r;
+}
 
-    // clamp to TAP_MIN_BPM .. TAP_MAX_BPM
-    if (bpm < TAP_MIN_BPM)
-        bpm = TAP_MIN_BPM;
-    if (bpm > TAP_MAX_BPM)
-        bpm = TAP_MAX_BPM;
+// Least-squares fit of tap time against beat index over the taps marked in `use`.
+static bool fit_line(const int32_t *y, const int32_t *x, const bool *use, uint8_t n,
+                     tap_fit_t *fit) {
+    int64_t sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int64_t m = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        if (!use[i])
+            continue;
+        sx += x[i];
+        sy += y[i];
+        sxx += (int64_t)x[i] * x[i];
+        sxy += (int64_t)x[i] * y[i];
+        m++;
+    }
+    int64_t den = m * sxx - sx * sx;
+    if (m < 2 || den == 0)
+        return false;
+    fit->period_q8 = ((m * sxy - sx * sy) << TAP_FIT_FRACTION_BITS) / den;
+    fit->intercept_q8 = ((sy << TAP_FIT_FRACTION_BITS) - fit->period_q8 * sx) / m;
+    return fit->period_q8 > 0;
+}
 
-    return (uint16_t)bpm;
+static inline int32_t fit_residual(const tap_fit_t *fit, int32_t x, int32_t y) {
+    return y - (int32_t)((fit->intercept_q8 + fit->period_q8 * x) >> TAP_FIT_FRACTION_BITS);
 }
 
-// Public API: main FSM event handler
-tap_result_t taptempo_handle_event(button_event_t ev) {
-    uint64_t now = time_us_64();
+/*
+ * Estimates the beat period from the taps in the window.
+ *
+ * Each tap is assigned a beat index by rounding its distance from the first
+ * tap to the median interval, so a skipped beat does not bend the fit. A
+ * least-squares line through (index, time) gives the period. Taps whose
+ * residual is further than 3 scaled MADs from the median residual are then
+ * dropped and the line is refitted. Confidence (0-100) falls with the
+ * width of the period's 95 % confidence interval, from the slope's standard
+ * error and the Student t quantile for the taps used: few taps need a
+ * tighter fit for the same confidence.
+ */
+static bool calc_tempo(void) {
+    int32_t y[TAP_MAX_TAPS], x[TAP_MAX_TAPS], scratch[TAP_MAX_TAPS];
+    bool use[TAP_MAX_TAPS];
+    uint8_t n = ctx.count;
+    uint8_t first = (ctx.head + TAP_MAX_TAPS - n) % TAP_MAX_TAPS;
+
+    for (uint8_t i = 0; i < n; i++)
+        y[i] = (int32_t)(ctx.stamp[(first + i) % TAP_MAX_TAPS] - ctx.stamp[first]);
+    for (uint8_t i = 1; i < n; i++)
+        scratch[i - 1] = y[i] - y[i - 1];
+    int32_t interval = median(scratch, n - 1);
+    if (interval <= 0)
+        return false;
+    for (uint8_t i = 0; i < n; i++) {
+        x[i] = (y[i] + interval / 2) / interval;
+        use[i] = true;
+    }
+
+    tap_fit_t fit;
+    if (!fit_line(y, x, use, n, &fit))
+        return false;
+
+    uint8_t used = n;
+    if (n >= 4) {
+        for (uint8_t i = 0; i < n; i++)
+            scratch[i] = fit_residual(&fit, x[i], y[i]);
+        int32_t center = median(scratch, n);
+        for (uint8_t i = 0; i < n; i++) {
+            int32_t d = fit_residual(&fit, x[i], y[i]) - center;
+            scratch[i] = d < 0 ? -d : d;
+        }
+        int32_t mad = median(scratch, n);
+        int32_t limit = mad * 4448 / 1000;  // 3 x 1.4826 x MAD (normal-consistent)
+        if (limit < TAP_OUTLIER_MIN_US)
+            limit = TAP_OUTLIER_MIN_US;
+        for (uint8_t i = 0; i < n; i++) {
+            int32_t d = fit_residual(&fit, x[i], y[i]) - center;
+            if (d > limit || d < -limit) {
+                use[i] = false;
+                used--;
+            }
+        }
+        if (used < n && !fit_line(y, x, use, n, &fit))
+            return false;
+    }
+
+    uint64_t bpm_x100 = ((60ull * 1000 * 1000 * 100) << TAP_FIT_FRACTION_BITS) / fit.period_q8;
+    if (bpm_x100 < TAP_MIN_BPM * 100)
+        bpm_x100 = TAP_MIN_BPM * 100;
+    if (bpm_x100 > TAP_MAX_BPM * 100)
+        bpm_x100 = TAP_MAX_BPM * 100;
+    latest_bpm_x100 = (uint32_t)bpm_x100;
+
+    latest_confidence = 0;
+    if (used >= 3) {
+        int64_t sx = 0, sxx = 0;
+        uint64_t sse = 0;
+        for (uint8_t i = 0; i < n; i++) {
+            if (!use[i])
+                continue;
+            int64_t r = fit_residual(&fit, x[i], y[i]);
+            sse += r * r;
+            sx += x[i];
+            sxx += (int64_t)x[i] * x[i];
+        }
+        uint64_t sxx_centered = (sxx * used - sx * sx) / used;
+        // standard error of the period in 1/256 µs, then the interval relative to the period
+        uint64_t se_q8 = isqrt64((sse << (2 * TAP_FIT_FRACTION_BITS)) / (used - 2) /
+                                 (sxx_centered ? sxx_centered : 1));
+        uint64_t bound_bp = se_q8 * t95_x100[used - 2] * 100 / (uint64_t)fit.period_q8;
+        latest_confidence = bound_bp <= TAP_CONFIDENCE_FULL_BP ? 100
+                            : bound_bp >= TAP_CONFIDENCE_NONE_BP
+                                ? 0
+                                : (TAP_CONFIDENCE_NONE_BP - bound_bp) * 100 /
+                                      (TAP_CONFIDENCE_NONE_BP - TAP_CONFIDENCE_FULL_BP);
+    }
+    return true;
+}
+
+static void tap_reset(void) {
+    ctx.count = 0;
+    ctx.head = 0;
+}
+
+// Public API: main FSM event handler; `time_us` is the event's raw edge time.
+tap_result_t taptempo_handle_event(button_event_t ev, uint64_t time_us) {
+    uint64_t now = time_us;
 
     switch (ctx.state) {
         case TT_IDLE:
@@ -68,9 +221,8 @@ tap_result_t taptempo_handle_event(button_event_t ev) {
                 ctx.state = TT_IDLE;
                 return TAP_EXIT;
             } else if (ev == BUTTON_EVENT_CLICK_RELEASE) {
-                ctx.count = 0;
+                tap_reset();
                 ctx.state = TT_COLLECT;
-                ctx.stamp[0] = now;  // mark entry time
             }
             return TAP_NONE;
 
@@ -79,26 +231,20 @@ tap_result_t taptempo_handle_event(button_event_t ev) {
                 ctx.state = TT_IDLE;
                 return TAP_EXIT;
             }
-            if (ctx.count && (now - ctx.stamp[ctx.count ? ctx.count - 1 : 0]) > TIMEOUT_US) {
-                ctx.count = 0;
+            if (ctx.count &&
+                (now - ctx.stamp[(ctx.head + TAP_MAX_TAPS - 1) % TAP_MAX_TAPS]) > TIMEOUT_US) {
+                tap_reset();
                 ctx.state = TT_IDLE;
                 return TAP_NONE;
             } else if (ev == BUTTON_EVENT_CLICK_RELEASE) {
+                ctx.stamp[ctx.head] = now;
+                ctx.head = (ctx.head + 1) % TAP_MAX_TAPS;
                 if (ctx.count < TAP_MAX_TAPS)
-                    ctx.stamp[ctx.count++] = now;
-
-                if (ctx.count >= 2) {
-                    latest_bpm = calc_bpm(ctx.stamp[0], ctx.stamp[ctx.count - 1], ctx.count - 1);
-                }
-                /* 2 taps → PRELIM, 3 taps → FINAL, 4 taps → FINAL+reset */
-                if (ctx.count == 2) {
-                    return TAP_PRELIM;
-                } else if (ctx.count == 3) {
-                    return TAP_FINAL;
-                } else if (ctx.count == TAP_MAX_TAPS) {  // 4 taps
-                    ctx.count = 0;                       // auto-reset
-                    return TAP_FINAL;
-                }
+                    ctx.count++;
+
+                /* 2 taps → PRELIM, 3+ taps → FINAL, refined by every further tap */
+                if (ctx.count >= 2 && calc_tempo())
+                    return (ctx.count == 2) ? TAP_PRELIM : TAP_FINAL;
             }
             return TAP_NONE;
         default:
@@ -108,5 +254,7 @@ tap_result_t taptempo_handle_event(button_event_t ev) {
     }
 }
 
-uint16_t taptempo_get_bpm(void) { return latest_bpm; }
+uint16_t taptempo_get_bpm(void) { return (uint16_t)((latest_bpm_x100 + 50) / 100); }
+uint32_t taptempo_get_bpm_x100(void) { return latest_bpm_x100; }
+uint8_t taptempo_get_confidence(void) { return latest_confidence; }
 bool taptempo_active(void) { return ctx.state == TT_COLLECT; }
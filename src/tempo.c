@@ -0,0 +1,142 @@
+/*
+ * tempo.c
+ *
+ * Tempo-change engine for the internal clock. A requested tempo starts
+ * immediately, on the next beat or on the next bar, and is reached either
+ * at once or through a linear or exponential ramp over a number of bars.
+ *
+ * The step timer asks for the length of every step as it is entered. During
+ * a ramp that length is integrated from the tempo curve over
+ * TEMPO_SUBSTEPS sub-steps (trapezoidal rule on the beat period), and the
+ * sub-microsecond remainder is carried to the next step, so deadlines follow
+ * the curve exactly and the bar after the ramp starts where the integral
+ * says it does instead of where a step-wise BPM change would put it.
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "tempo.h"
+
+#include <math.h>
+
+#include "hot_path.h"
+#include "looper.h"
+
+#define TEMPO_SUBSTEPS 16
+#define TEMPO_STEPS_PER_BAR (LOOPER_STEPS_PER_BEAT * LOOPER_BEATS_PER_BAR)
+#define TEMPO_SUBSTEP_US_AT_1BPM (60.0f * 1000 * 1000 / (LOOPER_STEPS_PER_BEAT * TEMPO_SUBSTEPS))
+
+typedef struct {
+    bool active;
+    tempo_curve_t curve;
+    float bpm;             // tempo at the current sub-step boundary
+    float increment;       // per sub-step: BPM added (linear) or factor (exponential)
+    uint32_t target_x100;  // tempo held once the ramp is complete
+    uint16_t remaining;    // sub-steps left
+} tempo_ramp_t;
+
+static tempo_settings_t settings = {TEMPO_APPLY_IMMEDIATE, TEMPO_CURVE_LINEAR, 0};
+static volatile bool pending = false;
+static volatile uint32_t pending_x100;
+static tempo_ramp_t ramp;
+static float carry_us = 0.0f;  // fractional µs not yet added to a deadline
+
+const tempo_settings_t *tempo_settings(void) { return &settings; }
+
+void tempo_configure(tempo_apply_t apply, tempo_curve_t curve, uint8_t ramp_bars) {
+    settings.apply = apply;
+    settings.curve = curve;
+    settings.ramp_bars = ramp_bars > TEMPO_MAX_RAMP_BARS ? TEMPO_MAX_RAMP_BARS : ramp_bars;
+}
+
+// True when tempo requests are deferred or ramped rather than applied at once.
+bool HOT_PATH_FUNC(tempo_is_scheduled)(void) {
+    return settings.apply != TEMPO_APPLY_IMMEDIATE || settings.ramp_bars > 0;
+}
+
+/*
+ * Requests a new tempo. With immediate application and no ramp it is set
+ * right away, as looper_update_bpm_x100() does; otherwise it replaces any
+ * request still waiting for its beat or bar.
+ */
+void tempo_request_bpm_x100(uint32_t bpm_x100) {
+    if (!tempo_is_scheduled()) {
+        ramp.active = false;
+        looper_update_bpm_x100(bpm_x100);
+        return;
+    }
+    pending_x100 = bpm_x100;
+    pending = true;
+}
+
+// Drops any pending request and stops a running ramp at its current tempo.
+void tempo_cancel(void) {
+    pending = false;
+    ramp.active = false;
+    carry_us = 0.0f;
+}
+
+static bool HOT_PATH_FUNC(tempo_at_boundary)(uint8_t step) {
+    switch (settings.apply) {
+        case TEMPO_APPLY_NEXT_BEAT:
+            return step % LOOPER_STEPS_PER_BEAT == 0;
+        case TEMPO_APPLY_NEXT_BAR:
+            return step % TEMPO_STEPS_PER_BAR == 0;
+        default:
+            return true;
+    }
+}
+
+static void tempo_start(uint32_t target_x100) {
+    float from = looper_status_get()->bpm_x100 / 100.0f;
+    float to = target_x100 / 100.0f;
+
+    ramp.active = false;
+    carry_us = 0.0f;
+    if (settings.ramp_bars == 0 || from <= 0.0f) {
+        looper_update_bpm_x100(target_x100);
+        return;
+    }
+
+    uint16_t substeps = settings.ramp_bars * TEMPO_STEPS_PER_BAR * TEMPO_SUBSTEPS;
+    ramp.curve = settings.curve;
+    ramp.bpm = from;
+    ramp.increment = (ramp.curve == TEMPO_CURVE_EXPONENTIAL)
+                         ? powf(to / from, 1.0f / substeps)
+                         : (to - from) / substeps;
+    ramp.target_x100 = target_x100;
+    ramp.remaining = substeps;
+    ramp.active = true;
+}
+
+/*
+ * Returns the duration of `step`, which starts now, and advances any ramp
+ * through it. Called by the step timer once per internal-clock step.
+ */
+uint32_t HOT_PATH_FUNC(tempo_step_duration_us)(uint8_t step) {
+    if (pending && tempo_at_boundary(step)) {
+        pending = false;
+        tempo_start(pending_x100);
+    }
+    if (!ramp.active)
+        return looper_status_get()->step_period_us;
+
+    float us = carry_us;
+    for (uint8_t i = 0; i < TEMPO_SUBSTEPS && ramp.remaining > 0; i++, ramp.remaining--) {
+        float next = (ramp.curve == TEMPO_CURVE_EXPONENTIAL) ? ramp.bpm * ramp.increment
+                                                                 : ramp.bpm + ramp.increment;
+        us += TEMPO_SUBSTEP_US_AT_1BPM * 0.5f * (1.0f / ramp.bpm + 1.0f / next);
+        ramp.bpm = next;
+    }
+    uint32_t whole_us = (uint32_t)us;
+    carry_us = us - whole_us;
+
+    if (ramp.remaining == 0) {
+        ramp.active = false;
+        looper_update_bpm_x100(ramp.target_x100);
+    } else {
+        looper_update_bpm_x100((uint32_t)(ramp.bpm * 100.0f + 0.5f));
+    }
+    return whole_us;
+}
@@ -0,0 +1,110 @@
+/*
+ * trace.c
+ *
+ * Binary trace of the timing pipeline. Each event is eight bytes (time,
+ * event, phase, argument) written into a RAM ring that keeps the most
+ * recent TRACE_BUFFER_EVENTS; recording is a timer read, one short
+ * interrupt-masked index bump and a store. The step timer, the note
+ * workers and the main loop all record into the same ring.
+ *
+ * `trace dump` on the console stops recording and streams the ring over
+ * CDC as hex lines, one line per main loop pass so the looper keeps
+ * playing. tools/trace_chrome.py turns a captured dump into Chrome trace
+ * JSON for chrome://tracing or Perfetto.
+ *
+ *   [TRACE] begin events=<n> lost=<n>
+ *   [TRACE] <up to 8 events, 16 hex digits each, little-endian>
+ *   [TRACE] end
+ *
+ * Copyright 2025, Hiroyuki OYAMA
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "trace.h"
+
+#include <stdio.h>
+
+#include "hardware/sync.h"
+
+#define TRACE_EVENTS_PER_LINE 8
+
+#if TRACE_ENABLED
+
+static trace_event_t ring[TRACE_BUFFER_EVENTS];
+static volatile uint32_t ring_head = 0;  // Events recorded since the last start
+static volatile bool recording = true;
+static uint32_t dump_position = 0;       // Next event to stream
+static uint32_t dump_end = 0;
+static bool dumping = false;
+
+void __not_in_flash_func(trace_record)(uint32_t time_us, trace_event_id_t id, trace_phase_t phase,
+                                       uint16_t arg) {
+    if (!recording)
+        return;
+    uint32_t flags = save_and_disable_interrupts();
+    uint32_t index = ring_head++;
+    restore_interrupts(flags);
+    ring[index & (TRACE_BUFFER_EVENTS - 1)] = (trace_event_t){time_us, id, phase, arg};
+}
+
+// Clears the ring and records from now on.
+void trace_start(void) {
+    dumping = false;
+    ring_head = 0;
+    recording = true;
+}
+
+void trace_stop(void) { recording = false; }
+
+// Stops recording and starts streaming the ring, oldest event first.
+void trace_dump(void) {
+    trace_stop();
+    uint32_t count = (ring_head < TRACE_BUFFER_EVENTS) ? ring_head : TRACE_BUFFER_EVENTS;
+    dump_position = ring_head - count;
+    dump_end = ring_head;
+    dumping = true;
+    printf("[TRACE] begin events=%lu lost=%lu\n", (unsigned long)count,
+           (unsigned long)(ring_head - count));
+}
+
+bool trace_dumping(void) { return dumping; }
+
+// Called from the main loop: streams one line of a dump in progress.
+void trace_task(void) {
+    if (!dumping)
+        return;
+    if (dump_position == dump_end) {
+        printf("[TRACE] end\n");
+        dumping = false;
+        return;
+    }
+
+    printf("[TRACE] ");
+    for (int i = 0; i < TRACE_EVENTS_PER_LINE && dump_position != dump_end; i++) {
+        const uint8_t *bytes =
+            (const uint8_t *)&ring[dump_position++ & (TRACE_BUFFER_EVENTS - 1)];
+        for (size_t b = 0; b < sizeof(trace_event_t); b++) printf("%02x", bytes[b]);
+    }
+    printf("\n");
+}
+
+#else
+
+void trace_record(uint32_t time_us, trace_event_id_t id, trace_phase_t phase, uint16_t arg) {
+    (void)time_us;
+    (void)id;
+    (void)phase;
+    (void)arg;
+}
+
+void trace_start(void) {}
+
+void trace_stop(void) {}
+
+void trace_dump(void) { printf("[TRACE] built without TRACE_ENABLED\n"); }
+
+bool trace_dumping(void) { return false; }
+
+void trace_task(void) {}
+
+#endif
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+#
+# ghost_sysex.py
+#
+# Host-side encoder/decoder for the Pico MIDI Looper "Ghost" SysEx bulk
+# protocol (see src/sysex.c). Dumps the device session to JSON, loads a JSON
+# session back, and reports transfer throughput.
+#
+#   ghost_sysex.py ports
+#   ghost_sysex.py dump <port> session.json
+#   ghost_sysex.py load <port> session.json
+#
+# Port I/O uses `mido` (pip install mido python-rtmidi).
+#
+# Copyright 2025, Hiroyuki OYAMA
+#
+# SPDX-License-Identifier: BSD-3-Clause
+import json
+import struct
+import sys
+import time
+
+MANUFACTURER_ID = 0x7D
+DEVICE_ID = 0x47
+CHUNK_BYTES = 21
+
+CMD_DUMP_REQUEST = 0x01
+CMD_LOAD_BEGIN = 0x02
+CMD_DATA = 0x03
+CMD_END = 0x04
+CMD_ACK = 0x05
+CMD_NAK = 0x06
+
+IMAGE_VERSION = 2
+MAX_TRACKS = 16
+TOTAL_STEPS = 32
+
+# Mirrors sysex_image_t (little-endian, packed)
+IMAGE_FORMAT = "<4sBBBBH%ds3fBB2fB3f" % (MAX_TRACKS * TOTAL_STEPS // 8)
+IMAGE_FIELDS = (
+    "ghost_intensity", "boundary_before_probability", "boundary_after_probability",
+    "euclid_k_max", "euclid_k_sufficient", "euclid_k_intensity", "euclid_probability",
+    "fill_interval_bar", "fill_start_mean", "fill_start_sd", "fill_probability",
+)
+
+
+def pack7(data):
+    out = bytearray()
+    for i in range(0, len(data), 7):
+        group = data[i:i + 7]
+        msb = 0
+        for j, b in enumerate(group):
+            if b & 0x80:
+                msb |= 1 << j
+        out.append(msb)
+        out.extend(b & 0x7F for b in group)
+    return bytes(out)
+
+
+def unpack7(data):
+    out = bytearray()
+    for i in range(0, len(data), 8):
+        msb = data[i]
+        for j, b in enumerate(data[i + 1:i + 8]):
+            out.append(b | (((msb >> j) & 1) << 7))
+    return bytes(out)
+
+
+def checksum(data):
+    s = 0
+    for b in data:
+        s ^= b
+    return s & 0x7F
+
+
+def encode_message(cmd, seq=0, payload=b""):
+    body = bytes([cmd, seq & 0x7F, (seq >> 7) & 0x7F, len(payload)]) + pack7(payload)
+    return bytes([0xF0, MANUFACTURER_ID, DEVICE_ID]) + body + bytes([checksum(body), 0xF7])
+
+
+def decode_message(msg):
+    """Returns (cmd, seq, payload) or None if the message is not ours or corrupt."""
+    msg = bytes(msg)
+    if len(msg) < 9 or msg[0] != 0xF0 or msg[-1] != 0xF7:
+        return None
+    if msg[1] != MANUFACTURER_ID or msg[2] != DEVICE_ID:
+        return None
+    if checksum(msg[3:-2]) != msg[-2]:
+        return None
+    payload = unpack7(msg[7:-2])
+    if len(payload) != msg[6]:
+        return None
+    return msg[3], msg[4] | (msg[5] << 7), payload
+
+
+def image_to_dict(image):
+    values = struct.unpack(IMAGE_FORMAT, image)
+    magic, version, num_tracks, total_steps, current_track, bpm, bits = values[:7]
+    if magic != b"GHST" or version != IMAGE_VERSION:
+        raise ValueError("unsupported image %r v%d" % (magic, version))
+    stride = total_steps // 8
+    patterns = []
+    for t in range(num_tracks):
+        row = bits[t * stride:(t + 1) * stride]
+        patterns.append("".join("*" if row[i // 8] >> (i % 8) & 1 else "_"
+                                for i in range(total_steps)))
+    session = {"bpm": bpm, "current_track": current_track, "patterns": patterns}
+    session["ghost"] = dict(zip(IMAGE_FIELDS, values[7:]))
+    return session
+
+
+def dict_to_image(session):
+    patterns = session["patterns"][:MAX_TRACKS]
+    bits = bytearray(MAX_TRACKS * TOTAL_STEPS // 8)
+    for t, row in enumerate(patterns):
+        for i, c in enumerate(row[:TOTAL_STEPS]):
+            if c == "*":
+                bits[t * TOTAL_STEPS // 8 + i // 8] |= 1 << (i % 8)
+    ghost = session["ghost"]
+    return struct.pack(IMAGE_FORMAT, b"GHST", IMAGE_VERSION, len(patterns), TOTAL_STEPS,
+                       session["current_track"], session["bpm"], bytes(bits),
+                       *(ghost[k] for k in IMAGE_FIELDS))
+
+
+class Link:
+    def __init__(self, name):
+        import mido
+        self.mido = mido
+        self.inport = mido.open_input(name)
+        self.outport = mido.open_output(name)
+
+    def send(self, msg):
+        self.outport.send(self.mido.Message("sysex", data=msg[1:-1]))
+
+    def receive(self, timeout=1.0):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            for m in self.inport.iter_pending():
+                if m.type == "sysex":
+                    decoded = decode_message(bytes([0xF0]) + bytes(m.data) + bytes([0xF7]))
+                    if decoded:
+                        return decoded
+            time.sleep(0.0005)
+        raise TimeoutError("no reply from device")
+
+
+def dump(link):
+    image = bytearray()
+    link.send(encode_message(CMD_DUMP_REQUEST))
+    while True:
+        cmd, seq, payload = link.receive()
+        if cmd == CMD_DATA and seq * CHUNK_BYTES == len(image):
+            image.extend(payload)
+            link.send(encode_message(CMD_ACK, seq))
+        elif cmd == CMD_DATA:
+            link.send(encode_message(CMD_ACK, seq))  # duplicate
+        elif cmd == CMD_END:
+            link.send(encode_message(CMD_ACK, seq))
+            if len(image) != struct.unpack("<H", payload)[0]:
+                raise IOError("length mismatch")
+            return bytes(image)
+
+
+def transact(link, msg, seq, retries=3):
+    for _ in range(retries):
+        link.send(msg)
+        try:
+            cmd, reply_seq, _ = link.receive()
+        except TimeoutError:
+            continue
+        if cmd == CMD_ACK and reply_seq == seq:
+            return
+    raise IOError("device rejected chunk %d" % seq)
+
+
+def load(link, image):
+    transact(link, encode_message(CMD_LOAD_BEGIN, 0, struct.pack("<H", len(image))), 0)
+    seq = 0
+    for offset in range(0, len(image), CHUNK_BYTES):
+        transact(link, encode_message(CMD_DATA, seq, image[offset:offset + CHUNK_BYTES]), seq)
+        seq += 1
+    transact(link, encode_message(CMD_END, seq), seq)
+
+
+def report(label, nbytes, elapsed):
+    print("%s %d bytes in %.1f ms (%.0f B/s)" % (label, nbytes, elapsed * 1000,
+                                                 nbytes / elapsed if elapsed else 0))
+
+
+def main(argv):
+    if len(argv) >= 2 and argv[1] == "ports":
+        import mido
+        print("\n".join(mido.get_input_names()))
+        return 0
+    if len(argv) != 4 or argv[1] not in ("dump", "load"):
+        print("usage: ghost_sysex.py ports | dump|load <port> <file.json>")
+        return 2
+    link = Link(argv[2])
+    start = time.monotonic()
+    if argv[1] == "dump":
+        image = dump(link)
+        report("dump", len(image), time.monotonic() - start)
+        with open(argv[3], "w") as f:
+            json.dump(image_to_dict(image), f, indent=2)
+    else:
+        with open(argv[3]) as f:
+            image = dict_to_image(json.load(f))
+        load(link, image)
+        report("load", len(image), time.monotonic() - start)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
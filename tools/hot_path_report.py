@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# hot_path_report.py
+#
+# Lists what the step tick path still runs or reads from flash. The call
+# graph is taken from a disassembly of the firmware ELF: direct calls and
+# branches, calls through long-branch veneers, and function addresses
+# loaded from literal pools (workers and callbacks). Every function
+# reachable from the roots is placed by its address, as are the data
+# objects, such as constant tables, the reached functions load.
+#
+#   hot_path_report.py [--objdump tool] [--nm tool] firmware.elf root ...
+#
+# Built by the hot_path_report target of the firmware CMake project. Each
+# line gives where the symbol lives, its size and the function it was
+# first reached from.
+#
+# Copyright 2025, Hiroyuki OYAMA
+#
+# SPDX-License-Identifier: BSD-3-Clause
+import argparse
+import collections
+import re
+import subprocess
+import sys
+
+FLASH = (0x10000000, 0x20000000)  # XIP window, cached and uncached aliases
+SRAM = (0x20000000, 0x30000000)
+
+FUNCTION_HEADER = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+BRANCH = re.compile(r"\s(?:blx?|b(?:[a-z]{2})?(?:\.[nw])?)\s+"  # bl, b.n, beq.n, ...
+                    r"[0-9a-f]+ <([^>+]+)(?:\+0x[0-9a-f]+)?>")
+LITERAL = re.compile(r"\s\.word\s+0x([0-9a-f]+)")
+VENEER = re.compile(r"^__(.+)_veneer$")
+
+
+def region(address):
+    if FLASH[0] <= address < FLASH[1]:
+        return "flash"
+    if SRAM[0] <= address < SRAM[1]:
+        return "sram"
+    return "rom"
+
+
+def read_symbols(nm, elf):
+    """Returns {name: (address, size, type)} and the data objects sorted by address."""
+    symbols = {}
+    objects = []
+    output = subprocess.run([nm, "-S", "--defined-only", elf], capture_output=True, text=True,
+                            check=True).stdout
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        address, size, kind, name = int(fields[0], 16), int(fields[1], 16), fields[2], fields[3]
+        symbols.setdefault(name, (address, size, kind))
+        if kind in "rRdDbB" and size > 0:
+            objects.append((address, size, name))
+    objects.sort()
+    return symbols, objects
+
+
+def read_graph(objdump, elf):
+    """Returns {function: (callees, literal words)} from the disassembly."""
+    graph = collections.defaultdict(lambda: (set(), set()))
+    current = None
+    output = subprocess.run([objdump, "-d", elf], capture_output=True, text=True,
+                            check=True).stdout
+    for line in output.splitlines():
+        header = FUNCTION_HEADER.match(line)
+        if header:
+            current = header.group(2)
+            continue
+        if current is None:
+            continue
+        branch = BRANCH.search(line)
+        if branch and branch.group(1) != current:
+            graph[current][0].add(branch.group(1))
+        literal = LITERAL.search(line)
+        if literal:
+            graph[current][1].add(int(literal.group(1), 16))
+    return graph
+
+
+def object_at(objects, address):
+    low, high = 0, len(objects)
+    while low < high:
+        middle = (low + high) // 2
+        if objects[middle][0] <= address:
+            low = middle + 1
+        else:
+            high = middle
+    if low > 0:
+        start, size, name = objects[low - 1]
+        if address < start + size:
+            return name
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="List the tick path symbols still in flash.")
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("elf")
+    parser.add_argument("roots", nargs="+")
+    args = parser.parse_args()
+
+    symbols, objects = read_symbols(args.nm, args.elf)
+    functions = {address & ~1: name for name, (address, _, kind) in symbols.items()
+                 if kind in "tTwW"}
+    graph = read_graph(args.objdump, args.elf)
+
+    reached = {}  # function -> the function it was first reached from
+    data = {}     # data object -> the function that first loads its address
+    queue = collections.deque()
+    for root in args.roots:
+        if root not in symbols:
+            print(f"[HOT] unknown root {root}", file=sys.stderr)
+            return 1
+        reached[root] = None
+        queue.append(root)
+    while queue:
+        function = queue.popleft()
+        callees, literals = graph[function]
+        targets = set()
+        for callee in callees:
+            veneer = VENEER.match(callee)
+            targets.add(veneer.group(1) if veneer else callee)
+        for word in literals:
+            if (word & ~1) in functions and word & 1:
+                targets.add(functions[word & ~1])
+            else:
+                name = object_at(objects, word)
+                if name is not None and name not in data:
+                    data[name] = function
+        for target in sorted(targets):
+            if target in symbols and target not in reached:
+                reached[target] = function
+                queue.append(target)
+
+    in_flash = [name for name in reached if region(symbols[name][0]) == "flash"]
+    print(f"[HOT] roots: {' '.join(args.roots)}")
+    print(f"[HOT] functions reached: {len(reached)}, in flash: {len(in_flash)}")
+    for name in in_flash:
+        address, size, _ = symbols[name]
+        print(f"flash 0x{address:08x} {size:6d} {name:40s} from {reached[name] or '-'}")
+    flash_data = [name for name in data if region(symbols[name][0]) == "flash"]
+    print(f"[HOT] data objects read: {len(data)}, in flash: {len(flash_data)}")
+    for name in flash_data:
+        address, size, _ = symbols[name]
+        print(f"flash 0x{address:08x} {size:6d} {name:40s} from {data[name]}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
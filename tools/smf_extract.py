@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# smf_extract.py
+#
+# Extracts a Standard MIDI File exported on the Pico MIDI Looper console
+# (`smf [bars]`, see src/smf_export.c) into a .mid file. Any console output
+# around the export is ignored, so a plain serial capture works as input;
+# if it holds several exports, the last complete one is written.
+#
+#   smf_extract.py capture.log loop.mid
+#   smf_extract.py - loop.mid < capture.log
+#
+# Copyright 2025, Hiroyuki OYAMA
+#
+# SPDX-License-Identifier: BSD-3-Clause
+import sys
+
+
+def read_export(lines):
+    export = None
+    data = None
+    expected = 0
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("[SMF] "):
+            continue
+        body = line[len("[SMF] "):]
+        if body.startswith("begin"):
+            fields = dict(field.split("=", 1) for field in body.split()[1:] if "=" in field)
+            expected = int(fields.get("bytes", 0))
+            data = bytearray()
+        elif body == "end":
+            if data is not None and len(data) == expected:
+                export = bytes(data)
+            elif data is not None:
+                print("skipping export: %d of %d bytes" % (len(data), expected))
+            data = None
+        elif data is not None:
+            data.extend(bytes.fromhex(body))
+    return export
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage: smf_extract.py <capture.log|-> <loop.mid>")
+        return 2
+    if argv[1] == "-":
+        export = read_export(sys.stdin)
+    else:
+        with open(argv[1], errors="replace") as f:
+            export = read_export(f)
+    if export is None:
+        print("no complete export found")
+        return 1
+    with open(argv[2], "wb") as f:
+        f.write(export)
+    print("%d bytes" % len(export))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
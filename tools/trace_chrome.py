@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# trace_chrome.py
+#
+# Converts a trace dump from the Pico MIDI Looper console (`trace dump`,
+# see src/trace.c) into Chrome trace JSON, to be opened in chrome://tracing
+# or https://ui.perfetto.dev. Any console output around the dump is
+# ignored, so a plain serial capture works as input.
+#
+#   trace_chrome.py capture.log trace.json
+#   trace_chrome.py - trace.json < capture.log
+#
+# Copyright 2025, Hiroyuki OYAMA
+#
+# SPDX-License-Identifier: BSD-3-Clause
+import json
+import struct
+import sys
+
+EVENT_FORMAT = "<IBBH"  # Mirrors trace_event_t
+EVENT_SIZE = struct.calcsize(EVENT_FORMAT)
+
+# Mirrors trace_event_id_t: (name, thread the event runs on)
+EVENT_NAMES = (
+    ("tick", "step timer"),
+    ("ghost", "step timer"),
+    ("note schedule", "step timer"),
+    ("worker", "note workers"),
+    ("dispatch", "main loop"),
+    ("usb write", "main loop"),
+    ("ble notify", "bluetooth"),
+    ("button", "input"),
+    ("midi clock", "input"),
+)
+THREADS = ("step timer", "note workers", "main loop", "bluetooth", "input")
+
+
+def read_events(lines):
+    events = []
+    in_dump = False
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("[TRACE] "):
+            continue
+        body = line[len("[TRACE] "):]
+        if body.startswith("begin"):
+            events = []
+            in_dump = True
+        elif body == "end":
+            in_dump = False
+        elif in_dump:
+            data = bytes.fromhex(body)
+            events.extend(struct.iter_unpack(EVENT_FORMAT, data[:len(data) // EVENT_SIZE *
+                                                                   EVENT_SIZE]))
+    return events
+
+
+def to_chrome(events):
+    out = [{"name": "thread_name", "ph": "M", "pid": 1, "tid": tid,
+            "args": {"name": name}} for tid, name in enumerate(THREADS)]
+    base = None
+    previous = 0
+    wraps = 0
+    for time_us, event_id, phase, arg in events:
+        if base is not None and time_us < previous and previous - time_us > 1 << 31:
+            wraps += 1  # 32-bit microsecond clock rolled over
+        previous = time_us
+        ts = time_us + (wraps << 32)
+        if base is None:
+            base = ts
+        name, thread = EVENT_NAMES[event_id] if event_id < len(EVENT_NAMES) else (
+            "event %d" % event_id, "input")
+        event = {"name": name, "ph": chr(phase), "ts": ts - base, "pid": 1,
+                 "tid": THREADS.index(thread), "args": {"arg": arg}}
+        if event["ph"] == "i":
+            event["s"] = "t"
+        out.append(event)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage: trace_chrome.py <capture.log|-> <trace.json>")
+        return 2
+    if argv[1] == "-":
+        events = read_events(sys.stdin)
+    else:
+        with open(argv[1], errors="replace") as f:
+            events = read_events(f)
+    with open(argv[2], "w") as f:
+        json.dump(to_chrome(events), f)
+    print("%d events" % len(events))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))